@@ -32,6 +32,7 @@ static struct iwstatus iwds_statmsgs[] = {
   /* error */
   { E_DSPATH_INCORRECT, "error: datastore path '%s' is incorrect" },
   { E_FAIL_CHECKFILE, "error: failed to check the file of datastore, '%s'" },
+  { E_FAIL_FALLOCATE, "error: failed to allocate %ld bytes for '%s' on datastore: %s" },
   { E_FAIL_FREAD, "error: failed to read from datastore, '%s'" },
   { E_FAIL_FWRITE, "error: failed to write to datastore, '%s'" },
   { E_FAIL_MALLOC, "error: failed memory allocation, %s" },
@@ -42,25 +43,29 @@ static struct iwstatus iwds_statmsgs[] = {
 
 static struct iwstatus iwds_statvmsgs[] = {
   /* error verbose */
-  { EV_DSESSION_NOTFOUND, "error: datastore session not found, '%d', '%s'" },
-  { EV_FAIL_ADD_DSESSION, "error: faild to add a datastore session" },
-  { EV_FAIL_CREATE_DSESSION, "error: could not create a new session of datastore, '%d', '%s'" },
-  { EV_FAIL_FCLOSE, "error: fclose: failed, %s: %s" },
-  { EV_FAIL_FOPEN, "error: fopen: failed, '%s': %s" },
+  { EV_FAIL_CREATE_DSESSION, "error: could not create a new session of datastore, '%s'" },
+  { EV_FAIL_INDEX, "error: could not index datastore '%s', checking the files by stat: %s" },
+  { EV_FAIL_CLOSE, "error: close: failed, %s: %s" },
+  { EV_FAIL_OPEN, "error: open: failed, '%s': %s" },
   { EV_FAIL_JOIN_PATH, "error: failed to join path '%s' and '%s'" },
   { EV_FAIL_REALPATH, "error: realpath: failed to convert '%s': %s" },
+  { EV_FAIL_STAT, "error: stat: failed, '%s': %s" },
+  { EV_FAIL_RELEASE, "error: failed to release the space reserved for '%s': %s" },
+  { EV_FAIL_UNLINK, "error: unlink: failed, '%s': %s" },
   { EV_NODSREQ, "error: request was not passed" },
   { EV_NULL_OBJ, "error: invalid object" },
 #ifdef DEBUG
   /* debugging */
   { DBG_READ_END, "DBG: end of reading" },
   { DBG_READ, "DBG: reading from the filesystem" },
-  { DBG_FREAD, "DBG: read: datalen=%d, fp=%p, file=%s" },
-  { DBG_FWRITE, "DBG: wrote: datalen=%d, fp=%p, file=%s" },
+  { DBG_FREAD, "DBG: read: datalen=%d, offset=%ld, fd=%d, file=%s" },
+  { DBG_FWRITE, "DBG: wrote: datalen=%d, offset=%ld, fd=%d, file=%s" },
   { DBG_WRITE_END, "DBG: end of writing" },
-  { DBG_RETRIEVE_DSESSION, "DBG: retrieving the dsession, id=%d, file=%s" },
-  { DBG_DSREQ, "DBG: dsreq: dsid=%d, dfile=%s, dbuf=%s, dlen=%d, derr=%d" },
+  { DBG_DSREQ, "DBG: dsreq: dfile=%s, dbuf=%s, dlen=%d, doff=%ld, derr=%d" },
   { DBG_WRITE, "DBG: writing to the filesystem" },
+  { DBG_OPEN, "DBG: opening a file on the filesystem" },
+  { DBG_CREATE, "DBG: creating a file on the filesystem" },
+  { DBG_GETSIZE, "DBG: getting the size of a file in the filesystem" },
   { DBG_SET_CHROOT, "DBG: setting a chroot flag" },
   { DBG_CLEANUP_DSESSION, "DBG: clean up all dsession" },
   { DBG_DSPATH, "DBG: datastore path, dspath=%s, fchroot=%d" },
@@ -71,14 +76,16 @@ static struct iwstatus iwds_statvmsgs[] = {
   { DBG_CHECK_FILE, "DBG: checking a file in the filesystem" },
   { DBG_FSTAT, "DBG: get status, path=%s" },
   { DBG_FOPEN, "DBG: open the file, path=%s, mode=%s" },
+  { DBG_FALLOCATE, "DBG: preallocate the file, path=%s, size=%ld" },
   { DBG_ADD_DSESSION, "DBG: add a new dsession" },
-  { DBG_FCLOSE, "DBG: closing the file, fp=%p, file=%s" },
+  { DBG_FCLOSE, "DBG: closing the file, fd=%d, file=%s" },
   { DBG_DEL_DSESSION, "DBG: delete a dsession" },
   { DBG_REMAIN_DSESSION, "DBG: remains of dsession" },
   { DBG_DSESSION_EMPTY, "DBG: dsession is empty" },
-  { DBG_DSESSION, "DBG: DSESSION: clid=%d, fp=%p, file=%s, derr=%d" },
-  { DBG_DSESSION_ALL, "DBG: DSESSION %d: clid=%d, fp=%p, file=%s, derr=%d" },
+  { DBG_DSESSION, "DBG: DSESSION: fd=%d, file=%s, derr=%d" },
+  { DBG_DSESSION_ALL, "DBG: DSESSION %d: fd=%d, file=%s, derr=%d" },
   { DBG_CLOSE_DSESSION, "DBG: closing the dsession" },
+  { DBG_DSFILE, "DBG: DSFILE: fd=%d, nrefs=%d, fstale=%d, file=%s" },
 #endif  /* DEBUG */
   { 0, NULL }
 };
@@ -92,6 +99,7 @@ static struct iwstatus iwds_dsreq_errmsgs[] = {
   { DSERR_NOSESSION, "no the session of datastore" },
   { DSERR_READFAIL, "file reading error" },
   { DSERR_WRITEFAIL, "file writing error" },
+  { DSERR_NOSPACE, "no space left on datastore" },
   { 0, NULL }
 };
 
@@ -129,9 +137,22 @@ iwds_init(const char *datastore)
     goto err;
   }
   memset(pds, 0, sizeof(IWDS));
+
+  if (! (pds->negs = calloc(DSNEG_SIZE, sizeof(struct dsneg)))) {
+    pmsg(E_FAIL_MALLOC, __FUNCTION__);
+    free(pds);
+    goto err;
+  }
   
   pds->dspath = path;
   pds->fchroot = IW_FALSE;
+  pthread_mutex_init(&pds->lock, NULL);
+  pthread_mutex_init(&pds->neglock, NULL);
+
+  /* without the index, e.g. over the limit of inotify watches, the files are checked by stat */
+  if (! (pds->index = dsix_init(path))) {
+    pmsg(EV_FAIL_INDEX, path, strerror(errno));
+  }
 
   return pds;
 
@@ -141,14 +162,14 @@ iwds_init(const char *datastore)
 }
 
 
-extern size_t
-iwds_read(IWDS *ds, struct dsreq *req)
+/* open an existing file for reading */
+extern IWDSFILE *
+iwds_open(IWDS *ds, struct dsreq *req)
 {
-  DBG_PRINT(DBG_READ);
-  struct dsession *ses = NULL;
-  size_t rlen = 0;
+  DBG_PRINT(DBG_OPEN);
+  struct dsession *ses;
   int32_t errcode;
-    
+
   if (! ds) {
     pmsg(EV_NULL_OBJ);
     errcode = DSERR_INVALIDOBJ;
@@ -163,60 +184,35 @@ iwds_read(IWDS *ds, struct dsreq *req)
 
   DBG_SH_DSREQ(req);
 
-  switch (is_dsfile(ds->dspath, req->dfile)) {
-  case IW_ERR:
-    pmsg(E_FAIL_CHECKFILE, req->dfile);
-    errcode = DSERR_INTERERROR;
-    goto err;
-  case IW_FALSE:
-    pmsg(E_FILE_NOTEXIST, req->dfile);
-    errcode = DSERR_NOTEXIST;
-    goto err;
-  }
-
-  DBG_SH_QUERY(req->dsid, req->dfile);
-  
-  if (! (ses = get_dsession(ds->dhead, req->dsid, req->dfile))) {
-    if (! (ses = create_dsession(&ds->dhead, req->dsid, ds->dspath, req->dfile, MODE_READ))) {
-      pmsg(EV_FAIL_CREATE_DSESSION, req->dsid, req->dfile);
-      errcode = DSERR_NOSESSION;
-      goto err;
+  if (! (ses = create_dsession(ds, req->dfile, MODE_READ, 0))) {
+    if (errno == ENOENT || errno == EISDIR) {
+      pmsg(E_FILE_NOTEXIST, req->dfile);
+      errcode = DSERR_NOTEXIST;
     }
-  }
-
-  DBG_SH_DSESSION(ses);
-  
-  if ((rlen = fread(req->dbuf, sizeof(char), req->dlen, ses->fp)) < req->dlen) {
-    if (ferror(ses->fp)) {
-      pmsg(E_FAIL_FREAD, ses->filename);
-      errcode = DSERR_READFAIL;
-      goto err;
+    else {
+      pmsg(EV_FAIL_CREATE_DSESSION, req->dfile);
+      errcode = DSERR_NOSESSION;
     }
-
-    /* EOF */
-    DBG_PRINT(DBG_READ_END);
+    goto err;
   }
 
   req->derr = IW_OK;
-
-  DBG_SH_READ(rlen, ses->fp, ses->filename);
-  return rlen;
+  return ses;
 
  err:
   if (req) req->derr = errcode;
-  if (ds && ds->dhead && ses) del_dsession(&ds->dhead, ses);
-  return rlen;
+  return NULL;
 }
 
 
-extern size_t
-iwds_write(IWDS *ds, struct dsreq *req)
+/* create a new file for writing, preallocating dsize bytes */
+extern IWDSFILE *
+iwds_create(IWDS *ds, struct dsreq *req)
 {
-  DBG_PRINT(DBG_WRITE);
-  struct dsession *ses = NULL;
-  size_t wlen = 0;
+  DBG_PRINT(DBG_CREATE);
+  struct dsession *ses;
   int32_t errcode;
-  
+
   if (! ds) {
     pmsg(EV_NULL_OBJ);
     errcode = DSERR_INVALIDOBJ;
@@ -230,67 +226,97 @@ iwds_write(IWDS *ds, struct dsreq *req)
   }
 
   DBG_SH_DSREQ(req);
-  DBG_SH_QUERY(req->dsid, req->dfile);
-  
-  if (! (ses = get_dsession(ds->dhead, req->dsid, req->dfile))) {
-    switch (is_dsfile(ds->dspath, req->dfile)) {
-    case IW_ERR:
-      pmsg(E_FAIL_CHECKFILE, req->dfile);
-      errcode = DSERR_INTERERROR;
-      goto err;
-    case IW_TRUE:
+
+  if (! (ses = create_dsession(ds, req->dfile, MODE_WRITE, req->dsize))) {
+    if (errno == EEXIST) {
       pmsg(E_FILE_EXIST, req->dfile);
       errcode = DSERR_NOTPERMIT;
-      goto err;
     }
-
-    if (! (ses = create_dsession(&ds->dhead, req->dsid, ds->dspath, req->dfile, MODE_WRITE))) {
-      pmsg(EV_FAIL_CREATE_DSESSION, req->dsid, req->dfile);
-      errcode = DSERR_NOSESSION;
-      goto err;
+    else {
+      errcode = (errno == ENOSPC || errno == EFBIG) ? DSERR_NOSPACE : DSERR_NOSESSION;
+      pmsg(EV_FAIL_CREATE_DSESSION, req->dfile);
     }
+    goto err;
+  }
+
+  /* known before the events of the new file */
+  if (ds->index) {
+    dsix_update(ds->index, req->dfile);
   }
+  del_dsneg(ds, req->dfile);
 
-  DBG_SH_DSESSION(ses);
+  req->derr = IW_OK;
+  return ses;
 
-  if (req->dlen == 0) {
-    DBG_PRINT(DBG_WRITE_END);
+ err:
+  if (req) req->derr = errcode;
+  return NULL;
+}
 
-    /* end of writing */
-    del_dsession(&ds->dhead, ses);
-    req->derr = IW_OK;
 
-    DBG_SH_DSREQ(req);
-    return 0;
+/* read dlen bytes at doff, shorter at the end of the file */
+extern size_t
+iwds_read_at(IWDS *ds, IWDSFILE *fh, struct dsreq *req)
+{
+  DBG_PRINT(DBG_READ);
+  size_t rlen = 0;
+  ssize_t n;
+  int32_t errcode;
+    
+  if (! ds || ! fh) {
+    pmsg(EV_NULL_OBJ);
+    errcode = DSERR_INVALIDOBJ;
+    goto err;
   }
 
-  if ((wlen = fwrite(req->dbuf, sizeof(char), req->dlen, ses->fp)) < req->dlen) {
-    pmsg(E_FAIL_FWRITE, ses->filename);
-    errcode = DSERR_WRITEFAIL;
-    del_dsession(&ds->dhead, ses);
+  if (! req) {
+    pmsg(EV_NODSREQ);
+    errcode = DSERR_NOREQ;
+    goto err;
+  }
+
+  DBG_SH_DSREQ(req);
+  DBG_SH_DSESSION(fh);
+
+  /* short only at the end of the file */
+  while (rlen < req->dlen) {
+    if ((n = pread(fh->fd, (uint8_t *)req->dbuf + rlen, req->dlen - rlen, req->doff + rlen)) == -1) {
+      if (errno == EINTR) {
+	continue;
+      }
+      pmsg(E_FAIL_FREAD, fh->filename);
+      errcode = DSERR_READFAIL;
+      goto err;
+    }
+    if (n == 0) {
+      /* EOF */
+      DBG_PRINT(DBG_READ_END);
+      break;
+    }
+    rlen += n;
   }
 
   req->derr = IW_OK;
 
-  DBG_SH_WRITE(wlen, ses->fp, ses->filename);
-  return wlen;
+  DBG_SH_READ(rlen, req->doff, fh->fd, fh->filename);
+  return rlen;
 
  err:
   if (req) req->derr = errcode;
-  if (ds && ds->dhead && ses) del_dsession(&ds->dhead, ses);
-
-  return wlen;
+  return rlen;
 }
 
 
-extern int32_t
-iwds_close(IWDS *ds, struct dsreq *req)
+/* write dlen bytes at doff */
+extern size_t
+iwds_write_at(IWDS *ds, IWDSFILE *fh, struct dsreq *req)
 {
-  DBG_PRINT(DBG_CLOSE_DSESSION);
-  struct dsession *ses;
+  DBG_PRINT(DBG_WRITE);
+  size_t wlen = 0;
+  ssize_t n;
   int32_t errcode;
   
-  if (! ds) {
+  if (! ds || ! fh) {
     pmsg(EV_NULL_OBJ);
     errcode = DSERR_INVALIDOBJ;
     goto err;
@@ -302,35 +328,121 @@ iwds_close(IWDS *ds, struct dsreq *req)
     goto err;
   }
 
-  DBG_SH_QUERY(req->dsid, req->dfile);
-  if (! (ses = get_dsession(ds->dhead, req->dsid, req->dfile))) {
-    if (req->dlen == 0) {	/* for closing */
-      return IW_OK;
+  DBG_SH_DSREQ(req);
+  DBG_SH_DSESSION(fh);
+
+  while (wlen < req->dlen) {
+    if ((n = pwrite(fh->fd, (uint8_t *)req->dbuf + wlen, req->dlen - wlen, req->doff + wlen)) == -1) {
+      if (errno == EINTR) {
+	continue;
+      }
+      pmsg(E_FAIL_FWRITE, fh->filename);
+      errcode = errno == ENOSPC || errno == EFBIG ? DSERR_NOSPACE : DSERR_WRITEFAIL;
+      goto err;
     }
-    pmsg(EV_DSESSION_NOTFOUND, req->dsid, req->dfile);
-    errcode = DSERR_NOSESSION;
-    goto err;
+    wlen += n;
   }
 
-  del_dsession(&ds->dhead, ses);
   req->derr = IW_OK;
-  return IW_OK;
+
+  DBG_SH_WRITE(wlen, req->doff, fh->fd, fh->filename);
+  return wlen;
 
  err:
   if (req) req->derr = errcode;
-  return IW_ERR;
+  return wlen;
+}
+
+
+/* close the file of the handle, which is invalid after this */
+extern int32_t
+iwds_close(IWDS *ds, IWDSFILE *fh)
+{
+  DBG_PRINT(DBG_CLOSE_DSESSION);
+
+  if (! ds || ! fh) {
+    pmsg(EV_NULL_OBJ);
+    return IW_ERR;
+  }
+
+  return del_dsession(ds, fh);
+}
+
+
+extern int32_t
+iwds_discard(IWDS *ds, IWDSFILE *fh)
+{
+  DBG_PRINT(DBG_CLOSE_DSESSION);
+  char *pathbuf;
+  size_t bufsize;
+
+  if (! ds || ! fh) {
+    pmsg(EV_NULL_OBJ);
+    return IW_ERR;
+  }
+
+  /* created by this session with O_EXCL, so it is not a file of others */
+  if (! fh->shfile) {
+    bufsize = strlen(ds->dspath) + strlen(fh->filename) + 2;
+    if (! (pathbuf = malloc(sizeof(char) * bufsize))) {
+      pmsg(E_FAIL_MALLOC, __FUNCTION__);
+    }
+    else {
+      if (join_path(ds->dspath, fh->filename, pathbuf, bufsize) == -1) {
+	pmsg(EV_FAIL_JOIN_PATH, ds->dspath, fh->filename);
+      }
+      else if (unlink(pathbuf) == -1) {
+	pmsg(EV_FAIL_UNLINK, pathbuf, strerror(errno));
+      }
+      free(pathbuf);
+    }
+    fh->reserved = 0;
+  }
+
+  return del_dsession(ds, fh);
 }
 
 
 extern int32_t
 iwds_isfile(IWDS *ds, const char *filename)
 {
+  DBG_PRINT(DBG_CHECK_FILE);
+  struct dsmeta meta;
+  int32_t ret;
+
   if (! ds) {
     pmsg(EV_NULL_OBJ);
     goto err;
   }
 
-  return is_dsfile(ds->dspath, filename);
+  if ((ret = get_dsmeta(ds, filename, &meta)) != IW_TRUE) {
+    DBG_PRINT(DBG_FILE_NOTEXIST);
+    return ret;
+  }
+  return meta.type == DSIX_REG ? IW_TRUE : IW_FALSE;
+
+ err:
+  return IW_ERR;
+}
+
+
+/* size of the file, from the metadata without opening it */
+extern off_t
+iwds_getsize(IWDS *ds, const char *filename)
+{
+  DBG_PRINT(DBG_GETSIZE);
+  struct dsmeta meta;
+
+  if (! ds) {
+    pmsg(EV_NULL_OBJ);
+    goto err;
+  }
+
+  if (get_dsmeta(ds, filename, &meta) != IW_TRUE || meta.type != DSIX_REG) {
+    DBG_PRINT(DBG_FILE_NOTEXIST);
+    goto err;
+  }
+  return meta.size;
 
  err:
   return IW_ERR;
@@ -351,6 +463,12 @@ iwds_set_chroot(IWDS *ds)
   *(ds->dspath) = '/';
   *(ds->dspath + 1) = '\0';
 
+  /* the directories are watched by the paths in the new root */
+  if (ds->index && dsix_set_root(ds->index, ds->dspath) == IW_ERR) {
+    pmsg(E_FAIL_MALLOC, __FUNCTION__);
+    goto err;
+  }
+
   DBG_SH_DSPATH(ds);
   return IW_OK;
   
@@ -365,6 +483,7 @@ iwds_exit(IWDS *ds)
   DBG_PRINT(DBG_CLEANUP_DSESSION);
   struct dsession *pm;
   struct dsession *tmp;
+  int32_t i;
   
   if (! ds) {
     return;
@@ -373,10 +492,14 @@ iwds_exit(IWDS *ds)
   pm = ds->dhead;
   while (pm) {
     DBG_SH_DSESSION(pm);
-    DBG_CLOSE_FILE(pm->fp, pm->filename);
-    
-    if (fclose(pm->fp) == EOF) {
-      pmsg(EV_FAIL_FCLOSE, pm->filename);
+    if (pm->shfile) {
+      put_dsfile(ds, pm->shfile);
+    }
+    else {
+      DBG_CLOSE_FILE(pm->fd, pm->filename);
+      if (close(pm->fd) == -1) {
+	pmsg(EV_FAIL_CLOSE, pm->filename, strerror(errno));
+      }
     }
     free(pm->filename);
     tmp = pm;
@@ -384,6 +507,13 @@ iwds_exit(IWDS *ds)
     free(tmp);
   }
 
+  dsix_exit(ds->index);
+  for (i = 0; i < DSNEG_SIZE; i++) {
+    free(ds->negs[i].filename);
+  }
+  free(ds->negs);
+  pthread_mutex_destroy(&ds->neglock);
+  pthread_mutex_destroy(&ds->lock);
   free(ds->dspath);
   free(ds);
 }
@@ -404,6 +534,21 @@ iwds_get_dspath(IWDS *ds)
 }
 
 
+extern void
+iwds_get_stats(IWDS *ds, struct dsstats *stats)
+{
+  memset(stats, 0, sizeof(struct dsstats));
+
+  if (! ds) {
+    pmsg(EV_NULL_OBJ);
+    return;
+  }
+
+  stats->neghits = __atomic_load_n(&ds->neghits, __ATOMIC_RELAXED);
+  stats->negmisses = __atomic_load_n(&ds->negmisses, __ATOMIC_RELAXED);
+}
+
+
 extern char *
 iwds_strerr(int32_t ecode)
 {
@@ -490,99 +635,202 @@ is_dspath(const char *dirpath)
 }
 
 
+/* metadata of the file from the index, or by stat if the index doesn't know it
+ * return: IW_TRUE with meta, IW_FALSE if it doesn't exist, or IW_ERR
+ */
 static int32_t
-is_dsfile(const char *rootdir, const char *file)
+get_dsmeta(IWDS *ds, const char *file, struct dsmeta *meta)
 {
-  DBG_PRINT(DBG_CHECK_FILE);
   char *buf = NULL;
   size_t bufsize;
   struct stat st;
-  
-  bufsize = strlen(rootdir) + strlen(file) + 2;
+  uint32_t hkey;
+  int32_t ret;
+
+  if (ds->index && (ret = dsix_lookup(ds->index, file, meta)) != IW_ERR) {
+    return ret;
+  }
+
+  /* probes of missing files, e.g. pxelinux.cfg/01-<MAC> and the prefixes of the IP address */
+  hkey = hash_string(file);
+  if (find_dsneg(ds, file, hkey) == IW_TRUE) {
+    __atomic_add_fetch(&ds->neghits, 1, __ATOMIC_RELAXED);
+    return IW_FALSE;
+  }
+  __atomic_add_fetch(&ds->negmisses, 1, __ATOMIC_RELAXED);
+
+  bufsize = strlen(ds->dspath) + strlen(file) + 2;
   if (! (buf = malloc(sizeof(char) * bufsize))) {
     pmsg(E_FAIL_MALLOC, __FUNCTION__);
     goto err;
   }
 
   /* join path of rootdir and filename */
-  if (join_path(rootdir, file, buf, bufsize) == -1) {
-    pmsg(EV_FAIL_JOIN_PATH, rootdir, file);
+  if (join_path(ds->dspath, file, buf, bufsize) == -1) {
+    pmsg(EV_FAIL_JOIN_PATH, ds->dspath, file);
     goto err;
   }
 
   DBG_STAT_FILE(buf);
 
-  /* check file */
   if (stat(buf, &st) == -1) {
+    if (errno != ENOENT && errno != ENOTDIR) {
+      pmsg(EV_FAIL_STAT, buf, strerror(errno));
+    }
+    else {
+      add_dsneg(ds, file, hkey);
+    }
     free(buf);
-    DBG_PRINT(DBG_FILE_NOTEXIST);
     return IW_FALSE;
   }
 
+  meta->type = S_ISREG(st.st_mode) ? DSIX_REG : S_ISDIR(st.st_mode) ? DSIX_DIR : DSIX_OTHER;
+  meta->size = st.st_size;
+  meta->mtime = st.st_mtim;
+  meta->dev = st.st_dev;
+  meta->ino = st.st_ino;
+
   free(buf);
-  return S_ISREG(st.st_mode) ? IW_TRUE : IW_FALSE;
-    
+  return IW_TRUE;
+
  err:
   free(buf);
   return IW_ERR;
 }
 
 
-static struct dsession *
-get_dsession(struct dsession *head, int32_t id, const char *file)
+/* whether the file was found missing, and the entry is still valid */
+static int32_t
+find_dsneg(IWDS *ds, const char *file, uint32_t hkey)
 {
-  struct dsession *pm;
+  struct dsneg *pm;
+  int32_t ret = IW_FALSE;
 
-  if (! head) {
-    return NULL;
-  }
+  pm = &ds->negs[hkey & (DSNEG_SIZE - 1)];
 
-  pm = head;
-  while (pm) {
-    if (pm->clid == id && strcmp(pm->filename, file) == 0) {
-      break;
+  pthread_mutex_lock(&ds->neglock);
+  if (pm->filename && pm->hkey == hkey && strcmp(pm->filename, file) == 0) {
+    if (pm->expire > get_monotonic_msec() &&
+	(! ds->index || pm->gen == dsix_generation(ds->index))) {
+      ret = IW_TRUE;
+    }
+    else {
+      free(pm->filename);
+      pm->filename = NULL;
     }
-    pm = pm->next;
   }
-  
-  return pm;
+  pthread_mutex_unlock(&ds->neglock);
+  return ret;
+}
+
+
+/* remember the missing file, in place of the entry of the slot */
+static void
+add_dsneg(IWDS *ds, const char *file, uint32_t hkey)
+{
+  struct dsneg *pm;
+  char *name;
+
+  if (! (name = strdup(file))) {
+    return;
+  }
+
+  pm = &ds->negs[hkey & (DSNEG_SIZE - 1)];
+
+  pthread_mutex_lock(&ds->neglock);
+  free(pm->filename);
+  pm->filename = name;
+  pm->hkey = hkey;
+  pm->gen = ds->index ? dsix_generation(ds->index) : 0;
+  pm->expire = get_monotonic_msec() + DSNEG_TTL;
+  pthread_mutex_unlock(&ds->neglock);
+}
+
+
+/* forget the file, created by this process */
+static void
+del_dsneg(IWDS *ds, const char *file)
+{
+  struct dsneg *pm;
+  uint32_t hkey;
+
+  hkey = hash_string(file);
+  pm = &ds->negs[hkey & (DSNEG_SIZE - 1)];
+
+  pthread_mutex_lock(&ds->neglock);
+  if (pm->filename && pm->hkey == hkey && strcmp(pm->filename, file) == 0) {
+    free(pm->filename);
+    pm->filename = NULL;
+  }
+  pthread_mutex_unlock(&ds->neglock);
 }
 
 
+/* open the file, and link the session to the list for cleaning up at exiting */
 static struct dsession *
-create_dsession(struct dsession **head, int32_t id, const char *dir, const char *file, int32_t fmode)
+create_dsession(IWDS *ds, const char *file, int32_t fmode, off_t fsize)
 {
   DBG_PRINT(DBG_ADD_DSESSION);
   struct dsession *node = NULL;
-  FILE *pst = NULL;
+  struct dsfile *shfile = NULL;
+  int fd = -1;
   char *pathbuf = NULL;
   size_t bufsize;
+  int errsv = 0;
 
   /* to make a full path of file */
-  bufsize = strlen(dir) + strlen(file) + 2;
+  bufsize = strlen(ds->dspath) + strlen(file) + 2;
   if (! (pathbuf = malloc(sizeof(char) * bufsize))) {
     pmsg(E_FAIL_MALLOC, __FUNCTION__);
     goto err;
   }
 
-  if (join_path(dir, file, pathbuf, bufsize) == -1) {
-    pmsg(EV_FAIL_JOIN_PATH, dir, file);
+  if (join_path(ds->dspath, file, pathbuf, bufsize) == -1) {
+    pmsg(EV_FAIL_JOIN_PATH, ds->dspath, file);
     goto err;
   }
 
   DBG_OPEN_FILE(pathbuf, fmode);
 
-  if (! (pst = fopen(pathbuf, fmode & MODE_READ ? "r" : "w"))) {
-    pmsg(EV_FAIL_FOPEN, pathbuf, strerror(errno));
+  /* readers of the same file share the descriptor, an existing file is not overwritten */
+  if (fmode & MODE_READ) {
+    if (! (shfile = get_dsfile(ds, file, pathbuf))) {
+      errsv = errno;
+      goto err;
+    }
+    fd = shfile->fd;
+  }
+  else if ((fd = open(pathbuf, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666)) == -1) {
+    errsv = errno;
+    pmsg(EV_FAIL_OPEN, pathbuf, strerror(errno));
     goto err;
   }
 
-  if (! (node = add_dsession(head))) {
-    pmsg(EV_FAIL_ADD_DSESSION);
+  /* reserve the blocks for the expected size, without changing the file size */
+  if (fmode & MODE_WRITE && fsize > 0) {
+    DBG_ALLOC_FILE(pathbuf, fsize);
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, fsize) == -1) {
+      errsv = errno;
+      if (errsv == ENOSPC || errsv == EFBIG) {
+	pmsg(E_FAIL_FALLOCATE, (long)fsize, file, strerror(errsv));
+	close(fd);
+	fd = -1;
+	unlink(pathbuf);
+	goto err;
+      }
+      /* the filesystem may not support it */
+      errsv = 0;
+    }
+  }
+
+  if (! (node = malloc(sizeof(struct dsession)))) {
+    pmsg(E_FAIL_MALLOC, __FUNCTION__);
     goto err;
   }
-  node->fp = pst;
-  node->clid = id;
+  memset(node, 0, sizeof(struct dsession));
+  node->fd = fd;
+  node->shfile = shfile;
+  node->reserved = fmode & MODE_WRITE ? fsize : 0;
 
   if (! (node->filename = malloc(sizeof(char) * (strlen(file) + 1)))) {
     pmsg(E_FAIL_MALLOC, __FUNCTION__);
@@ -590,6 +838,10 @@ create_dsession(struct dsession **head, int32_t id, const char *dir, const char
   }
   strncpy(node->filename, file, strlen(file) + 1);
 
+  pthread_mutex_lock(&ds->lock);
+  add_dsession(&ds->dhead, node);
+  pthread_mutex_unlock(&ds->lock);
+
   free(pathbuf);
 
   DBG_SH_DSESSION(node);
@@ -597,81 +849,244 @@ create_dsession(struct dsession **head, int32_t id, const char *dir, const char
   
  err:
   if (node)
-    del_dsession(head, node);
-  else if (pst)
-    fclose(pst);
+    free(node);
+  if (shfile)
+    put_dsfile(ds, shfile);
+  else if (fd != -1)
+    close(fd);
   free(pathbuf);
+  errno = errsv;
   return NULL;
 }
 
 
-static struct dsession *
-add_dsession(struct dsession **head)
+static void
+add_dsession(struct dsession **head, struct dsession *node)
 {
-  struct dsession *node;
-
-  if (! (node = malloc(sizeof(struct dsession)))) {
-    pmsg(E_FAIL_MALLOC, __FUNCTION__);
-    goto err;
-  }
-  memset(node, 0, sizeof(struct dsession));
-  
+  node->prev = NULL;
+  node->next = *head;
   if (*head) {
     (*head)->prev = node;
-    node->next = *head;
   }
   *head = node;
-
-  return node;
-  
- err:
-  return NULL;
 }
 
 
+/* unlink the session with holding the lock of the list, and close the file */
 static int32_t
-del_dsession(struct dsession **head, struct dsession *node)
+del_dsession(IWDS *ds, struct dsession *node)
 {
   DBG_PRINT(DBG_DEL_DSESSION);
-  struct dsession *pm;
 
-  if (! (pm = get_dsession(*head, node->clid, node->filename))) {
-    pmsg(EV_DSESSION_NOTFOUND, node->clid, node->filename);
-    goto err;
-  }
-
-  if (! pm->prev && pm->next) {
-    pm->next->prev = NULL;
-    *head = pm->next;
-  }
-  else if (pm->prev && pm->next) {
-    pm->prev->next = pm->next;
-    pm->next->prev = pm->prev;
-  }
-  else if (pm->prev && ! pm->next) {
-    pm->prev->next = NULL;
+  pthread_mutex_lock(&ds->lock);
+  if (node->prev) {
+    node->prev->next = node->next;
   }
   else {
-    *head = NULL;
+    ds->dhead = node->next;
+  }
+  if (node->next) {
+    node->next->prev = node->prev;
   }
+  pthread_mutex_unlock(&ds->lock);
 
-  DBG_SH_DSESSION(pm);
+  DBG_SH_DSESSION(node);
   
-  if (pm->fp) {
-    DBG_CLOSE_FILE(pm->fp, pm->filename);
-    if (fclose(pm->fp) == EOF) {
-      pmsg(EV_FAIL_FCLOSE, pm->filename);
+  if (node->shfile) {
+    put_dsfile(ds, node->shfile);
+  }
+  else {
+    if (node->reserved > 0) {
+      release_dsspace(node);
+    }
+    DBG_CLOSE_FILE(node->fd, node->filename);
+    if (close(node->fd) == -1) {
+      pmsg(EV_FAIL_CLOSE, node->filename, strerror(errno));
+    }
+    /* the size written */
+    if (ds->index) {
+      dsix_update(ds->index, node->filename);
     }
   }
-  free(pm->filename);
-  free(pm);
+  free(node->filename);
+  free(node);
 
   DBG_PRINT(DBG_REMAIN_DSESSION);
-  DBG_SH_ALLDSESSION(*head);
   return IW_OK;
+}
+
+
+/* release the preallocated blocks beyond the end of a short upload */
+static void
+release_dsspace(struct dsession *node)
+{
+  struct stat st;
+
+  if (fstat(node->fd, &st) == -1) {
+    pmsg(EV_FAIL_STAT, node->filename, strerror(errno));
+    return;
+  }
+  if (st.st_size >= node->reserved) {
+    return;
+  }
+
+  /* truncating to the same size frees the blocks beyond it, unlike punching a hole (ext4) */
+  if (ftruncate(node->fd, st.st_size) == -1) {
+    pmsg(EV_FAIL_RELEASE, node->filename, strerror(errno));
+  }
+}
+
+
+/* the shared file of the path, opened again if the inode was replaced or changed */
+static struct dsfile *
+get_dsfile(IWDS *ds, const char *file, const char *path)
+{
+  struct dsfile *df = NULL;
+  struct dsfile *pm;
+  struct dsmeta meta;
+  struct stat st;
+  uint32_t hkey;
+  int fd = -1;
+  int errsv = 0;
+
+  hkey = hash_string(file);
+
+  switch (get_dsmeta(ds, file, &meta)) {
+  case IW_TRUE:
+    break;
+  case IW_FALSE:
+    errsv = ENOENT;
+    goto err;
+  default:
+    errsv = ENOMEM;
+    goto err;
+  }
+  /* only regular files are read */
+  if (meta.type != DSIX_REG) {
+    errsv = EISDIR;
+    goto err;
+  }
+
+  pthread_mutex_lock(&ds->lock);
+  if ((pm = find_dsfile(ds, hkey, file, &meta))) {
+    pm->nrefs++;
+    pthread_mutex_unlock(&ds->lock);
+    DBG_SH_DSFILE(pm);
+    return pm;
+  }
+  pthread_mutex_unlock(&ds->lock);
+
+  DBG_OPEN_FILE(path, MODE_READ);
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+    errsv = errno;
+    pmsg(EV_FAIL_OPEN, path, strerror(errno));
+    goto err;
+  }
+  /* the identity of what was opened, the path may have been replaced after stat */
+  if (fstat(fd, &st) == -1) {
+    errsv = errno;
+    pmsg(EV_FAIL_STAT, path, strerror(errno));
+    goto err;
+  }
+  if (! S_ISREG(st.st_mode)) {
+    errsv = EISDIR;
+    goto err;
+  }
+  meta.size = st.st_size;
+  meta.mtime = st.st_mtim;
+  meta.dev = st.st_dev;
+  meta.ino = st.st_ino;
+
+  if (! (df = malloc(sizeof(struct dsfile))) || ! (df->filename = strdup(file))) {
+    errsv = ENOMEM;
+    pmsg(E_FAIL_MALLOC, __FUNCTION__);
+    goto err;
+  }
+  df->hkey = hkey;
+  df->fd = fd;
+  df->nrefs = 1;
+  df->fstale = IW_FALSE;
+  df->meta = meta;
+
+  /* another worker may have opened it meanwhile */
+  pthread_mutex_lock(&ds->lock);
+  if ((pm = find_dsfile(ds, hkey, file, &meta))) {
+    pm->nrefs++;
+    pthread_mutex_unlock(&ds->lock);
+    close(fd);
+    free(df->filename);
+    free(df);
+    DBG_SH_DSFILE(pm);
+    return pm;
+  }
+  df->next = ds->files[hkey & (DSFILES_HASHSIZE - 1)];
+  ds->files[hkey & (DSFILES_HASHSIZE - 1)] = df;
+  pthread_mutex_unlock(&ds->lock);
+
+  DBG_SH_DSFILE(df);
+  return df;
 
  err:
-  return IW_ERR;
+  free(df);
+  if (fd != -1)
+    close(fd);
+  errno = errsv;
+  return NULL;
+}
+
+
+/* the shared file of the same inode with holding the lock, a changed one leaves the buckets */
+static struct dsfile *
+find_dsfile(IWDS *ds, uint32_t hkey, const char *file, const struct dsmeta *meta)
+{
+  struct dsfile **pp;
+  struct dsfile *pm;
+
+  for (pp = &ds->files[hkey & (DSFILES_HASHSIZE - 1)]; (pm = *pp); pp = &pm->next) {
+    if (pm->hkey != hkey || strcmp(pm->filename, file) != 0) {
+      continue;
+    }
+    if (pm->meta.dev == meta->dev && pm->meta.ino == meta->ino && pm->meta.size == meta->size &&
+	pm->meta.mtime.tv_sec == meta->mtime.tv_sec && pm->meta.mtime.tv_nsec == meta->mtime.tv_nsec) {
+      return pm;
+    }
+    /* closed by the last reader */
+    *pp = pm->next;
+    pm->fstale = IW_TRUE;
+    DBG_SH_DSFILE(pm);
+    return NULL;
+  }
+  return NULL;
+}
+
+
+/* release the shared file, closed by the last reader */
+static void
+put_dsfile(IWDS *ds, struct dsfile *df)
+{
+  struct dsfile **pp;
+
+  pthread_mutex_lock(&ds->lock);
+  if (--df->nrefs > 0) {
+    pthread_mutex_unlock(&ds->lock);
+    return;
+  }
+  if (df->fstale == IW_FALSE) {
+    for (pp = &ds->files[df->hkey & (DSFILES_HASHSIZE - 1)]; *pp; pp = &(*pp)->next) {
+      if (*pp == df) {
+	*pp = df->next;
+	break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&ds->lock);
+
+  DBG_CLOSE_FILE(df->fd, df->filename);
+  if (close(df->fd) == -1) {
+    pmsg(EV_FAIL_CLOSE, df->filename, strerror(errno));
+  }
+  free(df->filename);
+  free(df);
 }
 
 
@@ -684,7 +1099,7 @@ dbg_show_dsession(struct dsession *ses)
     pmsg(DBG_DSESSION_EMPTY);
   }
   else {
-    pmsg(DBG_DSESSION, ses->clid, ses->fp, ses->filename, ses->derr);
+    pmsg(DBG_DSESSION, ses->fd, ses->filename, ses->derr);
   }
 }
 
@@ -699,7 +1114,7 @@ dbg_show_alldsession(struct dsession *head)
   }
   else {
     for (i = 1, pm = head; pm; pm = pm->next, i++) {
-      pmsg(DBG_DSESSION_ALL, i, pm->clid, pm->fp, pm->filename, pm->derr);
+      pmsg(DBG_DSESSION_ALL, i, pm->fd, pm->filename, pm->derr);
     }
   }
 }
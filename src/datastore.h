@@ -29,17 +29,22 @@
 
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #include "iw_common.h"
 #include "iw_log.h"
 #include "util.h"
 #include "iw_ds.h"
+#include "dsindex.h"
 
 
 /* constants */
 #define DEFAULT_DATASTORE "/tftpboot"     /* default path of the datastore */
 #define MODE_READ 0x00000001		  /* I/O mode */
 #define MODE_WRITE 0x00000002
+#define DSFILES_HASHSIZE 256		  /* buckets of the files shared by readers, a power of 2 */
+#define DSNEG_SIZE 1024			  /* slots of the negative lookup cache, a power of 2 */
+#define DSNEG_TTL 2000			  /* msec to trust a negative lookup */
 
 
 /* iwds object */
@@ -47,14 +52,41 @@ struct _iwds {
   struct dsession *dhead;	/* head of the session list */
   char *dspath;			/* path of the datastore */
   int32_t fchroot;		/* flag of if chroot */
+  pthread_mutex_t lock;		/* lock of the session list and the shared files, shared by workers */
+  struct dsfile *files[DSFILES_HASHSIZE]; /* files opened for reading, by the filename */
+  struct dsindex *index;	/* metadata of the files, or NULL to stat them */
+  pthread_mutex_t neglock;	/* lock of the negative lookup cache */
+  struct dsneg *negs;		/* files found missing by stat, DSNEG_SIZE slots */
+  uint64_t neghits;		/* counters of the negative lookup cache */
+  uint64_t negmisses;
+};
+
+/* file found missing by stat, not looked up again until it expires or the index changes */
+struct dsneg {
+  char *filename;		/* file path, or NULL if the slot is empty */
+  uint32_t hkey;		/* hash of the filename */
+  uint32_t gen;			/* generation of the index */
+  int64_t expire;		/* monotonic msec */
+};
+
+/* file opened for reading, shared by the sessions of the same file */
+struct dsfile {
+  struct dsfile *next;		/* next in the bucket */
+  uint32_t hkey;		/* hash of the filename */
+  char *filename;		/* file path */
+  int fd;			/* read-only file descriptor */
+  int32_t nrefs;		/* sessions reading the file */
+  int32_t fstale;		/* flag of whether the file was replaced, out of the buckets */
+  struct dsmeta meta;		/* identity of the inode opened */
 };
 
 /* session on the datastore */
 struct dsession {
   struct dsession *next;
   struct dsession *prev;
-  int32_t clid;			/* session ID */
-  FILE *fp;			/* file pointer */
+  int fd;			/* file descriptor, read and written at offsets */
+  struct dsfile *shfile;	/* shared file for reading, or NULL for writing */
+  off_t reserved;		/* bytes preallocated for writing, released beyond the end at closing */
   char *filename;		/* file path */
   int32_t derr;			/* error */
 };
@@ -68,6 +100,7 @@ enum D_STATCODE {
   /* error */
   E_DSPATH_INCORRECT = 1,
   E_FAIL_CHECKFILE,
+  E_FAIL_FALLOCATE,
   E_FAIL_FREAD,
   E_FAIL_FWRITE,
   E_FAIL_MALLOC,
@@ -77,13 +110,15 @@ enum D_STATCODE {
 
 enum D_STATCODE_VERBOSE {
   /* error verbose */
-  EV_DSESSION_NOTFOUND = 65,
-  EV_FAIL_ADD_DSESSION,
-  EV_FAIL_CREATE_DSESSION,
-  EV_FAIL_FCLOSE,
-  EV_FAIL_FOPEN,
+  EV_FAIL_CREATE_DSESSION = 65,
+  EV_FAIL_INDEX,
+  EV_FAIL_CLOSE,
+  EV_FAIL_OPEN,
   EV_FAIL_JOIN_PATH,
   EV_FAIL_REALPATH,
+  EV_FAIL_STAT,
+  EV_FAIL_RELEASE,
+  EV_FAIL_UNLINK,
   EV_NODSREQ,
   EV_NULL_OBJ,            
 #ifdef DEBUG
@@ -93,9 +128,11 @@ enum D_STATCODE_VERBOSE {
   DBG_FREAD,
   DBG_FWRITE,
   DBG_WRITE_END,
-  DBG_RETRIEVE_DSESSION,
   DBG_DSREQ,
   DBG_WRITE,
+  DBG_OPEN,
+  DBG_CREATE,
+  DBG_GETSIZE,
   DBG_SET_CHROOT,
   DBG_CLEANUP_DSESSION,
   DBG_DSPATH,
@@ -106,6 +143,7 @@ enum D_STATCODE_VERBOSE {
   DBG_CHECK_FILE,
   DBG_FSTAT,
   DBG_FOPEN,
+  DBG_FALLOCATE,
   DBG_ADD_DSESSION,
   DBG_FCLOSE,
   DBG_DEL_DSESSION,
@@ -114,6 +152,7 @@ enum D_STATCODE_VERBOSE {
   DBG_DSESSION,
   DBG_DSESSION_ALL,
   DBG_CLOSE_DSESSION,
+  DBG_DSFILE,
 #endif  /* DEBUG */
 };
 
@@ -121,42 +160,47 @@ enum D_STATCODE_VERBOSE {
 /* function prototypes */
 static void pmsg(int32_t statcode, ...);
 static int32_t is_dspath(const char *dirpath);
-static int32_t is_dsfile(const char *rootdir, const char *file);
-static struct dsession *get_dsession(struct dsession *head, int32_t id, const char *file);
-static struct dsession *create_dsession(struct dsession **head, int32_t id,
-					const char *dir, const char *file, int32_t fmode);
-static struct dsession *add_dsession(struct dsession **head);
-static int32_t del_dsession(struct dsession **head, struct dsession *node);
+static int32_t get_dsmeta(IWDS *ds, const char *file, struct dsmeta *meta);
+static int32_t find_dsneg(IWDS *ds, const char *file, uint32_t hkey);
+static void add_dsneg(IWDS *ds, const char *file, uint32_t hkey);
+static void del_dsneg(IWDS *ds, const char *file);
+static struct dsession *create_dsession(IWDS *ds, const char *file, int32_t fmode, off_t fsize);
+static void add_dsession(struct dsession **head, struct dsession *node);
+static int32_t del_dsession(IWDS *ds, struct dsession *node);
+static void release_dsspace(struct dsession *node);
+static struct dsfile *get_dsfile(IWDS *ds, const char *file, const char *path);
+static struct dsfile *find_dsfile(IWDS *ds, uint32_t hkey, const char *file, const struct dsmeta *meta);
+static void put_dsfile(IWDS *ds, struct dsfile *df);
 
 
 /* for debug */
 #ifdef DEBUG
 #define DBG_PRINT(c) pmsg(c)
-#define DBG_CLOSE_FILE(fp, file) pmsg(DBG_FCLOSE, fp, file)
+#define DBG_CLOSE_FILE(fd, file) pmsg(DBG_FCLOSE, fd, file)
 #define DBG_OPEN_FILE(path, mode) pmsg(DBG_FOPEN, path, mode & MODE_READ ? "READ" : "WRITE")
 #define DBG_STAT_FILE(path) pmsg(DBG_FSTAT, path)
-#define DBG_SH_ALLDSESSION(hd) dbg_show_alldsession(hd)
+#define DBG_ALLOC_FILE(path, size) pmsg(DBG_FALLOCATE, path, (long)size)
 #define DBG_SH_DSESSION(s) dbg_show_dsession(s)
+#define DBG_SH_DSFILE(f) pmsg(DBG_DSFILE, f->fd, f->nrefs, f->fstale, f->filename)
 #define DBG_SH_DSPATH(m) pmsg(DBG_DSPATH, m->dspath, m->fchroot)
-#define DBG_SH_DSREQ(r) pmsg(DBG_DSREQ, r->dsid, r->dfile, r->dbuf ? "***" : "null", r->dlen, r->derr)
-#define DBG_SH_QUERY(id, file) pmsg(DBG_RETRIEVE_DSESSION, id, file)
-#define DBG_SH_READ(len, fp, file) pmsg(DBG_FREAD, len, fp, file);
-#define DBG_SH_WRITE(len, fp, file) pmsg(DBG_FWRITE, len, fp, file);
+#define DBG_SH_DSREQ(r) pmsg(DBG_DSREQ, r->dfile ? r->dfile : "null", r->dbuf ? "***" : "null", r->dlen, (long)r->doff, r->derr)
+#define DBG_SH_READ(len, off, fd, file) pmsg(DBG_FREAD, len, (long)off, fd, file);
+#define DBG_SH_WRITE(len, off, fd, file) pmsg(DBG_FWRITE, len, (long)off, fd, file);
 
 static void dbg_show_dsession(struct dsession *ses);
 static void dbg_show_alldsession(struct dsession *head);
 #else
 #define DBG_PRINT(c)
-#define DBG_CLOSE_FILE(fp, file) 
+#define DBG_CLOSE_FILE(fd, file)
 #define DBG_OPEN_FILE(path, mode)
 #define DBG_STAT_FILE(path)
-#define DBG_SH_ALLDSESSION(hd)
+#define DBG_ALLOC_FILE(path, size)
 #define DBG_SH_DSESSION(s)
+#define DBG_SH_DSFILE(f)
 #define DBG_SH_DSPATH(m)
 #define DBG_SH_DSREQ(r)
-#define DBG_SH_QUERY(id, file)
-#define DBG_SH_READ(len, fp, file)
-#define DBG_SH_WRITE(len, fp, file)
+#define DBG_SH_READ(len, off, fd, file)
+#define DBG_SH_WRITE(len, off, fd, file)
 #endif	/* DEBUG */
 
 
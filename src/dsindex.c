@@ -0,0 +1,614 @@
+/*
+ * dsindex.c
+ *
+ * Copyright (c) 2012, Daisuke Sato <bigsplint@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+
+#include "iw_common.h"
+#include "util.h"
+#include "dsindex.h"
+
+/* changes of the entries in the watched directories */
+#define DSIX_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | \
+		   IN_CLOSE_WRITE | IN_ATTRIB | IN_ONLYDIR | IN_EXCL_UNLINK)
+
+/* function prototypes */
+static void *watch_thread(void *arg);
+static void handle_events(struct dsindex *ix, const uint8_t *buf, ssize_t len);
+static void scan_dir(struct dsindex *ix, const char *dir);
+static struct dsentry *put_entry(struct dsindex *ix, const char *path);
+static struct dsentry *find_entry(struct dsindex *ix, const char *path, uint32_t hkey);
+static void del_entry(struct dsindex *ix, const char *path);
+static void del_tree(struct dsindex *ix, const char *dir);
+static void clear_index(struct dsindex *ix);
+static int32_t grow_table(struct dsindex *ix);
+static int32_t set_wdir(struct dsindex *ix, int wd, const char *dir);
+static int32_t normalize_path(const char *file, char *buf, size_t bufsize);
+static int32_t is_under(const char *path, const char *dir);
+
+
+/* To index the files under root, and start the thread keeping them current.
+ * return: the index, or NULL with errno, e.g. without inotify or over max_user_watches
+ */
+extern struct dsindex *
+dsix_init(const char *root)
+{
+  struct dsindex *ix;
+  sigset_t allsigs;
+  sigset_t oldsigs;
+  int errsv;
+  int ret;
+
+  if (! (ix = calloc(1, sizeof(struct dsindex)))) {
+    return NULL;
+  }
+  ix->rootfd = -1;
+  ix->inofd = -1;
+  ix->stopfd = -1;
+  pthread_rwlock_init(&ix->lock, NULL);
+
+  if (! (ix->table = calloc(DSIX_TABLE_INIT, sizeof(struct dsentry *))) ||
+      ! (ix->root = strdup(root))) {
+    goto err;
+  }
+  ix->size = DSIX_TABLE_INIT;
+
+  if ((ix->rootfd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1 ||
+      (ix->inofd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1 ||
+      (ix->stopfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+    goto err;
+  }
+
+  /* the root is watched, or nothing is known */
+  scan_dir(ix, "");
+  if (ix->nwdirs == 0) {
+    goto err;
+  }
+
+  /* the thread doesn't take signals */
+  sigfillset(&allsigs);
+  pthread_sigmask(SIG_BLOCK, &allsigs, &oldsigs);
+  ret = pthread_create(&ix->thread, NULL, watch_thread, ix);
+  pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+  if (ret != 0) {
+    errno = ret;
+    goto err;
+  }
+  ix->fthread = IW_TRUE;
+
+  return ix;
+
+ err:
+  errsv = errno;
+  dsix_exit(ix);
+  errno = errsv;
+  return NULL;
+}
+
+
+/* To look up the metadata of file, a path from the root.
+ * return: IW_TRUE with meta, IW_FALSE if it doesn't exist,
+ *         or IW_ERR if not known by the index (symbolic links, "..", unwatched directories)
+ */
+extern int32_t
+dsix_lookup(struct dsindex *ix, const char *file, struct dsmeta *meta)
+{
+  struct dsentry *pm;
+  char path[PATH_MAX];
+  char *sep;
+  int32_t ret = IW_ERR;
+
+  if (normalize_path(file, path, sizeof path) == -1) {
+    return IW_ERR;
+  }
+
+  pthread_rwlock_rdlock(&ix->lock);
+  if ((pm = find_entry(ix, path, hash_string(path)))) {
+    if (pm->flink == IW_FALSE) {
+      *meta = pm->meta;
+      ret = IW_TRUE;
+    }
+    goto done;
+  }
+
+  /* absent, if the nearest existing ancestor is a watched directory or not a directory */
+  while ((sep = strrchr(path, '/'))) {
+    *sep = '\0';
+    if ((pm = find_entry(ix, path, hash_string(path)))) {
+      if (pm->flink == IW_FALSE && (pm->meta.type != DSIX_DIR || pm->fwatched == IW_TRUE)) {
+	ret = IW_FALSE;
+      }
+      goto done;
+    }
+  }
+  /* the root */
+  ret = IW_FALSE;
+
+ done:
+  pthread_rwlock_unlock(&ix->lock);
+  return ret;
+}
+
+
+/* To update the entry of file at once, e.g. written by this process, before the event. */
+extern void
+dsix_update(struct dsindex *ix, const char *file)
+{
+  char path[PATH_MAX];
+
+  if (normalize_path(file, path, sizeof path) == -1 || path[0] == '\0') {
+    return;
+  }
+
+  pthread_rwlock_wrlock(&ix->lock);
+  put_entry(ix, path);
+  pthread_rwlock_unlock(&ix->lock);
+}
+
+
+/* To get the generation of the index, which changes when files may have been added,
+ * for the caches of missing files.
+ */
+extern uint32_t
+dsix_generation(struct dsindex *ix)
+{
+  return __atomic_load_n(&ix->gen, __ATOMIC_ACQUIRE);
+}
+
+
+/* To change the path of the root for adding watches, e.g. "/" after chroot.
+ * return: IW_OK, or IW_ERR
+ */
+extern int32_t
+dsix_set_root(struct dsindex *ix, const char *root)
+{
+  char *path;
+
+  if (! (path = strdup(root))) {
+    return IW_ERR;
+  }
+
+  pthread_rwlock_wrlock(&ix->lock);
+  free(ix->root);
+  ix->root = path;
+  pthread_rwlock_unlock(&ix->lock);
+  return IW_OK;
+}
+
+
+/* To stop the thread, and free the index. */
+extern void
+dsix_exit(struct dsindex *ix)
+{
+  uint64_t val = 1;
+  int32_t i;
+
+  if (! ix) {
+    return;
+  }
+
+  if (ix->fthread == IW_TRUE) {
+    if (write(ix->stopfd, &val, sizeof val) == -1) {
+      pthread_cancel(ix->thread);
+    }
+    pthread_join(ix->thread, NULL);
+  }
+
+  if (ix->table) {
+    clear_index(ix);
+  }
+  for (i = 0; i < ix->nwdirs; i++) {
+    free(ix->wdirs[i]);
+  }
+  free(ix->wdirs);
+  free(ix->table);
+  free(ix->root);
+  if (ix->rootfd != -1) close(ix->rootfd);
+  if (ix->inofd != -1) close(ix->inofd);
+  if (ix->stopfd != -1) close(ix->stopfd);
+  pthread_rwlock_destroy(&ix->lock);
+  free(ix);
+}
+
+
+/* read the events until stopped */
+static void *
+watch_thread(void *arg)
+{
+  struct dsindex *ix = arg;
+  struct pollfd pfds[2];
+  uint8_t buf[DSIX_EVBUF_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+
+  pfds[0].fd = ix->inofd;
+  pfds[0].events = POLLIN;
+  pfds[1].fd = ix->stopfd;
+  pfds[1].events = POLLIN;
+
+  for (;;) {
+    if (poll(pfds, 2, -1) == -1) {
+      if (errno == EINTR) {
+	continue;
+      }
+      break;
+    }
+    if (pfds[1].revents) {
+      break;
+    }
+
+    while ((len = read(ix->inofd, buf, sizeof buf)) > 0) {
+      pthread_rwlock_wrlock(&ix->lock);
+      handle_events(ix, buf, len);
+      pthread_rwlock_unlock(&ix->lock);
+    }
+  }
+  return NULL;
+}
+
+
+/* apply the events to the index, with holding the lock */
+static void
+handle_events(struct dsindex *ix, const uint8_t *buf, ssize_t len)
+{
+  const struct inotify_event *ev;
+  struct dsentry *pm;
+  char path[PATH_MAX];
+  const uint8_t *p;
+  int32_t frescan = IW_FALSE;
+
+  for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len) {
+    ev = (const struct inotify_event *)p;
+
+    /* events were lost */
+    if (ev->mask & IN_Q_OVERFLOW) {
+      frescan = IW_TRUE;
+      continue;
+    }
+    /* a file may appear also by a symbolic link */
+    if (ev->mask & (IN_CREATE | IN_MOVED_TO | IN_ATTRIB)) {
+      __atomic_add_fetch(&ix->gen, 1, __ATOMIC_RELEASE);
+    }
+    if (ev->wd < 0 || ev->wd >= ix->nwdirs || ! ix->wdirs[ev->wd]) {
+      continue;
+    }
+    if (ev->mask & IN_IGNORED) {
+      free(ix->wdirs[ev->wd]);
+      ix->wdirs[ev->wd] = NULL;
+      continue;
+    }
+    /* the directory itself is updated by the watch of its parent */
+    if (ev->len == 0) {
+      continue;
+    }
+
+    if (snprintf(path, sizeof path, "%s%s%s", ix->wdirs[ev->wd], *ix->wdirs[ev->wd] ? "/" : "",
+		 ev->name) >= (int)sizeof path) {
+      continue;
+    }
+
+    if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+      del_tree(ix, path);
+      del_entry(ix, path);
+    }
+    else if ((pm = put_entry(ix, path)) && pm->meta.type == DSIX_DIR && pm->flink == IW_FALSE &&
+	     ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+      scan_dir(ix, path);
+    }
+  }
+
+  if (frescan == IW_TRUE) {
+    __atomic_add_fetch(&ix->gen, 1, __ATOMIC_RELEASE);
+    clear_index(ix);
+    scan_dir(ix, "");
+  }
+}
+
+
+/* watch the directory, and add the entries under it */
+static void
+scan_dir(struct dsindex *ix, const char *dir)
+{
+  struct dsentry *pm;
+  struct dsentry *parent = NULL;
+  struct dirent *de;
+  DIR *dp;
+  char path[PATH_MAX];
+  int wd;
+  int fd;
+
+  if (*dir && ! (parent = find_entry(ix, dir, hash_string(dir)))) {
+    return;
+  }
+
+  /* watched before reading, not to miss the files created meanwhile */
+  if (snprintf(path, sizeof path, "%s/%s", ix->root, dir) >= (int)sizeof path ||
+      (wd = inotify_add_watch(ix->inofd, path, DSIX_MASK)) == -1 ||
+      set_wdir(ix, wd, dir) == IW_ERR) {
+    return;
+  }
+
+  if ((fd = openat(ix->rootfd, *dir ? dir : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+    return;
+  }
+  if (! (dp = fdopendir(fd))) {
+    close(fd);
+    return;
+  }
+  if (parent) {
+    parent->fwatched = IW_TRUE;
+  }
+
+  while ((de = readdir(dp))) {
+    if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+      continue;
+    }
+    if (snprintf(path, sizeof path, "%s%s%s", dir, *dir ? "/" : "", de->d_name) >= (int)sizeof path) {
+      continue;
+    }
+    if ((pm = put_entry(ix, path)) && pm->meta.type == DSIX_DIR && pm->flink == IW_FALSE) {
+      scan_dir(ix, path);
+    }
+  }
+  closedir(dp);
+}
+
+
+/* add or update the entry by the status of the file, or delete it if gone */
+static struct dsentry *
+put_entry(struct dsindex *ix, const char *path)
+{
+  struct dsentry *pm;
+  struct stat st;
+  uint32_t hkey;
+  int32_t flink = IW_FALSE;
+
+  if (fstatat(ix->rootfd, path, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+    del_tree(ix, path);
+    del_entry(ix, path);
+    return NULL;
+  }
+  /* the target of a link is looked up by stat */
+  if (S_ISLNK(st.st_mode)) {
+    flink = IW_TRUE;
+    if (fstatat(ix->rootfd, path, &st, 0) == -1) {
+      memset(&st, 0, sizeof st);
+    }
+  }
+
+  hkey = hash_string(path);
+  if (! (pm = find_entry(ix, path, hkey))) {
+    if (ix->nentries >= ix->size && grow_table(ix) == IW_ERR) {
+      return NULL;
+    }
+    if (! (pm = calloc(1, sizeof(struct dsentry) + strlen(path) + 1))) {
+      return NULL;
+    }
+    strcpy(pm->path, path);
+    pm->hkey = hkey;
+    pm->next = ix->table[hkey & (ix->size - 1)];
+    ix->table[hkey & (ix->size - 1)] = pm;
+    ix->nentries++;
+  }
+
+  pm->meta.type = S_ISREG(st.st_mode) ? DSIX_REG : S_ISDIR(st.st_mode) ? DSIX_DIR : DSIX_OTHER;
+  pm->meta.size = st.st_size;
+  pm->meta.mtime = st.st_mtim;
+  pm->meta.dev = st.st_dev;
+  pm->meta.ino = st.st_ino;
+  pm->flink = flink;
+  return pm;
+}
+
+
+static struct dsentry *
+find_entry(struct dsindex *ix, const char *path, uint32_t hkey)
+{
+  struct dsentry *pm;
+
+  for (pm = ix->table[hkey & (ix->size - 1)]; pm; pm = pm->next) {
+    if (pm->hkey == hkey && strcmp(pm->path, path) == 0) {
+      break;
+    }
+  }
+  return pm;
+}
+
+
+static void
+del_entry(struct dsindex *ix, const char *path)
+{
+  struct dsentry **pp;
+  struct dsentry *pm;
+  uint32_t hkey;
+
+  hkey = hash_string(path);
+  for (pp = &ix->table[hkey & (ix->size - 1)]; (pm = *pp); pp = &pm->next) {
+    if (pm->hkey == hkey && strcmp(pm->path, path) == 0) {
+      *pp = pm->next;
+      free(pm);
+      ix->nentries--;
+      return;
+    }
+  }
+}
+
+
+/* delete the entries and the watches under the directory, removed or moved away */
+static void
+del_tree(struct dsindex *ix, const char *dir)
+{
+  struct dsentry **pp;
+  struct dsentry *pm;
+  uint32_t i;
+  int32_t wd;
+
+  for (i = 0; i < ix->size; i++) {
+    for (pp = &ix->table[i]; (pm = *pp);) {
+      if (is_under(pm->path, dir) == IW_TRUE) {
+	*pp = pm->next;
+	free(pm);
+	ix->nentries--;
+      }
+      else {
+	pp = &pm->next;
+      }
+    }
+  }
+
+  for (wd = 0; wd < ix->nwdirs; wd++) {
+    if (ix->wdirs[wd] && (strcmp(ix->wdirs[wd], dir) == 0 || is_under(ix->wdirs[wd], dir) == IW_TRUE)) {
+      inotify_rm_watch(ix->inofd, wd);
+      free(ix->wdirs[wd]);
+      ix->wdirs[wd] = NULL;
+    }
+  }
+}
+
+
+/* delete all entries, to scan again */
+static void
+clear_index(struct dsindex *ix)
+{
+  struct dsentry *pm;
+  uint32_t i;
+
+  for (i = 0; i < ix->size; i++) {
+    while ((pm = ix->table[i])) {
+      ix->table[i] = pm->next;
+      free(pm);
+    }
+  }
+  ix->nentries = 0;
+}
+
+
+static int32_t
+grow_table(struct dsindex *ix)
+{
+  struct dsentry **table;
+  struct dsentry *pm;
+  uint32_t size;
+  uint32_t i;
+
+  size = ix->size * 2;
+  if (! (table = calloc(size, sizeof(struct dsentry *)))) {
+    return IW_ERR;
+  }
+  for (i = 0; i < ix->size; i++) {
+    while ((pm = ix->table[i])) {
+      ix->table[i] = pm->next;
+      pm->next = table[pm->hkey & (size - 1)];
+      table[pm->hkey & (size - 1)] = pm;
+    }
+  }
+  free(ix->table);
+  ix->table = table;
+  ix->size = size;
+  return IW_OK;
+}
+
+
+/* the directory of the watch descriptor, the same one for the same directory */
+static int32_t
+set_wdir(struct dsindex *ix, int wd, const char *dir)
+{
+  char **wdirs;
+  char *name;
+
+  if (wd >= ix->nwdirs) {
+    if (! (wdirs = realloc(ix->wdirs, sizeof(char *) * (wd + 1) * 2))) {
+      return IW_ERR;
+    }
+    memset(wdirs + ix->nwdirs, 0, sizeof(char *) * ((wd + 1) * 2 - ix->nwdirs));
+    ix->wdirs = wdirs;
+    ix->nwdirs = (wd + 1) * 2;
+  }
+  if (! (name = strdup(dir))) {
+    return IW_ERR;
+  }
+  free(ix->wdirs[wd]);
+  ix->wdirs[wd] = name;
+  return IW_OK;
+}
+
+
+/* the path from the root without empty and "." components, or -1 with ".." */
+static int32_t
+normalize_path(const char *file, char *buf, size_t bufsize)
+{
+  const char *p;
+  size_t len = 0;
+  size_t n;
+
+  while (*file) {
+    while (*file == '/') {
+      file++;
+    }
+    for (p = file; *p && *p != '/'; p++)
+      ;
+    n = p - file;
+    if (n == 0 || (n == 1 && file[0] == '.')) {
+      file = p;
+      continue;
+    }
+    /* a symbolic link may be on the way */
+    if (n == 2 && file[0] == '.' && file[1] == '.') {
+      return -1;
+    }
+    if (len + n + 2 > bufsize) {
+      return -1;
+    }
+    if (len > 0) {
+      buf[len++] = '/';
+    }
+    memcpy(buf + len, file, n);
+    len += n;
+    file = p;
+  }
+  buf[len] = '\0';
+  return len;
+}
+
+
+static int32_t
+is_under(const char *path, const char *dir)
+{
+  size_t len;
+
+  len = strlen(dir);
+  return strncmp(path, dir, len) == 0 && path[len] == '/' ? IW_TRUE : IW_FALSE;
+}
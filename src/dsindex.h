@@ -0,0 +1,93 @@
+/*
+ * dsindex.h
+ *
+ * Copyright (c) 2012, Daisuke Sato <bigsplint@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _DSINDEX_H_
+#define _DSINDEX_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <time.h>
+
+
+/* constants */
+#define DSIX_TABLE_INIT 1024		/* initial buckets, doubled as the files increase */
+#define DSIX_EVBUF_SIZE 16384		/* buffer of inotify events */
+
+
+/* kinds of the files */
+enum DSIX_TYPE {
+  DSIX_REG = 1,			/* regular file */
+  DSIX_DIR,			/* directory */
+  DSIX_OTHER,			/* others, including dangling symbolic links */
+};
+
+/* metadata of a file, copied out of the index */
+struct dsmeta {
+  int32_t type;			/* DSIX_* */
+  off_t size;			/* size of the file */
+  struct timespec mtime;	/* modification time */
+  dev_t dev;			/* identity of the inode */
+  ino_t ino;
+};
+
+/* file or directory, by the path from the root */
+struct dsentry {
+  struct dsentry *next;		/* next in the bucket */
+  uint32_t hkey;		/* hash of the path */
+  struct dsmeta meta;
+  int32_t fwatched;		/* flag of whether the entries in the directory are kept current */
+  int32_t flink;		/* flag of a symbolic link, whose target is not watched */
+  char path[];			/* without leading '/', "." and ".." */
+};
+
+/* index of the files under the root, kept current by inotify */
+struct dsindex {
+  struct dsentry **table;	/* buckets of the entries */
+  uint32_t size;		/* number of buckets, a power of 2 */
+  uint32_t nentries;		/* number of entries */
+  char **wdirs;			/* directory of each watch descriptor, or NULL */
+  int32_t nwdirs;		/* size of wdirs */
+  char *root;			/* path of the root for adding watches, "/" after chroot */
+  int rootfd;			/* the root, for stat of the entries */
+  int inofd;			/* inotify instance */
+  int stopfd;			/* eventfd to stop the thread */
+  pthread_t thread;		/* thread reading the events */
+  int32_t fthread;		/* flag of whether the thread is running */
+  uint32_t gen;			/* generation, incremented by the files added */
+  pthread_rwlock_t lock;	/* read by workers, written by the thread */
+};
+
+
+extern struct dsindex *dsix_init(const char *root);
+extern int32_t dsix_lookup(struct dsindex *ix, const char *file, struct dsmeta *meta);
+extern void dsix_update(struct dsindex *ix, const char *file);
+extern uint32_t dsix_generation(struct dsindex *ix);
+extern int32_t dsix_set_root(struct dsindex *ix, const char *root);
+extern void dsix_exit(struct dsindex *ix);
+
+
+#endif	/* _DSINDEX_H_ */
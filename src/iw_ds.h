@@ -30,30 +30,50 @@
 
 typedef struct _iwds IWDS;
 
+/* handle of an opened file */
+typedef struct dsession IWDSFILE;
+
 /* to create instance and termination */
 extern IWDS *iwds_init(const char *datastore);
 extern void iwds_exit(IWDS *ds);
 
-/* request structure used for reading and writing */
+/* request structure used for opening, reading and writing */
 struct dsreq {
-  int32_t dsid;			/* session ID */
-  char *dfile;			/* filename */
+  char *dfile;			/* filename (for opening) */
   void *dbuf;			/* data buffer */
   size_t dlen;			/* size of data buffer */
+  off_t doff;			/* offset of file */
+  off_t dsize;			/* size of file (for preallocation) */
   int32_t derr;			/* error code */
 };
 
-/* read and write */
-extern size_t iwds_read(IWDS *ds, struct dsreq *req);
-extern size_t iwds_write(IWDS *ds, struct dsreq *req);
-extern int32_t iwds_close(IWDS *ds, struct dsreq *req);
+/* open a file for reading, or create a file for writing preallocating dsize bytes */
+extern IWDSFILE *iwds_open(IWDS *ds, struct dsreq *req);
+extern IWDSFILE *iwds_create(IWDS *ds, struct dsreq *req);
+
+/* read and write at the offset, without looking up the file */
+extern size_t iwds_read_at(IWDS *ds, IWDSFILE *fh, struct dsreq *req);
+extern size_t iwds_write_at(IWDS *ds, IWDSFILE *fh, struct dsreq *req);
+extern int32_t iwds_close(IWDS *ds, IWDSFILE *fh);
+
+/* close the file, and remove it if it was created, e.g. for an aborted upload */
+extern int32_t iwds_discard(IWDS *ds, IWDSFILE *fh);
 
 /* check file */
 extern int32_t iwds_isfile(IWDS *ds, const char *filename);
+extern off_t iwds_getsize(IWDS *ds, const char *filename);
 
 extern int32_t iwds_set_chroot(IWDS *ds);
 extern char *iwds_get_dspath(IWDS *ds);
 
+/* counters of the lookups of missing files */
+struct dsstats {
+  uint64_t neghits;		/* answered by the negative lookup cache */
+  uint64_t negmisses;		/* looked up by stat */
+};
+
+extern void iwds_get_stats(IWDS *ds, struct dsstats *stats);
+
 
 /* error code */
 enum DSREQ_ERRCODE {
@@ -65,6 +85,7 @@ enum DSREQ_ERRCODE {
   DSERR_NOSESSION,		/* datastore session not found */
   DSERR_READFAIL,		/* reading error */
   DSERR_WRITEFAIL,		/* writing error */
+  DSERR_NOSPACE,		/* no space left */
 };
 
 /* get a message string of error code */
@@ -30,10 +30,35 @@
 
 typedef struct _iwtftp IWTFTP;
 
+/* event backends */
+#define IWTFTP_BACKEND_EPOLL 0		/* epoll and recvmmsg/sendmmsg */
+#define IWTFTP_BACKEND_URING 1		/* io_uring, falls back to epoll if not supported */
+
 /* to create instance and termination */
-extern IWTFTP *iwtftp_init(int32_t ipver, const char *ifname, IWDS *pds);
+extern IWTFTP *iwtftp_init(int32_t ipver, const char *ifname, IWDS *pds, int32_t nworkers, int32_t backend);
 extern void iwtftp_exit(IWTFTP *ins);
 
+/* ports of session sockets from minport to maxport, by default ephemeral ports */
+extern int32_t iwtftp_set_ports(IWTFTP *ins, uint16_t minport, uint16_t maxport);
+
+/* sessions of a worker share nsocks sockets for each server socket, instead of own sockets */
+extern int32_t iwtftp_set_shared(IWTFTP *ins, int32_t nsocks);
+
+/* workers spin on the sockets pinned on CPUs, sleeping after idle msec without packets */
+extern int32_t iwtftp_set_busypoll(IWTFTP *ins, int32_t idle);
+
+/* workers are pinned on CPUs, and allocate the buffers on the NUMA nodes */
+extern int32_t iwtftp_set_affinity(IWTFTP *ins);
+
+/* requests of a client address go to the same worker, instead of the hash of the client TID */
+extern int32_t iwtftp_set_steering(IWTFTP *ins);
+
+/* uploads and their tsize are limited to size bytes, or not limited by 0 */
+extern int32_t iwtftp_set_maxupload(IWTFTP *ins, off_t size);
+
+/* IPv4 on the device by AF_XDP, sessions from minport to maxport (0 for default), while root */
+extern int32_t iwtftp_set_xdp(IWTFTP *ins, const char *ifname, uint16_t minport, uint16_t maxport);
+
 /* start service */
 extern int32_t iwtftp_service(IWTFTP *ins);
 
@@ -49,6 +49,7 @@ static struct iwstatus statmsgs[] = {
   { E_USER_UNKNOWN, "error: unknown user '%s'" },
   /* info */
   { I_NOASROOT, "info: must be run as root" },
+  { I_FDLIMIT, "info: open files are limited to %lu" },
   { I_START_SERVER, "info: starting server" },
   { I_EXIT_SERVER, "info: exiting server" },
   { I_SHOW_VER, PROGRAM_INFO },
@@ -65,6 +66,7 @@ static struct iwstatus statvmsgs[] = {
   { EV_FAIL_INITGROUPS, "error: initgroups: failed, '%s': %s" },
   { EV_FAIL_OPEN, "error: open: failed, '%s': %s" },
   { EV_FAIL_SETGID, "error: setgid: failed, '%d': %s" },
+  { EV_FAIL_SETRLIMIT, "error: setrlimit: failed to raise to %lu: %s" },
   { EV_FAIL_SETSID, "error: setsid: failed: %s" },
   { EV_FAIL_SETUID, "error: setuid: failed, '%d': %s" },
   { EV_FAIL_SIGACTION, "error: sigaction: failed to '%s' action: %s" },
@@ -80,8 +82,8 @@ main(int argc, const char **argv)
   uid_t psuid;
   struct svconf *svc = NULL;
 
-  int siglist[] = { SIGTERM, SIGQUIT, SIGHUP };
-  int ign_siglist[] = { SIGINT, SIGPIPE, SIGUSR1, SIGUSR2, SIGTSTP, SIGTTIN, SIGTTOU };
+  int siglist[] = { SIGTERM, SIGQUIT, SIGHUP, SIGUSR1 };
+  int ign_siglist[] = { SIGINT, SIGPIPE, SIGUSR2, SIGTSTP, SIGTTIN, SIGTTOU };
 
   int logfd = -1;
   IWDS *ads = NULL;
@@ -150,7 +152,47 @@ main(int argc, const char **argv)
   }
   svc->datastore = iwds_get_dspath(ads);
 
-  if (! (atftp = iwtftp_init(svc->ipver, svc->ifname, ads))) {
+  if (! svc->workers) {
+    svc->workers = get_usable_cpus();
+  }
+  if (! (atftp = iwtftp_init(svc->ipver, svc->ifname, ads, svc->workers, svc->backend))) {
+    pmsg(E_TFTP_FAIL_INIT);
+    exitval = EX_SOFTWARE;
+    goto ferr;
+  }
+  if (svc->minport && iwtftp_set_ports(atftp, svc->minport, svc->maxport) == IW_ERR) {
+    pmsg(E_TFTP_FAIL_INIT);
+    exitval = EX_SOFTWARE;
+    goto ferr;
+  }
+  if (svc->shared && iwtftp_set_shared(atftp, svc->shared) == IW_ERR) {
+    pmsg(E_TFTP_FAIL_INIT);
+    exitval = EX_SOFTWARE;
+    goto ferr;
+  }
+  if (svc->affinity == IW_TRUE && iwtftp_set_affinity(atftp) == IW_ERR) {
+    pmsg(E_TFTP_FAIL_INIT);
+    exitval = EX_SOFTWARE;
+    goto ferr;
+  }
+  if (svc->steering == IW_TRUE && iwtftp_set_steering(atftp) == IW_ERR) {
+    pmsg(E_TFTP_FAIL_INIT);
+    exitval = EX_SOFTWARE;
+    goto ferr;
+  }
+  if (svc->maxupload >= 0 && iwtftp_set_maxupload(atftp, svc->maxupload) == IW_ERR) {
+    pmsg(E_TFTP_FAIL_INIT);
+    exitval = EX_SOFTWARE;
+    goto ferr;
+  }
+  /* while root, for busy polling above net.core.busy_read */
+  if (svc->busyidle && iwtftp_set_busypoll(atftp, svc->busyidle) == IW_ERR) {
+    pmsg(E_TFTP_FAIL_INIT);
+    exitval = EX_SOFTWARE;
+    goto ferr;
+  }
+  /* while root, for loading the program and binding the sockets */
+  if (svc->xdpif && iwtftp_set_xdp(atftp, svc->xdpif, svc->minport, svc->maxport) == IW_ERR) {
     pmsg(E_TFTP_FAIL_INIT);
     exitval = EX_SOFTWARE;
     goto ferr;
@@ -176,6 +218,9 @@ main(int argc, const char **argv)
     goto ferr;
   }
 
+  /* while root, for the sockets of many sessions */
+  raise_fdlimit();
+
   if (set_credential(pwd->pw_name, pwd->pw_uid, pwd->pw_gid) == IW_ERR) {
     pmsg(E_FAIL_SET_CREDENTIAL, pwd->pw_name);
     exitval = EX_OSERR;
@@ -286,6 +331,16 @@ create_svconf(void)
   psv->datastore = NULL;
   psv->user = NULL;
   psv->verbose = IW_FALSE;
+  psv->workers = 0;
+  psv->backend = IWTFTP_BACKEND_EPOLL;
+  psv->shared = 0;
+  psv->busyidle = 0;
+  psv->affinity = IW_FALSE;
+  psv->steering = IW_FALSE;
+  psv->maxupload = -1;
+  psv->xdpif = NULL;
+  psv->minport = 0;
+  psv->maxport = 0;
 
   return psv;
 }
@@ -302,6 +357,17 @@ set_svconf(struct svconf *psv, int pargc, const char **pargv)
   char *uname;
   int32_t verbose = IW_FALSE;
   int32_t showver = IW_FALSE;
+  int32_t nworkers = 0;
+  int32_t nshared = 0;
+  int32_t busyidle = 0;
+  int32_t affinity = IW_FALSE;
+  int32_t steering = IW_FALSE;
+  int32_t maxupload = 0;
+  char *backend;
+  char *xdpif;
+  char *ports;
+  char *endp;
+  unsigned long minport, maxport;
   const char *leftover;
 
   struct poptOption optlist[] = {
@@ -310,6 +376,15 @@ set_svconf(struct svconf *psv, int pargc, const char **pargv)
     { "if", 'i', POPT_ARG_STRING, &netdev, 'i', "Use bind interface only", "NETDEV" },
     { "datastore", 'd', POPT_ARG_STRING, &dirpath, 'd', "Path of datastore", "DIRPATH" },
     { "username", 'u', POPT_ARG_STRING, &uname, 'u', "Username in /etc/passwd", "USER" },
+    { "workers", 'w', POPT_ARG_INT, &nworkers, 'w', "Number of worker threads (default: usable CPUs)", "NUM" },
+    { "backend", 'b', POPT_ARG_STRING, &backend, 'b', "Event backend: epoll or uring (default: epoll)", "NAME" },
+    { "shared", 's', POPT_ARG_INT, &nshared, 's', "Sessions share NUM sockets in each worker (default: own sockets)", "NUM" },
+    { "affinity", 'a', POPT_ARG_VAL, &affinity, IW_TRUE, "Pin workers on CPUs", NULL },
+    { "steer", 'r', POPT_ARG_VAL, &steering, IW_TRUE, "Requests of a client address go to the same worker", NULL },
+    { "busy-poll", 'P', POPT_ARG_INT, &busyidle, 'P', "Spin on the sockets pinned on CPUs, sleeping after MSEC without packets", "MSEC" },
+    { "max-upload", 'm', POPT_ARG_INT, &maxupload, 'm', "Largest size of uploads in MB, 0 for no limit (default: 1024)", "MB" },
+    { "xdp", 'x', POPT_ARG_STRING, &xdpif, 'x', "Serve IPv4 on the device by AF_XDP", "NETDEV" },
+    { "ports", 'p', POPT_ARG_STRING, &ports, 'p', "Ports of sessions (default: ephemeral; 61000-65535 by AF_XDP)", "MIN-MAX" },
     { "verbose", 'v', POPT_ARG_VAL, &verbose, IW_TRUE, "Verbose mode", NULL },
     { "version", 'V', POPT_ARG_VAL, &showver, IW_TRUE, "Show version", NULL },
     POPT_AUTOHELP
@@ -332,6 +407,63 @@ set_svconf(struct svconf *psv, int pargc, const char **pargv)
     case 'u':
       psv->user = uname;
       break;
+    case 'w':
+      if (nworkers < 1) {
+	pmsg(E_OPTION_BAD, "-w", "must be greater than 0");
+	goto err;
+      }
+      psv->workers = nworkers;
+      break;
+    case 'b':
+      if (strcmp(backend, "epoll") == 0) {
+	psv->backend = IWTFTP_BACKEND_EPOLL;
+      }
+      else if (strcmp(backend, "uring") == 0) {
+	psv->backend = IWTFTP_BACKEND_URING;
+      }
+      else {
+	pmsg(E_OPTION_BAD, "-b", "must be epoll or uring");
+	goto err;
+      }
+      break;
+    case 's':
+      if (nshared < 1) {
+	pmsg(E_OPTION_BAD, "-s", "must be greater than 0");
+	goto err;
+      }
+      psv->shared = nshared;
+      break;
+    case 'P':
+      if (busyidle < 1) {
+	pmsg(E_OPTION_BAD, "-P", "must be greater than 0");
+	goto err;
+      }
+      psv->busyidle = busyidle;
+      break;
+    case 'm':
+      if (maxupload < 0) {
+	pmsg(E_OPTION_BAD, "-m", "must be 0 or greater");
+	goto err;
+      }
+      psv->maxupload = (int64_t)maxupload * 1024 * 1024;
+      break;
+    case 'x':
+      psv->xdpif = xdpif;
+      break;
+    case 'p':
+      minport = strtoul(ports, &endp, 10);
+      if (*endp != '-' || endp == ports) {
+	pmsg(E_OPTION_BAD, "-p", "must be MIN-MAX");
+	goto err;
+      }
+      maxport = strtoul(endp + 1, &endp, 10);
+      if (*endp != '\0' || minport < 1024 || maxport > USHRT_MAX || minport > maxport) {
+	pmsg(E_OPTION_BAD, "-p", "must be MIN-MAX within 1024-65535");
+	goto err;
+      }
+      psv->minport = minport;
+      psv->maxport = maxport;
+      break;
     }
   }
 
@@ -361,6 +493,8 @@ set_svconf(struct svconf *psv, int pargc, const char **pargv)
   }
 
   psv->verbose = verbose;
+  psv->affinity = affinity;
+  psv->steering = steering;
   
   poptFreeContext(optcon);
   return IW_OK;
@@ -405,6 +539,10 @@ init_signal(int *siglist, uint32_t nlist, void (*func)(int))
 static void
 sig_handler(int sig)
 {
+  if (sig == SIGUSR1) {
+    g_stats_dump = IW_TRUE;
+    return;
+  }
   g_evloop_exit = sig > 0 ? IW_TRUE : IW_FALSE;
 }
 
@@ -414,7 +552,8 @@ daemonize(int excfd)
 {
   pid_t pid;
   int nullfd;
-  int32_t i;
+  long maxfd;
+  long i;
 
   if ((pid = fork()) == -1) {
     pmsg(EV_FAIL_FORK, strerror(errno));
@@ -431,7 +570,11 @@ daemonize(int excfd)
     goto err;
   }
 
-  for (i = 0; i < IW_FD_MAX; i++) {
+  /* every inherited descriptor, the limit may be far above IW_FD_MAX */
+  if ((maxfd = sysconf(_SC_OPEN_MAX)) < IW_FD_MAX) {
+    maxfd = IW_FD_MAX;
+  }
+  for (i = 0; i < maxfd; i++) {
     if (i != excfd && i != nullfd) {
       close(i);
     }
@@ -503,3 +646,33 @@ set_credential(const char *username, uid_t uid, gid_t gid)
  err:
   return IW_ERR;
 }
+
+
+static void
+raise_fdlimit(void)
+{
+  struct rlimit rlim;
+  rlim_t want;
+
+  if (getrlimit(RLIMIT_NOFILE, &rlim) == -1) {
+    return;
+  }
+
+  want = rlim.rlim_max > NOFILE_MIN ? rlim.rlim_max : NOFILE_MIN;
+  if (rlim.rlim_cur >= want) {
+    return;
+  }
+
+  rlim.rlim_cur = rlim.rlim_max = want;
+  if (setrlimit(RLIMIT_NOFILE, &rlim) == -1) {
+    pmsg(EV_FAIL_SETRLIMIT, (unsigned long)want, strerror(errno));
+
+    /* up to the hard limit at least */
+    getrlimit(RLIMIT_NOFILE, &rlim);
+    rlim.rlim_cur = rlim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rlim);
+  }
+
+  getrlimit(RLIMIT_NOFILE, &rlim);
+  pmsg(I_FDLIMIT, (unsigned long)rlim.rlim_cur);
+}
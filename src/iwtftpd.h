@@ -28,7 +28,9 @@
 #define _IWTFTPD_H_
 
 #include <signal.h>
+#include <limits.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <fcntl.h>
 #include <pwd.h>
 #include <grp.h>
@@ -39,6 +41,7 @@
 #include "iw_log.h"
 #include "iw_ds.h"
 #include "iw_tftp.h"
+#include "util.h"
 
 
 #define PROGRAM_NAME "iwtftpd"
@@ -51,6 +54,7 @@
 /* constants */
 #define DEFAULT_IPVER (IW_IPV4 | IW_IPV6)     /* default using IPv4 and IPv6 */
 #define DEFAULT_USER "nobody"		      /* default user of process */
+#define NOFILE_MIN 65536		      /* open files at least, a socket per session */
 
 
 /* server configuration */
@@ -60,11 +64,24 @@ struct svconf {
   char *datastore;		/* path of datastore */
   char *user;			/* username of process */
   int32_t verbose;		/* flag of verbose logging */
+  int32_t workers;		/* number of workers, 0 is usable CPUs */
+  int32_t backend;		/* event backend, IWTFTP_BACKEND_* */
+  int32_t shared;		/* sockets shared by the sessions of a worker, 0 is own sockets */
+  int32_t busyidle;		/* msec of busy polling without packets, 0 is no busy polling */
+  int32_t affinity;		/* flag of pinning workers on CPUs */
+  int32_t steering;		/* flag of steering a client address to a worker */
+  int64_t maxupload;		/* largest size of uploads (bytes), 0 is no limit, -1 is default */
+  char *xdpif;			/* name of network interface by AF_XDP, or NULL */
+  uint16_t minport;		/* first port of sessions, 0 for default */
+  uint16_t maxport;		/* last port of sessions, 0 for default */
 };
 
 /* flag for exiting event loop */
 extern volatile sig_atomic_t g_evloop_exit;
 
+/* flag for logging the statistics */
+extern volatile sig_atomic_t g_stats_dump;
+
 
 /* status codes */
 enum STATCODE {
@@ -84,6 +101,7 @@ enum STATCODE {
   E_TFTP_FAIL_INIT,
   E_USER_UNKNOWN,
   I_NOASROOT,
+  I_FDLIMIT,
   I_START_SERVER,
   I_EXIT_SERVER,
   I_SHOW_VER,
@@ -99,6 +117,7 @@ enum STATCODE_VERBOSE {
   EV_FAIL_INITGROUPS,
   EV_FAIL_OPEN,
   EV_FAIL_SETGID,
+  EV_FAIL_SETRLIMIT,
   EV_FAIL_SETSID,
   EV_FAIL_SETUID,
   EV_FAIL_SIGACTION,
@@ -114,6 +133,7 @@ static void sig_handler(int sig);
 static int32_t daemonize(int excfd);
 static int32_t exec_chroot(const char *dirpath);
 static int32_t set_credential(const char *username, uid_t uid, gid_t gid);
+static void raise_fdlimit(void);
 
 
 #endif	/* _IWTFTPD_H_ */
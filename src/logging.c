@@ -75,6 +75,7 @@ iwlog_init(int32_t verbose)
   plog->fverbose = verbose ? IW_TRUE : IW_FALSE;
   plog->logfd = fd;
   plog->msglen = 0;
+  pthread_mutex_init(&plog->lock, NULL);
 
   alog = plog;
   return IW_OK;
@@ -113,6 +114,8 @@ iwlog_print_msg(const char *msg, size_t msglen)
     }
   }
 
+  pthread_mutex_lock(&alog->lock);
+
   /* create string, "yyyy-MM-DD hh:mm:ss MESSAGE" */
   strncpy(alog->msgbuf, timebuf, LOGMSGBUF_SIZE);
   for (pb = alog->msgbuf; pb - alog->msgbuf < LOGMSGBUF_SIZE - 1; pb++) {
@@ -141,6 +144,8 @@ iwlog_print_msg(const char *msg, size_t msglen)
     pmsg(EV_FAIL_WRITE, alog->logfd, alog->msglen, strerror(errno));
     fprintf(stderr, "[log fallback]: %s", alog->msgbuf);
   }
+
+  pthread_mutex_unlock(&alog->lock);
 }
 
 
@@ -172,6 +177,7 @@ iwlog_exit(void)
     }
   }
 
+  pthread_mutex_destroy(&alog->lock);
   free(alog);
 }
 
@@ -29,6 +29,7 @@
 
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #include "iw_common.h"
 #include "iw_log.h"
@@ -46,6 +47,7 @@ struct iwlog {
   int logfd;			/* fd of log file */
   size_t msglen;		/* length of log string */
   char msgbuf[LOGMSGBUF_SIZE];	/* log buffer */
+  pthread_mutex_t lock;		/* lock of the log buffer, shared by workers */
 };
 
 
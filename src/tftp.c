@@ -30,6 +30,9 @@
 /* flag for exiting event loop */
 volatile sig_atomic_t g_evloop_exit = IW_FALSE;
 
+/* flag for logging the statistics */
+volatile sig_atomic_t g_stats_dump = IW_FALSE;
+
 /* TFTP error messages */
 static char *errmsgs[] = {
   "",				        /* TFTP_ERR_SEEMSG */
@@ -39,7 +42,8 @@ static char *errmsgs[] = {
   "illegal tftp operation",		/* TFTP_ERR_ILLEGALOPE */
   "unknown transfer id",		/* TFTP_ERR_UNKNOWNID */
   "file already exists",		/* TFTP_ERR_FILEEXIST */
-  "no such user"			/* TFTP_ERR_NOUSER */
+  "no such user",			/* TFTP_ERR_NOUSER */
+  "option negotiation failed"		/* TFTP_ERR_BADOPT */
 };
 
 /* messages of status */
@@ -48,6 +52,8 @@ static struct iwstatus iwtftp_statmsgs[] = {
   { E_DS_FAIL_READ, "error: failed to read the data from datastore, %s" },
   { E_DS_FAIL_WRITE, "error: failed to write the data to datastore, %s" },
   { E_DS_FAIL_CLOSE, "error: failed to close the session on datastore, %s" },
+  { E_DS_FAIL_OPEN, "error: failed to open the file on datastore, %s" },
+  { E_DS_FAIL_CREATE, "error: failed to create the file on datastore, %s" },
   { E_EVENT_NOTEXIST, "error: events nothing" },
   { E_FAIL_ADDRCONVERT, "error: failed to convert ip address" },
   { E_FAIL_CREATE_SOCKET, "error: failed to create socket, ipv%d, %s, %s" },
@@ -60,10 +66,12 @@ static struct iwstatus iwtftp_statmsgs[] = {
   { E_FAIL_RESEND, "error: failed to resend, to '%s:%d'" },
   { E_FAIL_SAVEFILE, "error: could not save the file, '%s'" },
   { E_FAIL_TFTP_PROC, "error: failed TFTP processing" },
-  { E_FAIL_UPDATE_EVENT, "error: error of updating events" },
   { E_IF_NOADDR, "error: interface '%s' has no ipv%d address" },
   { E_IF_NOTFOUND, "error: interface '%s' not found" },
   { E_SERVER_ERR, "error: server error" },
+  { E_WORKER_STOPPED, "error: worker %d stopped" },
+  { E_FAIL_XDP, "error: AF_XDP: %s: failed: %s" },
+  { E_XDP_UNSUPPORTED, "error: AF_XDP is not supported by this build" },
   /* info */
   { I_FILE_EXIST, "info: '%s' already exists" },
   { I_FILE_NOTFOUND, "info: '%s' not found" },
@@ -77,6 +85,22 @@ static struct iwstatus iwtftp_statmsgs[] = {
   { I_TFTPREQ_INCORRECT, "info: incorrect TFTP request format, from '%s:%d'" },
   { I_TFTPREQ_PUT, "info: put request '%s', by '%s:%d'" },
   { I_TFTPTRANS_FIN, "info: '%s' completed, with '%s:%d'" },
+  { I_START_WORKERS, "info: number of workers: %d" },
+  { I_STATS_WORKER, "info: stats: worker %d: rx %llu packets in %llu calls, tx %llu packets in %llu calls, "
+                    "%llu waits" },
+  { I_STATS_TOTAL, "info: stats: %llu packets in %llu system calls, %.3f calls per packet" },
+  { I_STATS_SESSIONS, "info: stats: worker %d: %llu sessions, first reply in %llu usec on average, "
+                      "%llu usec at most, %llu sockets from the pool" },
+  { I_STATS_TXQUEUE, "info: stats: worker %d: %llu EAGAIN, %llu messages waiting for sockets, "
+                     "%llu at most, %llu dropped" },
+  { I_STATS_DATASTORE, "info: stats: datastore: %llu missing files answered by the cache, %llu lookups by stat" },
+  { I_UDP_OFFLOAD, "info: UDP offload: segmentation %s, receive coalescing %s" },
+  { I_EVENT_BACKEND, "info: event backend: %s" },
+  { I_XDP_PATH, "info: AF_XDP: '%s', %d queues, %s mode, session ports %d-%d" },
+  { I_BUSY_POLL, "info: worker %d: busy polling on CPU %d, sleeping after %d msec without packets" },
+  { I_AFFINITY, "info: worker %d: CPU %d, NUMA node %d" },
+  { I_STEERING, "info: requests are steered to %d workers by client addresses" },
+  { I_UPLOAD_TOOLARGE, "info: upload of '%s' exceeds the limit of %lld bytes, by '%s:%d'" },
   { 0, NULL }
 };
 
@@ -86,23 +110,32 @@ static struct iwstatus iwtftp_statvmsgs[] = {
   { EV_ERRMSG_TOOLONG, "error: TFTP error message is too long" },
   { EV_FAIL_ADD_NEWSESSION, "error: failed to add the session, '%s:%d'" },
   { EV_FAIL_BIND, "error: bind: failed: %s" },
+  { EV_FAIL_CONNECT, "error: connect: failed to '%s:%d': %s" },
   { EV_FAIL_CREATE_SESSION,"error: could not create a new session" },
   { EV_FAIL_EPOLL_CREATE, "error: epoll_create: failed: %s" },
   { EV_FAIL_EPOLL_CTL, "error: epoll_ctl: failed to %s event of '%s:%d': %s" },
   { EV_FAIL_EPOLL_WAIT, "error: epoll_wait: failed: %s" },
+  { EV_FAIL_EVENTFD, "error: eventfd: failed: %s" },
   { EV_FAIL_GETADDRINFO, "error: getaddrinfo: failed: %s" },
   { EV_FAIL_GETIFADDRS, "error: getifaddrs: '%s': %s" },
   { EV_FAIL_GETNAMEINFO, "error: getnameinfo: failed: %s" },
   { EV_FAIL_GETSOCKNAME, "error: getsockname: failed: %s" },
   { EV_FAIL_INET_NTOP, "error: inet_ntop: ipv%d '%s': %s" },
-  { EV_FAIL_RECVFROM, "error: recvfrom: failed: %s" },
-  { EV_FAIL_SENDTO, "error: sendto: failed to send to '%s:%d': %s" },
+  { EV_FAIL_PTHREAD_CREATE, "error: pthread_create: failed to start worker %d: %s" },
+  { EV_FAIL_RECVMMSG, "error: recvmmsg: failed: %s" },
+  { EV_FAIL_SCHED_SETAFFINITY, "error: sched_setaffinity: failed to pin worker %d: %s" },
+  { EV_FAIL_SENDMMSG, "error: sendmmsg: failed to send to '%s:%d': %s" },
   { EV_FAIL_SETSOCKOPT,	"error: setsockopt: failed: %s" },
   { EV_FAIL_SOCKET, "error: socket: failed to create a socket: %s" },
+  { EV_FAIL_URING, "error: io_uring: %s: failed: %s" },
+  { EV_FAIL_WRITE_EVENTFD, "error: write: failed to wake up worker %d: %s" },
+  { EV_FAIL_XSK_SEND, "error: AF_XDP: failed to send on queue %u: %s" },
+  { EV_XDP_NOPORT, "error: AF_XDP: no free port of sessions" },
+  { EV_GSO_DISABLED, "error: UDP_SEGMENT disabled on worker %d: %s" },
   { EV_NULL_OBJ, "error: invalid object" },
-  { EV_SESSION_NOTFOUND, "error: session not found, '%s:%d'" },
   { EV_FAIL_GET_SESBUF, "error: failed to get the data from the session buffer, '%s:%d'" },
   { EV_FAIL_PUT_SESBUF, "error: failed to put the data to the session buffer, '%s:%d'" },
+  { EV_FAIL_MAKEOACK, "error: could not make TFTP OACK message, for '%s:%d'" },
   /* info verbose */
   { IV_ACK_INCORRECT, "info: ack filed is incorrect" },
   { IV_DATA_INCORRECT, "info: data filed is too long" },
@@ -111,6 +144,9 @@ static struct iwstatus iwtftp_statvmsgs[] = {
   { IV_FILENAME_INCORRECT, "info: filename field is incorrect" },
   { IV_MODE_INCORRECT, "info: mode field is incorrect" },
   { IV_OPCODE_INCORRECT, "info: opcode filed is incorrect" },
+  { IV_OPTION_INCORRECT, "info: option field is incorrect" },
+  { IV_OPTION_IGNORED, "info: option '%s' ignored, value '%s'" },
+  { IV_OPTION_REJECTED, "info: option '%s' rejected, value '%s'" },
   { IV_REQLEN_TOOSHORT, "info: length of TFTP request message is too short" },
   { IV_UNKNOWN_MSG, "info: unknown message, from '%s:%d'" },
 #ifdef DEBUG
@@ -119,7 +155,7 @@ static struct iwstatus iwtftp_statvmsgs[] = {
   { DBG_ADD_INITEVENT, "DBG: epoll event initialization" },
   { DBG_ADD_SESSION, "DBG: add a new session" },
   { DBG_CHECK_FILE, "DBG: check the file in the datastore" },
-  { DBG_CLEANUP_SESSION, "DBG: clean up sessions" },
+  { DBG_EXPIRE_SESSION, "DBG: processing expired timers of sessions" },
   { DBG_CLOSE_DATA, "DBG: closing the file on datastore" },
   { DBG_CREATE_SOCKET, "DBG: create a new socket" },
   { DBG_DEL_ALLSESSION, "DBG: deleting all sessions" },
@@ -127,30 +163,35 @@ static struct iwstatus iwtftp_statvmsgs[] = {
   { DBG_DEL_SESSION, "DBG: delete a session" },
   { DBG_DS_IOLEN, "DBG: DS: I/O: datalen=%d completed" },
   { DBG_DS_LOAD, "DBG: DS: loading data" },
-  { DBG_DS_REQ, "DBG: DS: REQ: dsid=%d, dfile=%s, dbuf=%s, dlen=%d, derr=%d" },
+  { DBG_DS_REQ, "DBG: DS: REQ: dfile=%s, dbuf=%s, dlen=%d, doff=%ld, derr=%d" },
   { DBG_DS_SAVE, "DBG: DS: saving data" },
+  { DBG_DS_REWIND, "DBG: DS: rewinding data" },
+  { DBG_DS_CREATE, "DBG: DS: creating data" },
   { DBG_DS_SETREQ, "DBG: DS: setting a request ticket of the datastore" },
   { DBG_MAKE_TFTPACK, "DBG: making a TFTP ACK message" },
   { DBG_MAKE_TFTPDATA, "DBG: making a TFTP DATA message" },
   { DBG_MAKE_TFTPERROR, "DBG: making a TFTP ERROR message" },
+  { DBG_MAKE_TFTPOACK, "DBG: making a TFTP OACK message" },
   { DBG_OPCODE, "DBG: opcode=%s" },
   { DBG_PARSE_TFTPACK, "DBG: parsing a TFTP ACK message" },
   { DBG_PARSE_TFTPDATA, "DBG: parsing a TFTP DATA message" },
   { DBG_PARSE_TFTPERROR, "DBG: parsing a TFTP ERROR message" },
   { DBG_PARSE_TFTPREQ, "DBG: parsing a TFTP request message" },
+  { DBG_SET_OPTION, "DBG: negotiating TFTP options of the session" },
   { DBG_PREPARE_RESEND, "DBG: setting sendinfo and updating retry count of the session" },
   { DBG_RECV, "DBG: received: rlen=%d, sock=%d, clip=%s, clport=%d" },
   { DBG_REMAIN_SESSION, "DBG: remains of session" },
-  { DBG_RESEND_SESSION, "DBG: resend sessions" },
+  { DBG_RESEND_SESSION, "DBG: resend the session" },
   { DBG_RETRIEVE_SESSION, "DBG: retrieving the session, clip=%s, clport=%d" },
   { DBG_SEND, "DBG: sent: msglen=%d, sock=%d, clip=%s, clport=%d" },
   { DBG_SENDINFO, "DBG: SENDINFO: sendsock=%d, msglen=%d" },
+  { DBG_SEND_WINDOW, "DBG: sending the rest of the window" },
   { DBG_SEND_SESSION, "DBG: send a TFTP message to the client" },
   { DBG_SESSION_ALL, "DBG: SES %d: '%s:%d', clsock=%d, regev=%d, file=%s, blk=%d, fin=%d, "
-                     "lastmlen=%u, time=%d, retry=%d, dis=%d" },
+                     "lastmlen=%u, time=%dms, retry=%d, dis=%d" },
   { DBG_SESSION_EMPTY, "DBG: session is empty" },
   { DBG_SESSION_ONE, "DBG: SES: '%s:%d', clsock=%d, regev=%d, file=%s, blk=%d, fin=%d, "
-		     "lastmlen=%u, time=%d, retry=%d, dis=%d" },
+		     "lastmlen=%u, time=%dms, retry=%d, dis=%d" },
   { DBG_SET_DISABLE, "DBG: disabled this session" },
   { DBG_SET_FIN, "DBG: finished this session" },
   { DBG_SOCKET, "DBG: socket=%d, ip=%s, port=%s" },
@@ -159,10 +200,13 @@ static struct iwstatus iwtftp_statvmsgs[] = {
   { DBG_TFTPACK, "DBG: TFTPACK: msglen=%d: op=%d, blk=%d" },
   { DBG_TFTPDATA, "DBG: TFTPDATA: msglen=%d: op=%d, blk=%d, data=%s" },
   { DBG_TFTPERROR, "DBG: TFTPERROR: msglen=%d, op=%d, ecode=%d, emsg=%s, emsglen=%d" },
+  { DBG_TFTPOACK, "DBG: TFTPOACK: msglen=%d: op=%d, optflags=0x%x, blksize=%d, windowsize=%d, tsize=%lld, "
+                  "timeout=%dms" },
+  { DBG_TFTPOPT, "DBG: TFTPOPT: %s=%s" },
   { DBG_TFTPREQ, "DBG: TFTPREQ: msglen=%d: op=%d, file=%s, mode=%s" },
   { DBG_TFTP_PROC, "DBG: TFTP processing" },
-  { DBG_UPDATE_EVENT, "DBG: updating epoll events" },
   { DBG_UPDATE_RETRY, "DBG: updating retry count of the session" },
+  { DBG_UPDATE_RTT, "DBG: RTT: sample=%ldus, srtt=%ldus, rttvar=%ldus, rto=%dms" },
   { DBG_GET_SESBUF_DATA, "DBG: reading from the session buffer" },
   { DBG_PUT_SESBUF_DATA, "DBG: writing to the session buffer" },
   { DBG_SESBUF_IOLEN, "DBG: SESBUF: I/O len=%d" },
@@ -173,6 +217,16 @@ static struct iwstatus iwtftp_statvmsgs[] = {
   { 0, NULL }
 };
 
+/* event backends */
+static const struct evbackend epoll_backend = {
+  "epoll", init_epoll, exit_epoll, add_epoll, del_epoll, wait_epoll, send_epoll, NULL, watch_epoll
+};
+#ifdef HAVE_IO_URING
+static const struct evbackend uring_backend = {
+  "io_uring", init_uring, exit_uring, add_uring, del_uring, wait_uring, send_uring, submit_uring, watch_uring
+};
+#endif
+
 /* -------------------------------------------------------------------------- */
 
 /* ------------ */
@@ -180,24 +234,73 @@ static struct iwstatus iwtftp_statvmsgs[] = {
 /* ------------ */
 
 extern IWTFTP *
-iwtftp_init(int32_t ipver, const char *ifname, IWDS *pds)
+iwtftp_init(int32_t ipver, const char *ifname, IWDS *pds, int32_t nworkers, int32_t backend)
 {
   IWTFTP *ins = NULL;
+  struct worker *wk;
   struct ifinet iaddr;
-  int32_t i;
+  const struct evbackend *evb;
+  int32_t freuseport;
+  int32_t i, w;
   
   if (! (ins = malloc(sizeof(IWTFTP)))) {
     pmsg(E_FAIL_MALLOC, __FUNCTION__);
     goto err;
   }
   memset(ins, 0, sizeof(IWTFTP));
-  memset(ins->svsocks, -1, sizeof ins->svsocks);
 
   if (! pds) {
     pmsg(EV_NULL_OBJ);
     goto err;
   }
   ins->ads = pds;
+  ins->maxupload = MAXUPLOAD_DEFAULT;
+
+  if (nworkers < 1) {
+    nworkers = 1;
+  }
+  else if (nworkers > WORKERS_MAX) {
+    nworkers = WORKERS_MAX;
+  }
+
+  if (! (ins->workers = malloc(sizeof(struct worker) * nworkers))) {
+    pmsg(E_FAIL_MALLOC, __FUNCTION__);
+    goto err;
+  }
+  memset(ins->workers, 0, sizeof(struct worker) * nworkers);
+
+  /* fall back to plain sending and receiving on older kernels */
+  probe_udp_offload(&ins->fgso, &ins->fgro);
+
+  /* io_uring falls back to epoll on older kernels */
+  evb = &epoll_backend;
+#ifdef HAVE_IO_URING
+  if (backend == IWTFTP_BACKEND_URING && probe_uring() == IW_TRUE) {
+    evb = &uring_backend;
+  }
+#else
+  (void)backend;
+#endif
+  pmsg(I_EVENT_BACKEND, evb->name);
+
+  for (w = 0; w < nworkers; w++) {
+    wk = &ins->workers[w];
+    wk->ins = ins;
+    wk->id = w;
+    wk->fgso = ins->fgso;
+    wk->fgro = ins->fgro;
+    wk->ads = pds;
+    wk->evb = evb;
+    wk->epollfd = -1;
+#ifdef HAVE_IO_URING
+    wk->ring.fd = -1;
+#endif
+    wk->evfd = -1;
+    wk->cpu = -1;
+    wk->node = -1;
+    memset(wk->svsocks, -1, sizeof wk->svsocks);
+  }
+  ins->nworkers = nworkers;
 
   /* retrieve ipv4 address and ipv6 address */
   if (ifname) {
@@ -219,45 +322,57 @@ iwtftp_init(int32_t ipver, const char *ifname, IWDS *pds)
       }
     }
   }
-  
-  if (ipver & IW_IPV4) {
-    for (i = 0; i < SVSOCKS_MAX; i++) {
-      if (ins->svsocks[i] < 0) {
-	break;
+
+  /* the kernel distributes requests among the server sockets of workers */
+  freuseport = nworkers > 1 ? IW_TRUE : IW_FALSE;
+
+  for (w = 0; w < nworkers; w++) {
+    wk = &ins->workers[w];
+
+    if (ipver & IW_IPV4) {
+      for (i = 0; i < SVSOCKS_MAX; i++) {
+	if (wk->svsocks[i] < 0) {
+	  break;
+	}
+      }
+      wk->svsocks[i] = create_socket(AF_INET, ifname ? iaddr.ipv4addr : "ANY", TFTP_PORT, freuseport);
+      if (wk->svsocks[i] == IW_ERR) {
+	pmsg(E_FAIL_CREATE_SOCKET, 4, ifname ? iaddr.ipv4addr : "ANY", TFTP_PORT);
       }
     }
-    ins->svsocks[i] = create_socket(AF_INET, ifname ? iaddr.ipv4addr : "ANY", TFTP_PORT);
-    if (ins->svsocks[i] == IW_ERR) {
-      pmsg(E_FAIL_CREATE_SOCKET, 4, ifname ? iaddr.ipv4addr : "ANY", TFTP_PORT);
+
+    if (ipver & IW_IPV6) {
+      for (i = 0; i < SVSOCKS_MAX; i++) {
+	if (wk->svsocks[i] < 0) {
+	  break;
+	}
+      }
+      wk->svsocks[i] = create_socket(AF_INET6, ifname ? iaddr.ipv6addr : "ANY", TFTP_PORT, freuseport);
+      if (wk->svsocks[i] == IW_ERR) {
+	pmsg(E_FAIL_CREATE_SOCKET, 6, ifname ? iaddr.ipv6addr : "ANY", TFTP_PORT);
+      }
     }
-  }
 
-  if (ipver & IW_IPV6) {
     for (i = 0; i < SVSOCKS_MAX; i++) {
-      if (ins->svsocks[i] < 0) {
+      if (wk->svsocks[i] >= 0) {
 	break;
       }
     }
-    ins->svsocks[i] = create_socket(AF_INET6, ifname ? iaddr.ipv6addr : "ANY", TFTP_PORT);
-    if (ins->svsocks[i] == IW_ERR) {
-      pmsg(E_FAIL_CREATE_SOCKET, 6, ifname ? iaddr.ipv6addr : "ANY", TFTP_PORT);
+    if (i == SVSOCKS_MAX) {
+      goto err;
     }
-  }
 
-  for (i = 0; i < SVSOCKS_MAX; i++) {
-    if (ins->svsocks[i] >= 0) {
-      return ins;
+    /* to wake up the worker at exiting */
+    if ((wk->evfd = eventfd(0, EFD_NONBLOCK)) == -1) {
+      pmsg(EV_FAIL_EVENTFD, strerror(errno));
+      goto err;
     }
   }
 
+  return ins;
+
  err:
-  if (ins) {
-    for (i = 0; i < SVSOCKS_MAX; i++) {
-      if (ins->svsocks[i] >= 0)
-	close(ins->svsocks[i]);
-    }
-  }
-  free(ins);
+  iwtftp_exit(ins);
   return NULL;
 }
 
@@ -265,186 +380,283 @@ iwtftp_init(int32_t ipver, const char *ifname, IWDS *pds)
 extern void
 iwtftp_exit(IWTFTP *ins)
 {
-  int32_t i;
+  struct worker *wk;
+  int32_t i, w;
   
   if (! ins)
     return;
 
-  del_allsession(&ins->seshead);
+#ifdef HAVE_AF_XDP
+  exit_xdp(ins);
+#endif
 
-  for (i = 0; i < SVSOCKS_MAX; i++) {
-    if (ins->svsocks[i] != -1) {
-      close(ins->svsocks[i]);
-      ins->svsocks[i] = -1;
+  for (w = 0; ins->workers && w < ins->nworkers; w++) {
+    wk = &ins->workers[w];
+
+    del_allsession(&wk->seshead);
+
+    for (i = 0; i < SVSOCKS_MAX; i++) {
+      if (wk->svsocks[i] >= 0) {
+	close(wk->svsocks[i]);
+	wk->svsocks[i] = -1;
+      }
+    }
+    if (wk->evfd >= 0) {
+      close(wk->evfd);
+      wk->evfd = -1;
     }
   }
+  free(ins->workers);
   free(ins);
 }
 
 
 extern int32_t
-iwtftp_service(IWTFTP *ins)
+iwtftp_set_ports(IWTFTP *ins, uint16_t minport, uint16_t maxport)
 {
-  /* for epoll */
-  struct epoll_event events[EVENTS_MAX];
-  struct epoll_event setev;
-  int epollfd = -1;
-  int32_t nfds;
-  int32_t timeout;
-  int32_t nevents;
-  int32_t i, n;
-  /* for receiving */
-  struct sockaddr_storage from;
-  socklen_t fromlen;
-  ssize_t rlen;
-  /* for getting client address */
-  uint8_t rbuf[NWBUF_SIZE];
-  char clipbuf[NI_MAXHOST];	/* 1025 */
-  char clportbuf[NI_MAXSERV];	/* 32 */
-  int ecode;
-  uint16_t clport;
-  /* for sending */
-  struct sendinfo sinfo;
-  int sendsock;
-  ssize_t slen;
-
-  DBG_PRINT(DBG_START_TFTP);
-  
   if (! ins) {
     pmsg(EV_NULL_OBJ);
-    goto err;
+    return IW_ERR;
   }
 
-  if ((epollfd = epoll_create(EVENTS_MAX)) == -1) {
-    pmsg(EV_FAIL_EPOLL_CREATE, strerror(errno));
-    goto err;
+  ins->minport = minport;
+  ins->maxport = maxport < minport ? minport : maxport;
+  return IW_OK;
+}
+
+
+extern int32_t
+iwtftp_set_shared(IWTFTP *ins, int32_t nsocks)
+{
+  if (! ins) {
+    pmsg(EV_NULL_OBJ);
+    return IW_ERR;
   }
 
-  timeout = BLOCKING_TIMEOUT;
+  ins->nshared = nsocks < SHSOCKS_MAX ? nsocks : SHSOCKS_MAX;
+  return IW_OK;
+}
 
-  DBG_PRINT(DBG_ADD_INITEVENT);
-  
-  /* add server socket to the epoll event */
-  for (nevents = 0, i = 0; i < SVSOCKS_MAX; i++) {
-    if (ins->svsocks[i] != -1) {
-      setev.data.fd = ins->svsocks[i];
-      setev.events = EPOLLIN;
 
-      if (epoll_ctl(epollfd, EPOLL_CTL_ADD, ins->svsocks[i], &setev) == -1) {
-	pmsg(EV_FAIL_EPOLL_CTL, "add", "SERVER", TFTP_PORT, strerror(errno));
-	continue;
+extern int32_t
+iwtftp_set_busypoll(IWTFTP *ins, int32_t idle)
+{
+  int32_t w, i;
+
+  if (! ins) {
+    pmsg(EV_NULL_OBJ);
+    return IW_ERR;
+  }
+
+  /* while root, raising the polling time over net.core.busy_read needs CAP_NET_ADMIN */
+  ins->busyidle = idle;
+  for (w = 0; w < ins->nworkers; w++) {
+    for (i = 0; i < SVSOCKS_MAX; i++) {
+      if (ins->workers[w].svsocks[i] != -1) {
+	set_busypoll(ins->workers[w].svsocks[i]);
       }
-      nevents++;
     }
   }
-  if (nevents == 0) {
-    pmsg(E_EVENT_NOTEXIST);
-    goto err;
-  }
+  return IW_OK;
+}
 
-  DBG_PRINT(DBG_START_EVLOOP);
 
-  /* event loop */
-  while (g_evloop_exit != IW_TRUE) {
-    switch ((nfds = epoll_wait(epollfd, events, EVENTS_MAX, timeout))) {
-    case -1:
-      if (errno != EINTR) {
-	pmsg(EV_FAIL_EPOLL_WAIT, strerror(errno));
-      }
-      break;
-    case 0:
-      /* epoll timeout */
-      break;
-    default:
-      for (n = 0; n < nfds; n++) {
-	fromlen = sizeof from;
-	rlen = recvfrom(events[n].data.fd, rbuf, sizeof rbuf, 0, (struct sockaddr *)&from, &fromlen);
-	if (rlen == -1) {
-	  pmsg(EV_FAIL_RECVFROM, strerror(errno));
-	  continue;
-	}
+extern int32_t
+iwtftp_set_maxupload(IWTFTP *ins, off_t size)
+{
+  if (! ins) {
+    pmsg(EV_NULL_OBJ);
+    return IW_ERR;
+  }
 
-	/* get client address and port */
-	if ((ecode = getnameinfo((struct sockaddr *)&from, fromlen, clipbuf, sizeof clipbuf,
-				 clportbuf, sizeof clportbuf, NI_NUMERICHOST | NI_NUMERICSERV)) != 0) {
-	  pmsg(EV_FAIL_GETNAMEINFO, gai_strerror(ecode));
-	  pmsg(E_FAIL_ADDRCONVERT);
-	  continue;
-	}
+  ins->maxupload = size;
+  return IW_OK;
+}
 
-	if (strlen(clipbuf) + 1 > IPADDRLEN_MAX) {
-	  pmsg(EV_BUF_TOOSHORT, "ip address");
-	  pmsg(E_FAIL_ADDRCONVERT);
-	  continue;
-	}
 
-	clport = atoi(clportbuf);
+extern int32_t
+iwtftp_set_affinity(IWTFTP *ins)
+{
+  if (! ins) {
+    pmsg(EV_NULL_OBJ);
+    return IW_ERR;
+  }
 
-	DBG_SH_RECV(rlen, events[n].data.fd, clipbuf, clport);
+  ins->faffinity = IW_TRUE;
+  return IW_OK;
+}
 
-	/* tftp processing */
-	if (tftp_proc(ins, events[n].data.fd, clipbuf, clport, rbuf, rlen, &sinfo) == IW_ERR) {
-	  pmsg(E_FAIL_TFTP_PROC);
-	  continue;
-	}
 
-	/* send reply */
-	sendsock = sinfo.ses ? sinfo.ses->clsock : events[n].data.fd;
+extern int32_t
+iwtftp_set_steering(IWTFTP *ins)
+{
+  int32_t w, i;
 
-	DBG_SH_SENDINFO(sendsock, sinfo.msglen);
+  if (! ins) {
+    pmsg(EV_NULL_OBJ);
+    return IW_ERR;
+  }
 
-	if (sinfo.ses && sinfo.ses->disabled == IW_TRUE) {
-	  continue;
-	}
+  /* a single server socket has no SO_REUSEPORT group */
+  if (ins->nworkers < 2) {
+    return IW_OK;
+  }
 
-	if ((slen = sendto(sendsock, sinfo.msgbuf, sinfo.msglen, 0,
-			   (struct sockaddr *)&from, fromlen)) == -1) {
-	  pmsg(EV_FAIL_SENDTO, sinfo.ses ? sinfo.ses->clip : clipbuf,
-	       sinfo.ses ? sinfo.ses->clport : atoi(clportbuf), strerror(errno));
-	}
-	if (sinfo.ses && sinfo.ses->fin == IW_TRUE) {
-	  pmsg(I_TFTPTRANS_FIN, sinfo.ses->filename, sinfo.ses->clip, sinfo.ses->clport);
-	}
-	
-	DBG_SH_SEND(slen, sendsock, (sinfo.ses ? sinfo.ses->clip : clipbuf),
-		    (sinfo.ses ? sinfo.ses->clport : atoi(clportbuf)));
+  /* the program belongs to the group, the sockets of every worker replace it with the same */
+  for (w = 0; w < ins->nworkers; w++) {
+    for (i = 0; i < SVSOCKS_MAX; i++) {
+      if (ins->workers[w].svsocks[i] != -1 &&
+	  attach_steering(ins->workers[w].svsocks[i], ins->nworkers) == IW_ERR) {
+	return IW_ERR;
       }
+    }
+  }
+  pmsg(I_STEERING, ins->nworkers);
+  return IW_OK;
+}
 
-      /* update epoll event */
-      if ((nevents = update_event(epollfd, ins->seshead)) == IW_ERR) {
-	pmsg(E_FAIL_UPDATE_EVENT);
-      }
-      break;
+
+extern int32_t
+iwtftp_set_xdp(IWTFTP *ins, const char *ifname, uint16_t minport, uint16_t maxport)
+{
+#ifdef HAVE_AF_XDP
+  struct xdppath *xp;
+  struct ifreq ifr;
+  size_t mtu = ETH_DATA_LEN;
+  int32_t nqueues;
+  int sock;
+
+  if (! ins) {
+    pmsg(EV_NULL_OBJ);
+    return IW_ERR;
+  }
+
+  if (! (xp = malloc(sizeof(struct xdppath)))) {
+    pmsg(E_FAIL_MALLOC, __FUNCTION__);
+    return IW_ERR;
+  }
+  memset(xp, 0, sizeof(struct xdppath));
+  xp->prog.mapfd = xp->prog.progfd = xp->prog.linkfd = -1;
+  ins->xdp = xp;
+
+  if (! (xp->ifindex = if_nametoindex(ifname))) {
+    pmsg(E_IF_NOTFOUND, ifname);
+    goto err;
+  }
+
+  /* DATA fits in the MTU, and in a frame after the headroom of receiving */
+  if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) != -1) {
+    memset(&ifr, 0, sizeof ifr);
+    strncpy(ifr.ifr_name, ifname, sizeof ifr.ifr_name - 1);
+    if (ioctl(sock, SIOCGIFMTU, &ifr) == 0) {
+      mtu = ifr.ifr_mtu;
     }
+    close(sock);
+  }
+  mtu = MIN(mtu, XSK_FRAME_SIZE - XSK_RX_HEADROOM - sizeof(struct ether_header));
+  xp->maxblksize = mtu - sizeof(struct iphdr) - sizeof(struct udphdr) - TFTP_OPCODE_SIZE - TFTP_BLKNUM_SIZE;
 
-    /* if needed, to resend */
-    resend_allsession(ins->seshead, ins->ads);
+  xp->minport = minport ? minport : SESPORT_MIN;
+  xp->maxport = maxport ? maxport : SESPORT_MAX;
+  if (xp->minport > xp->maxport) {
+    xp->maxport = xp->minport;
+  }
+  xp->nextport = xp->minport;
 
-    /* clean up finished sessions */
-    cleanup_session(&ins->seshead);
-    DBG_SH_DSALLDSESSION(ins->ads);
+  if (xdp_load(&xp->prog, atoi(TFTP_PORT), xp->minport, xp->maxport) == IW_ERR) {
+    pmsg(E_FAIL_XDP, "load program", strerror(errno));
+    goto err;
+  }
+  if (xdp_attach(&xp->prog, xp->ifindex) == IW_ERR) {
+    pmsg(E_FAIL_XDP, "attach program", strerror(errno));
+    goto err;
   }
 
-  del_allsession(&ins->seshead);
-  close(epollfd);
-  for (i = 0; i < SVSOCKS_MAX; i++) {
-    if (ins->svsocks[i] != -1) {
-      close(ins->svsocks[i]);
-      ins->svsocks[i] = -1;
+  /* zero-copy needs the program in the driver */
+  nqueues = xdp_count_queues(ifname);
+  for (xp->nxsks = 0; xp->nxsks < nqueues; xp->nxsks++) {
+    if (xsk_init(&xp->xsks[xp->nxsks], xp->ifindex, xp->nxsks, xp->prog.mapfd,
+		 xp->prog.fgeneric == IW_TRUE ? IW_FALSE : IW_TRUE) == IW_ERR) {
+      pmsg(E_FAIL_XDP, "socket", strerror(errno));
+      goto err;
     }
   }
+
+  pmsg(I_XDP_PATH, ifname, nqueues,
+       xp->prog.fgeneric == IW_TRUE ? "generic" : (xp->xsks[0].fzerocopy == IW_TRUE ? "zero-copy" : "driver"),
+       xp->minport, xp->maxport);
   return IW_OK;
 
  err:
-  del_allsession(&ins->seshead);
-  if (epollfd != -1)
-    close(epollfd);
-  for (i = 0; i < SVSOCKS_MAX; i++) {
-    if (ins->svsocks[i] != -1) {
-      close(ins->svsocks[i]);
-      ins->svsocks[i] = -1;
+  exit_xdp(ins);
+  return IW_ERR;
+#else
+  (void)ins;
+  (void)ifname;
+  (void)minport;
+  (void)maxport;
+  pmsg(E_XDP_UNSUPPORTED);
+  return IW_ERR;
+#endif
+}
+
+
+extern int32_t
+iwtftp_service(IWTFTP *ins)
+{
+  sigset_t allsigs;
+  sigset_t oldsigs;
+  uint64_t val = 1;
+  int32_t ret;
+  int32_t w;
+
+  DBG_PRINT(DBG_START_TFTP);
+  
+  if (! ins) {
+    pmsg(EV_NULL_OBJ);
+    goto err;
+  }
+
+  pmsg(I_START_WORKERS, ins->nworkers);
+
+  /* worker threads don't take signals, the first worker runs on this thread */
+  sigfillset(&allsigs);
+  pthread_sigmask(SIG_BLOCK, &allsigs, &oldsigs);
+
+  for (w = 1; w < ins->nworkers; w++) {
+    if ((ret = pthread_create(&ins->workers[w].thread, NULL, worker_thread, &ins->workers[w])) != 0) {
+      pmsg(EV_FAIL_PTHREAD_CREATE, w, strerror(ret));
+      break;
+    }
+    ins->workers[w].fthread = IW_TRUE;
+  }
+
+  pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+
+  if (w == ins->nworkers) {
+    ins->workers[0].status = service_worker(&ins->workers[0]);
+  }
+  else {
+    ins->workers[0].status = IW_ERR;
+  }
+
+  /* wake up and wait for other workers */
+  g_evloop_exit = IW_TRUE;
+  for (w = 1; w < ins->nworkers; w++) {
+    if (ins->workers[w].fthread == IW_FALSE) {
+      continue;
+    }
+    if (ins->workers[w].evfd >= 0 && write(ins->workers[w].evfd, &val, sizeof val) == -1) {
+      pmsg(EV_FAIL_WRITE_EVENTFD, w, strerror(errno));
     }
+    pthread_join(ins->workers[w].thread, NULL);
+    ins->workers[w].fthread = IW_FALSE;
   }
+  show_stats(ins);
+
+  return ins->workers[0].status;
+
+ err:
   return IW_ERR;
 }
 
@@ -510,186 +722,2223 @@ pmsg(int32_t statcode, ...)
 
 /* for socket */
 /* ---------- */
+static void *
+worker_thread(void *arg)
+{
+  struct worker *wk = arg;
+
+  if ((wk->status = service_worker(wk)) == IW_ERR) {
+    pmsg(E_WORKER_STOPPED, wk->id);
+  }
+  return NULL;
+}
+
+
+/* event loop of the worker */
 static int32_t
-get_ifaddress(const char *ifname, struct ifinet *iaddr)
+service_worker(struct worker *wk)
 {
-  struct ifaddrs *ifa;
-  struct ifaddrs *pm;
-  int32_t iffound;
-  size_t ipv6len;
-  
-  memset(iaddr, 0, sizeof(struct ifinet));
-  
-  if (getifaddrs(&ifa) == -1) {
-    pmsg(EV_FAIL_GETIFADDRS, ifname, strerror(errno));
+#ifdef HAVE_AF_XDP
+  struct xdppath *xp;
+#endif
+  int64_t now;
+  uint64_t rxpkts;
+  int32_t timeout;
+  int32_t nevents;
+  int32_t i;
+
+  /* pinned before allocating, the memory of the worker is on the local node by first touch */
+  if (wk->ins->faffinity == IW_TRUE || wk->ins->busyidle > 0) {
+    set_affinity(wk);
+  }
+
+  /* grows with the number of sessions */
+  if (! (wk->sestable = calloc(SESTABLE_INIT, sizeof(struct session *)))) {
+    pmsg(E_FAIL_MALLOC, __FUNCTION__);
     goto err;
   }
+  wk->sestablesize = SESTABLE_INIT;
+  wk->nsessions = 0;
 
-  /* check ifname */
-  for (pm = ifa, iffound = IW_FALSE; pm; pm = pm->ifa_next) {
-    if (strcmp(pm->ifa_name, ifname) == 0) {
-      iffound = IW_TRUE;
-      break;
+  /* buffers for batched sending */
+  if (init_iobatch(&wk->tx, NWBUF_SIZE, IW_FALSE) == IW_ERR) {
+    goto err;
+  }
+
+  if (wk->evb->init(wk) == IW_ERR) {
+    if (wk->evb == &epoll_backend) {
+      goto err;
+    }
+    /* e.g. locked memory limit of the rings */
+    pmsg(I_EVENT_BACKEND, epoll_backend.name);
+    wk->evb = &epoll_backend;
+    if (wk->evb->init(wk) == IW_ERR) {
+      goto err;
     }
   }
-  if (iffound == IW_FALSE) {
-    pmsg(E_IF_NOTFOUND, ifname);
+
+  DBG_PRINT(DBG_ADD_INITEVENT);
+  
+  /* add server socket to the event backend */
+  for (nevents = 0, i = 0; i < SVSOCKS_MAX; i++) {
+    if (wk->svsocks[i] != -1) {
+      wk->svsrcs[i].type = EVSRC_SERVER;
+      wk->svsrcs[i].fd = wk->svsocks[i];
+      wk->svsrcs[i].ses = NULL;
+      /* prefer this worker among SO_REUSEPORT sockets for packets received on its CPU */
+      if (wk->cpu != -1 &&
+	  setsockopt(wk->svsocks[i], SOL_SOCKET, SO_INCOMING_CPU, &wk->cpu, sizeof wk->cpu) == -1) {
+	pmsg(EV_FAIL_SETSOCKOPT, strerror(errno));
+      }
+      if (add_event(wk, &wk->svsrcs[i], "SERVER", atoi(TFTP_PORT)) == IW_ERR) {
+	continue;
+      }
+      nevents++;
+    }
+  }
+  if (nevents == 0) {
+    pmsg(E_EVENT_NOTEXIST);
     goto err;
   }
 
-  /* get ip addresses */
-  for (pm = ifa; pm; pm = pm->ifa_next) {
-    if (pm->ifa_addr && strcmp(pm->ifa_name, ifname) == 0) {
+  /* sockets of sessions, bound before the requests */
+  init_sockpool(wk);
 
-      /* ipv4 */
-      if (pm->ifa_addr->sa_family == AF_INET) {
-	if (! inet_ntop(pm->ifa_addr->sa_family, &((struct sockaddr_in *)pm->ifa_addr)->sin_addr,
-			iaddr->ipv4addr, sizeof iaddr->ipv4addr)) {
-	  pmsg(EV_FAIL_INET_NTOP, 4, ifname, strerror(errno));
-	  goto err;
-	}
-      }
+  /* for waking up at exiting */
+  wk->wakesrc.type = EVSRC_WAKEUP;
+  wk->wakesrc.fd = wk->evfd;
+  wk->wakesrc.ses = NULL;
+  if (add_event(wk, &wk->wakesrc, "EVENTFD", 0) == IW_ERR) {
+    goto err;
+  }
 
-      /* ipv6 */
+#ifdef HAVE_AF_XDP
+  /* the sessions of the AF_XDP path are in the first worker, whichever queue receives */
+  if (wk->id == 0 && (xp = wk->ins->xdp)) {
+    for (i = 0; i < xp->nxsks; i++) {
+      xp->srcs[i].type = EVSRC_XSK;
+      xp->srcs[i].fd = xp->xsks[i].fd;
+      xp->srcs[i].ses = NULL;
+      if (add_event(wk, &xp->srcs[i], "XDP", i) == IW_ERR) {
+	goto err;
+      }
+    }
+  }
+#endif
+
+  /* the spinning worker keeps a CPU */
+  if (wk->ins->busyidle > 0) {
+    pmsg(I_BUSY_POLL, wk->id, wk->cpu, wk->ins->busyidle);
+  }
+
+  DBG_PRINT(DBG_START_EVLOOP);
+
+  now = get_monotonic_msec();
+  tw_init(&wk->timers, now);
+  wk->lastrx = now;
+
+  /* event loop */
+  while (g_evloop_exit != IW_TRUE) {
+    /* sleep until the nearest timer of sessions, or spin while packets come */
+    now = get_monotonic_msec();
+    timeout = tw_next_timeout(&wk->timers, now);
+    if (wk->ins->busyidle > 0 && now - wk->lastrx < wk->ins->busyidle) {
+      timeout = 0;
+    }
+
+    rxpkts = wk->stats.rxpkts;
+    wk->evb->wait(wk, timeout);
+    if (wk->stats.rxpkts != rxpkts) {
+      wk->lastrx = get_monotonic_msec();
+    }
+
+    /* replies are sent before any session is closed */
+    flush_tx(wk);
+
+    /* resend or close the sessions of expired timers */
+    expire_session(wk);
+    flush_tx(wk);
+    DBG_SH_DSALLDSESSION(wk->ads);
+
+    /* bind the sockets taken by new sessions, after replying */
+    for (i = 0; i < SVSOCKS_MAX; i++) {
+      if (wk->pools[i].n < SOCKPOOL_MIN && wk->pools[i].nshared == 0) {
+	fill_sockpool(wk, &wk->pools[i]);
+      }
+    }
+
+    /* SIGUSR1 is taken by the main thread, the first worker */
+    if (g_stats_dump == IW_TRUE && wk->id == 0) {
+      g_stats_dump = IW_FALSE;
+      show_stats(wk->ins);
+    }
+  }
+
+  wk->evb->exit(wk);
+  del_allsession(&wk->seshead);
+  exit_sockpool(wk);
+  free(wk->sestable);
+  wk->sestable = NULL;
+  free(wk->tx.bufs);
+  wk->tx.bufs = NULL;
+  for (i = 0; i < SVSOCKS_MAX; i++) {
+    if (wk->svsocks[i] != -1) {
+      free_outq(wk, &wk->svsrcs[i]);
+      close(wk->svsocks[i]);
+      wk->svsocks[i] = -1;
+    }
+  }
+  return IW_OK;
+
+ err:
+  wk->evb->exit(wk);
+  del_allsession(&wk->seshead);
+  exit_sockpool(wk);
+  free(wk->sestable);
+  wk->sestable = NULL;
+  free(wk->tx.bufs);
+  wk->tx.bufs = NULL;
+  for (i = 0; i < SVSOCKS_MAX; i++) {
+    if (wk->svsocks[i] != -1) {
+      free_outq(wk, &wk->svsrcs[i]);
+      close(wk->svsocks[i]);
+      wk->svsocks[i] = -1;
+    }
+  }
+  return IW_ERR;
+}
+
+
+/* process the datagrams, DATA coalesced by UDP_GRO is split into seglen */
+static void
+handle_segments(struct worker *wk, struct evsrc *src, struct peer *pr, uint8_t *rbuf, size_t rlen, int seglen)
+{
+  size_t len;
+
+  if (seglen <= 0 || (size_t)seglen > rlen) {
+    seglen = rlen;
+  }
+  do {
+    len = rlen < (size_t)seglen ? rlen : (size_t)seglen;
+    STAT_ADD(wk->stats.rxpkts, 1);
+    handle_packet(wk, src, pr, rbuf, len);
+    rbuf += len;
+    rlen -= len;
+  } while (rlen > 0);
+}
+
+
+/* process a received packet, and queue the reply */
+static void
+handle_packet(struct worker *wk, struct evsrc *src, struct peer *pr, void *rbuf, size_t rlen)
+{
+  struct sendinfo sinfo;
+  const struct xskroute *rt;
+  struct evsrc *sendsrc;
+  uint64_t ttfb;
+
+  DBG_SH_RECV(rlen, src->fd, peer_ip(pr), peer_port(pr));
+
+  /* the reply is made on the next slot of the send queue, or a frame of the AF_XDP socket */
+  if (! (sinfo.msgbuf = get_txbuf(wk, pr->route ? pr->route->xsk : NULL, &sinfo.bufsize))) {
+    /* all frames in flight, the client sends again */
+    return;
+  }
+
+  /* tftp processing */
+  if (tftp_proc(wk, src, pr, rbuf, rlen, &sinfo) == IW_ERR) {
+    pmsg(E_FAIL_TFTP_PROC);
+    return;
+  }
+
+  /* send reply */
+  sendsrc = sinfo.ses ? sinfo.ses->sendsrc : src;
+  rt = sinfo.ses ? (sinfo.ses->route.xsk ? &sinfo.ses->route : NULL) : pr->route;
+
+  DBG_SH_SENDINFO(sendsrc ? sendsrc->fd : -1, sinfo.msglen);
+
+  if (sinfo.ses && sinfo.ses->disabled == IW_TRUE) {
+    set_session_timer(&wk->timers, sinfo.ses);
+    return;
+  }
+
+  if (sinfo.msglen > 0) {
+    put_txbuf(wk, sendsrc, sinfo.msglen,
+	      sinfo.ses && is_connected(sinfo.ses) == IW_TRUE ? NULL : pr->addr, pr->addrlen, rt);
+    DBG_SH_SEND(sinfo.msglen, sendsrc ? sendsrc->fd : -1, peer_ip(pr), peer_port(pr));
+  }
+
+  /* time to the first reply of the new session */
+  if (sinfo.ses && sinfo.ses->reqstamp) {
+    ttfb = get_monotonic_usec() - sinfo.ses->reqstamp;
+    sinfo.ses->reqstamp = 0;
+    STAT_ADD(wk->stats.sessions, 1);
+    STAT_ADD(wk->stats.ttfbsum, ttfb);
+    if (ttfb > wk->stats.ttfbmax) {
+      STAT_SET(wk->stats.ttfbmax, ttfb);
+    }
+  }
+
+  /* fill up the window with following DATA */
+  if (sinfo.ses && sinfo.ses->reqop == OP_RRQ && sinfo.ses->foack == IW_FALSE && sinfo.ses->fin == IW_FALSE) {
+    send_window(wk, sinfo.ses);
+  }
+
+  if (sinfo.ses) {
+    set_session_timer(&wk->timers, sinfo.ses);
+  }
+}
+
+
+static int32_t
+init_iobatch(struct iobatch *b, size_t bufsize, int32_t fctrl)
+{
+  int32_t i;
+
+  if (! (b->bufs = malloc((size_t)IOBATCH_MAX * bufsize))) {
+    pmsg(E_FAIL_MALLOC, __FUNCTION__);
+    return IW_ERR;
+  }
+
+  memset(b->msgs, 0, sizeof b->msgs);
+  for (i = 0; i < IOBATCH_MAX; i++) {
+    b->iovs[i].iov_base = b->bufs + (size_t)i * bufsize;
+    b->iovs[i].iov_len = bufsize;
+    b->msgs[i].msg_hdr.msg_iov = &b->iovs[i];
+    b->msgs[i].msg_hdr.msg_iovlen = 1;
+    b->msgs[i].msg_hdr.msg_name = &b->addrs[i];
+    b->msgs[i].msg_hdr.msg_namelen = sizeof b->addrs[i];
+    /* for receiving the segment size of UDP_GRO */
+    if (fctrl == IW_TRUE) {
+      b->msgs[i].msg_hdr.msg_control = b->ctrls[i];
+      b->msgs[i].msg_hdr.msg_controllen = sizeof b->ctrls[i];
+    }
+  }
+  b->n = 0;
+
+  return IW_OK;
+}
+
+
+/* buffer of the next message to be sent, flushing the queue if full.
+ * For the AF_XDP socket xs, it is a frame of UMEM after the room of the headers,
+ * kept for the slot until the message is sent. NULL if no frame is free.
+ */
+static uint8_t *
+get_txbuf(struct worker *wk, struct xsk *xs, size_t *bufsize)
+{
+  struct iobatch *b = &wk->tx;
+
+  if (b->n == IOBATCH_MAX) {
+    flush_tx(wk);
+  }
+
+#ifdef HAVE_AF_XDP
+  /* a frame left by the message not queued */
+  if (b->xsks[b->n] && b->xsks[b->n] != xs) {
+    xsk_put_frame(b->xsks[b->n], b->frames[b->n]);
+    b->xsks[b->n] = NULL;
+  }
+  if (xs) {
+    if (! b->xsks[b->n]) {
+      if (! xsk_get_frame(xs, &b->frames[b->n])) {
+	return NULL;
+      }
+      b->xsks[b->n] = xs;
+    }
+    b->iovs[b->n].iov_base = xs->umem + b->frames[b->n] + XDP_HDR_SIZE;
+    *bufsize = XSK_FRAME_SIZE - XDP_HDR_SIZE;
+    return b->iovs[b->n].iov_base;
+  }
+#else
+  (void)xs;
+#endif
+
+  b->iovs[b->n].iov_base = b->bufs + (size_t)b->n * NWBUF_SIZE;
+  *bufsize = NWBUF_SIZE;
+  return b->iovs[b->n].iov_base;
+}
+
+
+/* queue the message made on the buffer from get_txbuf(), to the XDP device by rt if not NULL */
+static void
+put_txbuf(struct worker *wk, struct evsrc *src, size_t len, const struct sockaddr *to, socklen_t tolen,
+	  const struct xskroute *rt)
+{
+  struct iobatch *b = &wk->tx;
+
+  b->srcs[b->n] = src;
+  b->socks[b->n] = src ? src->fd : -1;
+  b->iovs[b->n].iov_len = len;
+  if (to) {
+    memcpy(&b->addrs[b->n], to, tolen);
+    b->msgs[b->n].msg_hdr.msg_namelen = tolen;
+  }
+  else {
+    b->msgs[b->n].msg_hdr.msg_namelen = 0;
+  }
+
+#ifdef HAVE_AF_XDP
+  /* by the socket owning the frame, a run of the same socket is sent together */
+  b->routes[b->n].xsk = NULL;
+  if (rt) {
+    if (! b->xsks[b->n]) {
+      /* a packet of the session came by a kernel socket, no frame for it */
+      return;
+    }
+    b->routes[b->n] = *rt;
+    b->routes[b->n].xsk = b->xsks[b->n];
+    b->socks[b->n] = b->xsks[b->n]->fd;
+  }
+#else
+  (void)rt;
+#endif
+  b->n++;
+}
+
+
+/* send the queued messages by the backend, for each run of the same socket.
+ * DATA of a window to the same client goes as a message of UDP_SEGMENT,
+ * the kernel splits it into datagrams of the segment size.
+ */
+static void
+flush_tx(struct worker *wk)
+{
+  struct iobatch *b = &wk->tx;
+  struct msghdr *mh;
+  struct cmsghdr *cm;
+  uint32_t i, j, end, gend;
+  uint32_t first, ngrps;
+  size_t total;
+
+  for (ngrps = 0, i = 0; i < b->n; i = end) {
+    for (end = i + 1; end < b->n && b->socks[end] == b->socks[i]; end++)
+      ;
+
+#ifdef HAVE_AF_XDP
+    if (b->routes[i].xsk) {
+      send_xdp(wk, i, end);
+      continue;
+    }
+#endif
+
+    /* group same-size messages to the same client, the last can be shorter */
+    for (first = ngrps, j = i; j < end; j = gend, ngrps++) {
+      total = b->iovs[j].iov_len;
+      for (gend = j + 1; wk->fgso == IW_TRUE && gend < end && gend - j < GSO_SEGS_MAX; gend++) {
+	if (b->iovs[gend - 1].iov_len != b->iovs[j].iov_len || b->iovs[gend].iov_len > b->iovs[j].iov_len ||
+	    total + b->iovs[gend].iov_len > GSO_BYTES_MAX ||
+	    b->msgs[gend].msg_hdr.msg_namelen != b->msgs[j].msg_hdr.msg_namelen ||
+	    memcmp(&b->addrs[gend], &b->addrs[j], b->msgs[j].msg_hdr.msg_namelen) != 0) {
+	  break;
+	}
+	total += b->iovs[gend].iov_len;
+      }
+
+      mh = &b->gmsgs[ngrps].msg_hdr;
+      memset(mh, 0, sizeof(struct msghdr));
+      mh->msg_name = &b->addrs[j];
+      mh->msg_namelen = b->msgs[j].msg_hdr.msg_namelen;
+      mh->msg_iov = &b->iovs[j];
+      mh->msg_iovlen = gend - j;
+      if (gend - j > 1) {
+	mh->msg_control = b->ctrls[ngrps];
+	mh->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+	cm = CMSG_FIRSTHDR(mh);
+	cm->cmsg_level = SOL_UDP;
+	cm->cmsg_type = UDP_SEGMENT;
+	cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+	*(uint16_t *)CMSG_DATA(cm) = b->iovs[j].iov_len;
+      }
+      b->gfirst[ngrps] = j;
+      b->gsegs[ngrps] = gend - j;
+    }
+
+    wk->evb->send(wk, b->srcs[i], first, ngrps - first);
+  }
+
+  /* the buffers are reused after this */
+  if (b->n > 0 && wk->evb->submit) {
+    wk->evb->submit(wk);
+  }
+
+#ifdef HAVE_AF_XDP
+  /* frames sent by kernel sockets, and the frame of the next slot not queued */
+  for (i = 0; i <= b->n && i < IOBATCH_MAX; i++) {
+    if (b->xsks[i]) {
+      xsk_put_frame(b->xsks[i], b->frames[i]);
+      b->xsks[i] = NULL;
+    }
+  }
+#endif
+  b->n = 0;
+}
+
+
+/* send the messages one by one, by sendmmsg() */
+static void
+send_plain(struct worker *wk, struct evsrc *src, uint32_t first, uint32_t n)
+{
+  struct iobatch *b = &wk->tx;
+  uint32_t i = first;
+  uint32_t end = first + n;
+  int nsent;
+
+  while (i < end) {
+    if (src->nout > 0) {
+      queue_msg(wk, src, &b->msgs[i++].msg_hdr, 1);
+      continue;
+    }
+    nsent = sendmmsg(src->fd, &b->msgs[i], end - i, MSG_DONTWAIT);
+    STAT_ADD(wk->stats.txcalls, 1);
+
+    if (nsent == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+	STAT_ADD(wk->stats.txeagain, 1);
+	queue_msg(wk, src, &b->msgs[i++].msg_hdr, 1);
+	continue;
+      }
+      /* drop the failed message, the session resends it later */
+      send_failed(src->fd, &b->msgs[i]);
+      i++;
+      continue;
+    }
+    STAT_ADD(wk->stats.txpkts, nsent);
+    i += nsent;
+  }
+}
+
+
+/* keep a copy of the message until the socket is writable, watching EPOLLOUT from the first */
+static void
+queue_msg(struct worker *wk, struct evsrc *src, struct msghdr *mh, uint32_t nsegs)
+{
+  struct outmsg *m;
+  size_t len = 0;
+  size_t i;
+
+  if (src->nout >= OUTQ_MAX) {
+    /* the session resends it later */
+    STAT_ADD(wk->stats.txqdrops, 1);
+    return;
+  }
+
+  for (i = 0; i < mh->msg_iovlen; i++) {
+    len += mh->msg_iov[i].iov_len;
+  }
+  if (! (m = malloc(sizeof(struct outmsg) + len))) {
+    pmsg(E_FAIL_MALLOC, __FUNCTION__);
+    return;
+  }
+  m->next = NULL;
+  m->addrlen = mh->msg_namelen;
+  if (m->addrlen) {
+    memcpy(&m->addr, mh->msg_name, m->addrlen);
+  }
+  m->nsegs = nsegs;
+  m->segsize = nsegs > 1 ? mh->msg_iov[0].iov_len : 0;
+  for (m->len = 0, i = 0; i < mh->msg_iovlen; i++) {
+    memcpy(m->data + m->len, mh->msg_iov[i].iov_base, mh->msg_iov[i].iov_len);
+    m->len += mh->msg_iov[i].iov_len;
+  }
+
+  if (src->outtail) {
+    src->outtail->next = m;
+  }
+  else {
+    src->outhead = m;
+    wk->evb->watch(wk, src, IW_TRUE);
+  }
+  src->outtail = m;
+  src->nout++;
+
+  STAT_ADD(wk->stats.txqueued, 1);
+  if (wk->stats.txqueued > wk->stats.txqmax) {
+    STAT_SET(wk->stats.txqmax, wk->stats.txqueued);
+  }
+}
+
+
+/* send the waiting messages in order, while the socket is writable */
+static void
+drain_outq(struct worker *wk, struct evsrc *src)
+{
+  struct outmsg *m;
+  struct mmsghdr mm;
+  struct iovec iov;
+  struct cmsghdr *cm;
+  uint8_t ctrl[CMSG_SPACE(sizeof(uint16_t))];
+
+  while ((m = src->outhead)) {
+    memset(&mm, 0, sizeof mm);
+    iov.iov_base = m->data;
+    iov.iov_len = m->len;
+    mm.msg_hdr.msg_name = m->addrlen ? &m->addr : NULL;
+    mm.msg_hdr.msg_namelen = m->addrlen;
+    mm.msg_hdr.msg_iov = &iov;
+    mm.msg_hdr.msg_iovlen = 1;
+    if (m->segsize) {
+      mm.msg_hdr.msg_control = ctrl;
+      mm.msg_hdr.msg_controllen = sizeof ctrl;
+      cm = CMSG_FIRSTHDR(&mm.msg_hdr);
+      cm->cmsg_level = SOL_UDP;
+      cm->cmsg_type = UDP_SEGMENT;
+      cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+      *(uint16_t *)CMSG_DATA(cm) = m->segsize;
+    }
+
+    STAT_ADD(wk->stats.txcalls, 1);
+    if (sendmsg(src->fd, &mm.msg_hdr, MSG_DONTWAIT) == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+	STAT_ADD(wk->stats.txeagain, 1);
+	return;
+      }
+      /* dropped, the session resends it later */
+      send_failed(src->fd, &mm);
+    }
+    else {
+      STAT_ADD(wk->stats.txpkts, m->nsegs);
+    }
+
+    src->outhead = m->next;
+    free(m);
+    src->nout--;
+    STAT_ADD(wk->stats.txqueued, -1);
+  }
+
+  /* all sent, only reading again */
+  src->outtail = NULL;
+  wk->evb->watch(wk, src, IW_FALSE);
+}
+
+
+/* drop the waiting messages of the socket being closed */
+static void
+free_outq(struct worker *wk, struct evsrc *src)
+{
+  struct outmsg *m;
+
+  while ((m = src->outhead)) {
+    src->outhead = m->next;
+    free(m);
+    STAT_ADD(wk->stats.txqueued, -1);
+  }
+  src->outtail = NULL;
+  src->nout = 0;
+}
+
+
+static void
+send_failed(int sock, struct mmsghdr *msg)
+{
+  char ipbuf[IPADDRLEN_MAX];
+  struct sockaddr_storage peer;
+  struct sockaddr *to = msg->msg_hdr.msg_name;
+  socklen_t peerlen = sizeof peer;
+  int eno = errno;
+
+  /* the socket of a session is connected to its client */
+  if (msg->msg_hdr.msg_namelen == 0) {
+    memset(&peer, 0, sizeof peer);
+    getpeername(sock, (struct sockaddr *)&peer, &peerlen);
+    to = (struct sockaddr *)&peer;
+  }
+  if (format_sockaddr(to, ipbuf, sizeof ipbuf) == IW_ERR) {
+    strncpy(ipbuf, "?", sizeof ipbuf);
+  }
+  pmsg(EV_FAIL_SENDMMSG, ipbuf, sockaddr_port(to), strerror(eno));
+}
+
+
+/* segment size of the coalesced datagrams by UDP_GRO, or 0 */
+static int
+get_gro_size(struct msghdr *mh)
+{
+  struct cmsghdr *cm;
+
+  for (cm = CMSG_FIRSTHDR(mh); cm; cm = CMSG_NXTHDR(mh, cm)) {
+    if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+      return *(int *)CMSG_DATA(cm);
+    }
+  }
+  return 0;
+}
+
+
+/* whether the kernel accepts UDP_SEGMENT and UDP_GRO */
+static void
+probe_udp_offload(int32_t *fgso, int32_t *fgro)
+{
+  int sock;
+  int val;
+
+  *fgso = *fgro = IW_FALSE;
+
+  if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+    return;
+  }
+
+  val = TFTP_DATALEN_MAX;
+  if (setsockopt(sock, SOL_UDP, UDP_SEGMENT, &val, sizeof val) == 0) {
+    *fgso = IW_TRUE;
+  }
+  val = 1;
+  if (setsockopt(sock, SOL_UDP, UDP_GRO, &val, sizeof val) == 0) {
+    *fgro = IW_TRUE;
+  }
+  close(sock);
+
+  pmsg(I_UDP_OFFLOAD, *fgso == IW_TRUE ? "on" : "off", *fgro == IW_TRUE ? "on" : "off");
+}
+
+
+/* counters of packets and system calls of all workers */
+static void
+show_stats(IWTFTP *ins)
+{
+  struct iostats *st;
+  struct dsstats dsst;
+  uint64_t npkts = 0, ncalls = 0;
+  uint64_t nses;
+  int32_t w;
+
+  for (w = 0; w < ins->nworkers; w++) {
+    st = &ins->workers[w].stats;
+    pmsg(I_STATS_WORKER, w,
+	 (unsigned long long)STAT_GET(st->rxpkts), (unsigned long long)STAT_GET(st->rxcalls),
+	 (unsigned long long)STAT_GET(st->txpkts), (unsigned long long)STAT_GET(st->txcalls),
+	 (unsigned long long)STAT_GET(st->waitcalls));
+    nses = STAT_GET(st->sessions);
+    pmsg(I_STATS_SESSIONS, w, (unsigned long long)nses,
+	 (unsigned long long)(nses ? STAT_GET(st->ttfbsum) / nses : 0),
+	 (unsigned long long)STAT_GET(st->ttfbmax), (unsigned long long)STAT_GET(st->poolhits));
+    pmsg(I_STATS_TXQUEUE, w, (unsigned long long)STAT_GET(st->txeagain),
+	 (unsigned long long)STAT_GET(st->txqueued), (unsigned long long)STAT_GET(st->txqmax),
+	 (unsigned long long)STAT_GET(st->txqdrops));
+    npkts += STAT_GET(st->rxpkts) + STAT_GET(st->txpkts);
+    ncalls += STAT_GET(st->rxcalls) + STAT_GET(st->txcalls) + STAT_GET(st->waitcalls);
+  }
+
+  pmsg(I_STATS_TOTAL, (unsigned long long)npkts, (unsigned long long)ncalls,
+       npkts ? (double)ncalls / npkts : 0.0);
+
+  iwds_get_stats(ins->ads, &dsst);
+  pmsg(I_STATS_DATASTORE, (unsigned long long)dsst.neghits, (unsigned long long)dsst.negmisses);
+}
+
+
+static int32_t
+get_ifaddress(const char *ifname, struct ifinet *iaddr)
+{
+  struct ifaddrs *ifa;
+  struct ifaddrs *pm;
+  int32_t iffound;
+  size_t ipv6len;
+  
+  memset(iaddr, 0, sizeof(struct ifinet));
+  
+  if (getifaddrs(&ifa) == -1) {
+    pmsg(EV_FAIL_GETIFADDRS, ifname, strerror(errno));
+    goto err;
+  }
+
+  /* check ifname */
+  for (pm = ifa, iffound = IW_FALSE; pm; pm = pm->ifa_next) {
+    if (strcmp(pm->ifa_name, ifname) == 0) {
+      iffound = IW_TRUE;
+      break;
+    }
+  }
+  if (iffound == IW_FALSE) {
+    pmsg(E_IF_NOTFOUND, ifname);
+    goto err;
+  }
+
+  /* get ip addresses */
+  for (pm = ifa; pm; pm = pm->ifa_next) {
+    if (pm->ifa_addr && strcmp(pm->ifa_name, ifname) == 0) {
+
+      /* ipv4 */
+      if (pm->ifa_addr->sa_family == AF_INET) {
+	if (! inet_ntop(pm->ifa_addr->sa_family, &((struct sockaddr_in *)pm->ifa_addr)->sin_addr,
+			iaddr->ipv4addr, sizeof iaddr->ipv4addr)) {
+	  pmsg(EV_FAIL_INET_NTOP, 4, ifname, strerror(errno));
+	  goto err;
+	}
+      }
+
+      /* ipv6 */
       if (pm->ifa_addr->sa_family == AF_INET6) {
 	if (! inet_ntop(pm->ifa_addr->sa_family, &((struct sockaddr_in6 *)pm->ifa_addr)->sin6_addr,
 			iaddr->ipv6addr, sizeof iaddr->ipv6addr)) {
 
-	  pmsg(EV_FAIL_INET_NTOP, 6, ifname, strerror(errno));
-	  goto err;
-	}
+	  pmsg(EV_FAIL_INET_NTOP, 6, ifname, strerror(errno));
+	  goto err;
+	}
+
+	ipv6len = strlen(iaddr->ipv6addr);
+	iaddr->ipv6addr[ipv6len++] = '%';
+	strncpy(iaddr->ipv6addr + ipv6len, ifname, sizeof iaddr->ipv6addr - ipv6len - 1);
+      }
+    }
+  }
+
+  freeifaddrs(ifa);
+  return IW_OK;
+
+ err:
+  if (ifa) freeifaddrs(ifa);
+  return IW_ERR;
+}
+
+
+static int
+create_socket(int family, const char *ip, const char *service, int32_t freuseport)
+{
+  DBG_PRINT(DBG_CREATE_SOCKET);
+  struct addrinfo hints;
+  struct addrinfo *res = NULL;
+  int sock;
+  int opt;
+  int ecode;
+  
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_flags = AI_PASSIVE;
+  hints.ai_family = family;
+  hints.ai_socktype = SOCK_DGRAM;
+
+  if (strcmp(ip, "ANY") == 0) {
+    ip = NULL;
+  }
+  if ((ecode = getaddrinfo(ip, service, &hints, &res)) != 0) {
+    pmsg(EV_FAIL_GETADDRINFO, gai_strerror(ecode));
+    goto err;
+  }
+
+  if ((sock = socket(res->ai_family, res->ai_socktype | SOCK_NONBLOCK, res->ai_protocol)) == -1) {
+    pmsg(EV_FAIL_SOCKET, strerror(errno));
+    goto err;
+  }
+
+  opt = 1;
+  if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof opt) == -1) {
+    pmsg(EV_FAIL_SETSOCKOPT, strerror(errno));
+    goto err;
+  }
+
+  /* for the server sockets of workers */
+  if (freuseport == IW_TRUE) {
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof opt) == -1) {
+      pmsg(EV_FAIL_SETSOCKOPT, strerror(errno));
+      goto err;
+    }
+  }
+
+  if (bind(sock, res->ai_addr, res->ai_addrlen) == -1) {
+    pmsg(EV_FAIL_BIND, strerror(errno));
+    goto err;
+  }
+  
+  freeaddrinfo(res);
+
+  DBG_SH_SOCKET(sock, ip, service);
+  return sock;
+
+ err:
+  if (sock != -1) close(sock);
+  if (res) freeaddrinfo(res);
+  return IW_ERR;
+}
+
+
+/* select the socket of the SO_REUSEPORT group by the hash of the client address, not the port.
+ * The index is the order of joining the group, the order of workers in iwtftp_init().
+ * IPv4 (also mapped to IPv6 sockets) hashes the source address, IPv6 the XOR of its words.
+ */
+static int32_t
+attach_steering(int sock, int32_t nsocks)
+{
+  struct sock_filter code[] = {
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF),
+    BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 4),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 6, 2, 0),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),
+    BPF_JUMP(BPF_JMP | BPF_JA, 10, 0, 0),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 8),
+    BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),
+    BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+    BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 16),
+    BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+    BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 20),
+    BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+    /* multiplicative hashing, the upper bits are mixed */
+    BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0x9e3779b1),
+    BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+    BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t)nsocks),
+    BPF_STMT(BPF_RET | BPF_A, 0),
+  };
+  struct sock_fprog prog = { sizeof code / sizeof code[0], code };
+
+  if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof prog) == -1) {
+    pmsg(EV_FAIL_SETSOCKOPT, strerror(errno));
+    return IW_ERR;
+  }
+  return IW_OK;
+}
+
+
+/* register the fd to the event backend, once at the creation of the socket */
+static int32_t
+add_event(struct worker *wk, struct evsrc *src, const char *ip, uint16_t port)
+{
+  if (wk->evb->add(wk, src, ip, port) == IW_ERR) {
+    return IW_ERR;
+  }
+
+  DBG_SH_ADDEVENT(ip, port);
+  return IW_OK;
+}
+
+
+/* unregister the fd from the event backend, once before closing the socket */
+static void
+del_event(struct worker *wk, struct evsrc *src, const char *ip, uint16_t port)
+{
+  wk->evb->del(wk, src, ip, port);
+
+  DBG_SH_DELEVENT(ip, port);
+}
+
+
+/* bind the sockets of sessions on the addresses of the server sockets */
+static void
+init_sockpool(struct worker *wk)
+{
+  struct sockpool *sp;
+  int32_t i;
+
+  /* the workers start from different ports of the range */
+  if (wk->ins->minport) {
+    wk->nextport = wk->ins->minport +
+      (uint32_t)(wk->ins->maxport - wk->ins->minport + 1) * wk->id / wk->ins->nworkers;
+  }
+
+  for (i = 0; i < SVSOCKS_MAX; i++) {
+    sp = &wk->pools[i];
+    sp->n = 0;
+    sp->retry = 0;
+    sp->nshared = 0;
+    sp->addrlen = 0;
+    if (wk->svsocks[i] == -1) {
+      continue;
+    }
+    sp->addrlen = sizeof sp->addr;
+    if (getsockname(wk->svsocks[i], (struct sockaddr *)&sp->addr, &sp->addrlen) == -1) {
+      pmsg(EV_FAIL_GETSOCKNAME, strerror(errno));
+      sp->addrlen = 0;
+      continue;
+    }
+    if (sp->addr.ss_family == AF_INET) {
+      ((struct sockaddr_in *)&sp->addr)->sin_port = 0;
+    }
+    else {
+      ((struct sockaddr_in6 *)&sp->addr)->sin6_port = 0;
+    }
+    if (wk->ins->nshared > 0) {
+      init_shared(wk, sp);
+      continue;
+    }
+    fill_sockpool(wk, sp);
+  }
+}
+
+
+/* the sockets shared by sessions, registered for the lifetime of the worker */
+static void
+init_shared(struct worker *wk, struct sockpool *sp)
+{
+  struct evsrc *src;
+  int sock;
+
+  while (sp->nshared < wk->ins->nshared) {
+    if ((sock = bind_sessock(wk, sp)) == IW_ERR) {
+      break;
+    }
+    /* DATA of uploads may arrive coalesced */
+    if (wk->fgro == IW_TRUE && setsockopt(sock, SOL_UDP, UDP_GRO, &(int){ 1 }, sizeof(int)) == -1) {
+      pmsg(EV_FAIL_SETSOCKOPT, strerror(errno));
+    }
+    src = &sp->shsrcs[sp->nshared];
+    src->type = EVSRC_SHARED;
+    src->fd = sock;
+    src->ses = NULL;
+    sp->shared[sp->nshared++] = sock;
+    if (add_event(wk, src, "SHARED", sp->nshared - 1) == IW_ERR) {
+      close(sp->shared[--sp->nshared]);
+      break;
+    }
+  }
+}
+
+
+/* bind sockets up to the low mark, retried later if no port is free */
+static void
+fill_sockpool(struct worker *wk, struct sockpool *sp)
+{
+  int sock;
+
+  if (! sp->addrlen || (sp->retry && get_monotonic_msec() < sp->retry)) {
+    return;
+  }
+  while (sp->n < SOCKPOOL_MIN) {
+    if ((sock = bind_sessock(wk, sp)) == IW_ERR) {
+      sp->retry = get_monotonic_msec() + SOCKPOOL_RETRY;
+      return;
+    }
+    sp->socks[sp->n++] = sock;
+  }
+  sp->retry = 0;
+}
+
+
+static void
+exit_sockpool(struct worker *wk)
+{
+  int32_t i;
+
+  for (i = 0; i < SVSOCKS_MAX; i++) {
+    while (wk->pools[i].n > 0) {
+      close(wk->pools[i].socks[--wk->pools[i].n]);
+    }
+    while (wk->pools[i].nshared > 0) {
+      wk->pools[i].nshared--;
+      free_outq(wk, &wk->pools[i].shsrcs[wk->pools[i].nshared]);
+      close(wk->pools[i].shared[wk->pools[i].nshared]);
+    }
+  }
+}
+
+
+/* a socket on the address of the pool, on a port of the range or an ephemeral port */
+static int
+bind_sessock(struct worker *wk, struct sockpool *sp)
+{
+  struct sockaddr_storage addr;
+  uint32_t nports;
+  uint32_t i;
+  int sock;
+
+  if ((sock = socket(sp->addr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK, 0)) == -1) {
+    pmsg(EV_FAIL_SOCKET, strerror(errno));
+    return IW_ERR;
+  }
+  if (wk->ins->busyidle > 0) {
+    set_busypoll(sock);
+  }
+
+  if (! wk->ins->minport) {
+    if (bind(sock, (struct sockaddr *)&sp->addr, sp->addrlen) == -1) {
+      goto err;
+    }
+    return sock;
+  }
+
+  /* without SO_REUSEADDR, a port in use by others fails */
+  memcpy(&addr, &sp->addr, sp->addrlen);
+  nports = wk->ins->maxport - wk->ins->minport + 1;
+  for (i = 0; i < nports; i++, wk->nextport++) {
+    if (wk->nextport < wk->ins->minport || wk->nextport > wk->ins->maxport) {
+      wk->nextport = wk->ins->minport;
+    }
+    if (addr.ss_family == AF_INET) {
+      ((struct sockaddr_in *)&addr)->sin_port = htons(wk->nextport);
+    }
+    else {
+      ((struct sockaddr_in6 *)&addr)->sin6_port = htons(wk->nextport);
+    }
+    if (bind(sock, (struct sockaddr *)&addr, sp->addrlen) == 0) {
+      wk->nextport++;
+      return sock;
+    }
+    if (errno != EADDRINUSE) {
+      goto err;
+    }
+  }
+
+ err:
+  pmsg(EV_FAIL_BIND, strerror(errno));
+  close(sock);
+  return IW_ERR;
+}
+
+
+/* a socket of the session from the pool of the server socket, or bound now if empty */
+static int
+get_sessock(struct worker *wk, int svsock, struct session *ses)
+{
+  struct sockpool *sp = NULL;
+  int32_t i;
+
+  for (i = 0; i < SVSOCKS_MAX; i++) {
+    if (wk->svsocks[i] == svsock && wk->pools[i].addrlen) {
+      sp = &wk->pools[i];
+      break;
+    }
+  }
+  if (! sp) {
+    pmsg(EV_FAIL_SOCKET, strerror(ENOTSOCK));
+    return IW_ERR;
+  }
+
+  /* the same socket for the same client */
+  if (sp->nshared > 0) {
+    ses->fshared = IW_TRUE;
+    ses->sendsrc = &sp->shsrcs[ses->hkey % sp->nshared];
+    return ses->sendsrc->fd;
+  }
+
+  ses->pool = sp;
+  if (sp->n > 0) {
+    STAT_ADD(wk->stats.poolhits, 1);
+    return sp->socks[--sp->n];
+  }
+  return bind_sessock(wk, sp);
+}
+
+
+/* poll the device queue in receiving, instead of waiting for the interrupt.
+ * Without CAP_NET_ADMIN, the time is limited by net.core.busy_read, the loop spins anyway.
+ */
+static void
+set_busypoll(int sock)
+{
+  setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &(int){ BUSYPOLL_USEC }, sizeof(int));
+#ifdef SO_PREFER_BUSY_POLL
+  setsockopt(sock, SOL_SOCKET, SO_PREFER_BUSY_POLL, &(int){ 1 }, sizeof(int));
+#endif
+}
+
+
+/* pin the calling worker on the CPU of its number in the affinity mask, and report the node */
+static void
+set_affinity(struct worker *wk)
+{
+  unsigned int cpu;
+  unsigned int node;
+
+  if ((wk->cpu = pin_thread_cpu(wk->id)) == -1) {
+    pmsg(EV_FAIL_SCHED_SETAFFINITY, wk->id, strerror(errno));
+    return;
+  }
+  wk->node = getcpu(&cpu, &node) == 0 ? (int32_t)node : -1;
+  pmsg(I_AFFINITY, wk->id, wk->cpu, wk->node);
+}
+
+
+/* whether the session has its own socket connected to the client */
+static int32_t
+is_connected(const struct session *ses)
+{
+  return ses->clsock >= 0 && ses->fshared == IW_FALSE ? IW_TRUE : IW_FALSE;
+}
+
+
+/* give back the socket of the deleted session to the pool, or close it */
+static void
+put_sessock(struct worker *wk, struct session *ses)
+{
+  struct sockaddr sa;
+  int sock = ses->clsock;
+
+  /* receiving by io_uring is canceled later, the socket is not reused */
+  if (! ses->pool || ses->evsrc.armed == IW_TRUE || ses->evsrc.outarmed == IW_TRUE || ses->pool->n >= SOCKPOOL_MAX) {
+    close(sock);
+    return;
+  }
+
+  /* dissolve the association, and the coalescing of the upload */
+  memset(&sa, 0, sizeof sa);
+  sa.sa_family = AF_UNSPEC;
+  if (connect(sock, &sa, sizeof sa) == -1 ||
+      (ses->reqop == OP_WRQ && wk->fgro == IW_TRUE &&
+       setsockopt(sock, SOL_UDP, UDP_GRO, &(int){ 0 }, sizeof(int)) == -1)) {
+    close(sock);
+    return;
+  }
+  ses->pool->socks[ses->pool->n++] = sock;
+}
+
+
+/* epoll backend */
+/* ------------- */
+static int32_t
+init_epoll(struct worker *wk)
+{
+  if ((wk->epollfd = epoll_create1(0)) == -1) {
+    pmsg(EV_FAIL_EPOLL_CREATE, strerror(errno));
+    goto err;
+  }
+  wk->nregevents = 0;
+
+  /* grows with the number of sessions */
+  if (! (wk->events = malloc(sizeof(struct epoll_event) * EVENTS_INIT))) {
+    pmsg(E_FAIL_MALLOC, __FUNCTION__);
+    goto err;
+  }
+  wk->maxevents = EVENTS_INIT;
+
+  /* buffers for batched receiving */
+  if (init_iobatch(&wk->rx, RXBUF_SIZE, IW_TRUE) == IW_ERR) {
+    goto err;
+  }
+
+  return IW_OK;
+
+ err:
+  exit_epoll(wk);
+  return IW_ERR;
+}
+
+
+static void
+exit_epoll(struct worker *wk)
+{
+  if (wk->epollfd != -1) {
+    close(wk->epollfd);
+    wk->epollfd = -1;
+  }
+  free(wk->events);
+  wk->events = NULL;
+  free(wk->rx.bufs);
+  wk->rx.bufs = NULL;
+}
+
+
+/* register the fd to epoll, once at the creation of the socket */
+static int32_t
+add_epoll(struct worker *wk, struct evsrc *src, const char *ip, uint16_t port)
+{
+  struct epoll_event setev;
+
+  setev.data.ptr = src;
+  setev.events = EPOLLIN;
+
+  if (epoll_ctl(wk->epollfd, EPOLL_CTL_ADD, src->fd, &setev) == -1) {
+    pmsg(EV_FAIL_EPOLL_CTL, "add", ip, port, strerror(errno));
+    return IW_ERR;
+  }
+  wk->nregevents++;
+
+  return IW_OK;
+}
+
+
+/* unregister the fd from epoll, once before closing the socket */
+static void
+del_epoll(struct worker *wk, struct evsrc *src, const char *ip, uint16_t port)
+{
+  if (epoll_ctl(wk->epollfd, EPOLL_CTL_DEL, src->fd, NULL) == -1) {
+    pmsg(EV_FAIL_EPOLL_CTL, "del", ip, port, strerror(errno));
+  }
+  wk->nregevents--;
+}
+
+
+/* watch EPOLLOUT while messages wait for the socket */
+static void
+watch_epoll(struct worker *wk, struct evsrc *src, int32_t fout)
+{
+  struct epoll_event setev;
+
+  setev.data.ptr = src;
+  setev.events = fout == IW_TRUE ? EPOLLIN | EPOLLOUT : EPOLLIN;
+
+  if (epoll_ctl(wk->epollfd, EPOLL_CTL_MOD, src->fd, &setev) == -1) {
+    pmsg(EV_FAIL_EPOLL_CTL, "mod", "SOCKET", src->fd, strerror(errno));
+  }
+}
+
+
+/* wait for the ready sockets, and drain each by recvmmsg() */
+static void
+wait_epoll(struct worker *wk, int32_t timeout)
+{
+  struct epoll_event *events;
+  struct evsrc *src;
+  int32_t nfds;
+  int32_t n;
+  int nrecv;
+  int k;
+  struct peer pr;
+
+  /* room for all registered fds, not resized while handling the events */
+  if (wk->nregevents > wk->maxevents) {
+    for (n = wk->maxevents; n < wk->nregevents; n *= 2)
+      ;
+    if ((events = realloc(wk->events, sizeof(struct epoll_event) * n))) {
+      wk->events = events;
+      wk->maxevents = n;
+    }
+  }
+  events = wk->events;
+
+  nfds = epoll_wait(wk->epollfd, events, wk->maxevents, timeout);
+  STAT_ADD(wk->stats.waitcalls, 1);
+
+  if (nfds == -1) {
+    if (errno != EINTR) {
+      pmsg(EV_FAIL_EPOLL_WAIT, strerror(errno));
+    }
+    return;
+  }
+
+  for (n = 0; n < nfds; n++) {
+    src = events[n].data.ptr;
+    if (src->type == EVSRC_WAKEUP) {
+      /* woken up for exiting */
+      continue;
+    }
+#ifdef HAVE_AF_XDP
+    if (src->type == EVSRC_XSK) {
+      recv_xdp(wk, src);
+      continue;
+    }
+#endif
+    if (events[n].events & EPOLLOUT) {
+      drain_outq(wk, src);
+    }
+    if (! (events[n].events & (EPOLLIN | EPOLLERR))) {
+      continue;
+    }
+
+    /* drain the socket by a batch, the client of a session is known by its connected socket */
+    for (k = 0; k < IOBATCH_MAX; k++) {
+      wk->rx.msgs[k].msg_hdr.msg_namelen = src->ses ? 0 : sizeof(struct sockaddr_storage);
+      wk->rx.msgs[k].msg_hdr.msg_controllen = sizeof wk->rx.ctrls[k];
+    }
+    if ((nrecv = recvmmsg(src->fd, wk->rx.msgs, IOBATCH_MAX, MSG_DONTWAIT, NULL)) == -1) {
+      /* ICMP unreachable from the client of the session, it expires by the timer */
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED) {
+	pmsg(EV_FAIL_RECVMMSG, strerror(errno));
+      }
+      continue;
+    }
+    STAT_ADD(wk->stats.rxcalls, 1);
+
+    for (k = 0; k < nrecv; k++) {
+      /* the address is formatted only when it is logged */
+      if (src->ses) {
+	pr.addr = (struct sockaddr *)&src->ses->claddr;
+	pr.addrlen = src->ses->claddrlen;
+      }
+      else {
+	pr.addr = (struct sockaddr *)&wk->rx.addrs[k];
+	pr.addrlen = wk->rx.msgs[k].msg_hdr.msg_namelen;
+      }
+      pr.ip[0] = '\0';
+      pr.route = NULL;
+
+      handle_segments(wk, src, &pr, wk->rx.iovs[k].iov_base, wk->rx.msgs[k].msg_len,
+		      get_gro_size(&wk->rx.msgs[k].msg_hdr));
+    }
+  }
+}
+
+
+/* send the groups of messages by sendmmsg() */
+static void
+send_epoll(struct worker *wk, struct evsrc *src, uint32_t first, uint32_t ngrps)
+{
+  struct iobatch *b = &wk->tx;
+  uint32_t g = first;
+  uint32_t end = first + ngrps;
+  int nsent;
+
+  while (g < end) {
+    /* after the messages waiting for the socket */
+    if (src->nout > 0) {
+      queue_msg(wk, src, &b->gmsgs[g].msg_hdr, b->gsegs[g]);
+      g++;
+      continue;
+    }
+    nsent = sendmmsg(src->fd, &b->gmsgs[g], end - g, MSG_DONTWAIT);
+    STAT_ADD(wk->stats.txcalls, 1);
+
+    if (nsent == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+	/* the socket buffer is full, the rest waits for EPOLLOUT */
+	STAT_ADD(wk->stats.txeagain, 1);
+	queue_msg(wk, src, &b->gmsgs[g].msg_hdr, b->gsegs[g]);
+	g++;
+	continue;
+      }
+      if (b->gsegs[g] > 1 && (errno == EIO || errno == EINVAL)) {
+	/* no offload on the device, or the kernel refused it */
+	pmsg(EV_GSO_DISABLED, wk->id, strerror(errno));
+	wk->fgso = IW_FALSE;
+	for (; g < end; g++) {
+	  send_plain(wk, src, b->gfirst[g], b->gsegs[g]);
+	}
+	break;
+      }
+      /* drop the failed message, the session resends it later */
+      send_failed(src->fd, &b->msgs[b->gfirst[g]]);
+      g++;
+      continue;
+    }
+
+    for (; nsent > 0; nsent--, g++) {
+      STAT_ADD(wk->stats.txpkts, b->gsegs[g]);
+    }
+  }
+}
+
+
+#ifdef HAVE_IO_URING
+/* io_uring backend */
+/* ---------------- */
+
+/* whether the kernel has multishot recvmsg with provided buffer rings */
+static int32_t
+probe_uring(void)
+{
+  struct uring ur;
+  struct urbufs ub;
+  struct io_uring_sqe *sqe;
+  struct io_uring_cqe *cqe;
+  struct msghdr mh;
+  int32_t fok = IW_FALSE;
+  int sock = -1;
+  int n;
+
+  if (ur_init(&ur, 4, 4) == IW_ERR) {
+    pmsg(EV_FAIL_URING, "setup", strerror(errno));
+    return IW_FALSE;
+  }
+  if (ur_init_bufs(&ur, &ub, URBUF_SMALL, 1, URBUF_SMALL_SIZE) == IW_ERR) {
+    pmsg(EV_FAIL_URING, "register buffers", strerror(errno));
+    goto end;
+  }
+  if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+    pmsg(EV_FAIL_SOCKET, strerror(errno));
+    goto end;
+  }
+
+  /* an older kernel rejects the flag, then it is not canceled but fails */
+  memset(&mh, 0, sizeof mh);
+  mh.msg_namelen = sizeof(struct sockaddr_storage);
+  sqe = ur_get_sqe(&ur);
+  ur_prep_recvmsg_multishot(sqe, sock, &mh, URBUF_SMALL);
+  sqe->user_data = URTAG_RECV;
+  sqe = ur_get_sqe(&ur);
+  ur_prep_cancel(sqe, URTAG_RECV);
+  sqe->user_data = URTAG_IGNORE;
+  if (ur_submit(&ur, 2) == IW_ERR) {
+    pmsg(EV_FAIL_URING, "enter", strerror(errno));
+    goto end;
+  }
+
+  for (n = 0; n < 2 && (cqe = ur_peek_cqe(&ur)); n++) {
+    if (cqe->user_data == URTAG_RECV) {
+      if (cqe->res == -ECANCELED) {
+	fok = IW_TRUE;
+      }
+      else {
+	pmsg(EV_FAIL_URING, "multishot recvmsg", strerror(-cqe->res));
+      }
+    }
+    ur_seen_cqe(&ur);
+  }
+
+ end:
+  if (sock != -1) close(sock);
+  ur_exit(&ur);
+  ur_exit_bufs(&ur, &ub);
+  return fok;
+}
+
+
+static int32_t
+init_uring(struct worker *wk)
+{
+  if (ur_init(&wk->ring, URING_SQ_ENTRIES, URING_CQ_ENTRIES) == IW_ERR) {
+    pmsg(EV_FAIL_URING, "setup", strerror(errno));
+    goto err;
+  }
+
+  /* requests and ACK are small, DATA of uploads may be coalesced up to 64KB */
+  if (ur_init_bufs(&wk->ring, &wk->urbufs[URBUF_SMALL], URBUF_SMALL, URBUF_SMALL_NBUFS, URBUF_SMALL_SIZE) == IW_ERR ||
+      ur_init_bufs(&wk->ring, &wk->urbufs[URBUF_LARGE], URBUF_LARGE, URBUF_LARGE_NBUFS, URBUF_LARGE_SIZE) == IW_ERR) {
+    pmsg(EV_FAIL_URING, "register buffers", strerror(errno));
+    goto err;
+  }
+
+  memset(&wk->urmsg, 0, sizeof(struct msghdr));
+  wk->urmsg.msg_namelen = sizeof(struct sockaddr_storage);
+  wk->urmsg.msg_controllen = CMSG_SPACE(sizeof(int));
+  wk->urdeadline = -1;
+  wk->zombies = NULL;
+
+  return IW_OK;
+
+ err:
+  exit_uring(wk);
+  return IW_ERR;
+}
+
+
+static void
+exit_uring(struct worker *wk)
+{
+  struct session *pm;
+  struct session *next;
+  int32_t g;
+
+  if (wk->ring.fd == -1) {
+    return;
+  }
+
+  /* the kernel cancels all requests, so no buffer is in use */
+  ur_exit(&wk->ring);
+  for (g = 0; g < URBUF_GROUPS; g++) {
+    ur_exit_bufs(&wk->ring, &wk->urbufs[g]);
+  }
+
+  for (pm = wk->zombies; pm; pm = next) {
+    next = pm->next;
+    free(pm);
+  }
+  wk->zombies = NULL;
+}
+
+
+/* arm receiving of the socket, or polling of the eventfd */
+static int32_t
+add_uring(struct worker *wk, struct evsrc *src, const char *ip, uint16_t port)
+{
+  struct io_uring_sqe *sqe;
+
+  if (src->type == EVSRC_WAKEUP) {
+    if (! (sqe = get_sqe(wk))) {
+      pmsg(EV_FAIL_URING, "poll", strerror(EBUSY));
+      return IW_ERR;
+    }
+    ur_prep_poll(sqe, src->fd, POLLIN);
+    sqe->user_data = URTAG_WAKEUP;
+    return IW_OK;
+  }
+
+  /* the rings of AF_XDP socket are read after polling, which is armed again */
+  if (src->type == EVSRC_XSK) {
+    if (! (sqe = get_sqe(wk))) {
+      pmsg(EV_FAIL_URING, "poll", strerror(EBUSY));
+      return IW_ERR;
+    }
+    ur_prep_poll(sqe, src->fd, POLLIN);
+    sqe->user_data = (uint64_t)(uintptr_t)src | URTAG_POLL;
+    return IW_OK;
+  }
+
+  /* only the socket of upload, or shared by sessions, receives large DATA */
+  src->bgid = (src->ses && src->ses->reqop == OP_WRQ) || src->type == EVSRC_SHARED ? URBUF_LARGE : URBUF_SMALL;
+  if (arm_recv(wk, src) == IW_ERR) {
+    pmsg(EV_FAIL_URING, ip, strerror(EBUSY));
+    return IW_ERR;
+  }
+  (void)port;
+
+  return IW_OK;
+}
+
+
+/* cancel receiving and polling, the session is kept until the last completion */
+static void
+del_uring(struct worker *wk, struct evsrc *src, const char *ip, uint16_t port)
+{
+  struct io_uring_sqe *sqe;
+
+  src->type = EVSRC_CLOSED;
+  if (src->armed == IW_TRUE) {
+    if (! (sqe = get_sqe(wk))) {
+      pmsg(EV_FAIL_URING, "cancel", strerror(EBUSY));
+      return;
+    }
+    ur_prep_cancel(sqe, (uint64_t)(uintptr_t)src | URTAG_RECV);
+    sqe->user_data = URTAG_IGNORE;
+  }
+  if (src->outarmed == IW_TRUE) {
+    if (! (sqe = get_sqe(wk))) {
+      pmsg(EV_FAIL_URING, "cancel", strerror(EBUSY));
+      return;
+    }
+    ur_prep_cancel(sqe, (uint64_t)(uintptr_t)src | URTAG_WRITABLE);
+    sqe->user_data = URTAG_IGNORE;
+  }
+  (void)ip;
+  (void)port;
+}
+
+
+/* submit the requests and wait for a completion or the timeout, by a system call */
+static void
+wait_uring(struct worker *wk, int32_t timeout)
+{
+  struct io_uring_cqe *cqe;
+  struct evsrc *src;
+  uint64_t data;
+  int32_t res;
+  uint32_t flags;
+
+  /* busy polling reaps the completions without a timeout request */
+  if (timeout == 0) {
+    if (ur_submit(&wk->ring, 0) == IW_ERR) {
+      pmsg(EV_FAIL_URING, "enter", strerror(errno));
+    }
+  }
+  else {
+    set_uring_timeout(wk, timeout);
+    if (ur_submit(&wk->ring, 1) == IW_ERR && errno != EINTR && errno != ETIME) {
+      pmsg(EV_FAIL_URING, "enter", strerror(errno));
+    }
+  }
+  STAT_ADD(wk->stats.waitcalls, 1);
+
+  while ((cqe = ur_peek_cqe(&wk->ring))) {
+    /* the entry is reused by the kernel after seen */
+    data = cqe->user_data;
+    res = cqe->res;
+    flags = cqe->flags;
+    ur_seen_cqe(&wk->ring);
+
+    switch (data & URTAG_MASK) {
+    case URTAG_RECV:
+      recv_uring(wk, (struct evsrc *)(uintptr_t)(data & ~(uint64_t)URTAG_MASK), res, flags);
+      break;
+    case URTAG_SEND:
+      /* requeued by submit_uring() when the socket refused them */
+      if (res == -EAGAIN || res == -ECANCELED) {
+	break;
+      }
+      if (URSEND_SEGS(data) > 1 && (res == -EIO || res == -EINVAL) && wk->fgso == IW_TRUE) {
+	pmsg(EV_GSO_DISABLED, wk->id, strerror(-res));
+	wk->fgso = IW_FALSE;
+	break;
+      }
+      pmsg(EV_FAIL_URING, "sendmsg", strerror(-res));
+      break;
+    case URTAG_TIMEOUT:
+      wk->urdeadline = -1;
+      break;
+    case URTAG_WRITABLE:
+      src = (struct evsrc *)(uintptr_t)(data & ~(uint64_t)URTAG_MASK);
+      src->outarmed = IW_FALSE;
+      if (src->type == EVSRC_CLOSED) {
+	if (src->ses && src->armed == IW_FALSE) {
+	  free_zombie(wk, src->ses);
+	}
+	break;
+      }
+      if (res < 0) {
+	pmsg(EV_FAIL_URING, "poll", strerror(-res));
+	free_outq(wk, src);
+	break;
+      }
+      drain_outq(wk, src);
+      if (src->nout > 0) {
+	watch_uring(wk, src, IW_TRUE);
+      }
+      break;
+#ifdef HAVE_AF_XDP
+    case URTAG_POLL:
+      if (res < 0) {
+	pmsg(EV_FAIL_URING, "poll", strerror(-res));
+	break;
+      }
+      recv_xdp(wk, (struct evsrc *)(uintptr_t)(data & ~(uint64_t)URTAG_MASK));
+      add_uring(wk, (struct evsrc *)(uintptr_t)(data & ~(uint64_t)URTAG_MASK), "XDP", 0);
+      break;
+#endif
+    default:
+      /* URTAG_WAKEUP for exiting, or URTAG_IGNORE */
+      break;
+    }
+  }
+}
+
+
+/* queue the groups of messages as linked sendmsg, sent at the next submission.
+ * They don't wait for the socket, so they are done when the submission returns
+ * and the buffers can be reused. Only failures make completions, and the groups
+ * refused by the full socket buffer are requeued by submit_uring().
+ */
+static void
+send_uring(struct worker *wk, struct evsrc *src, uint32_t first, uint32_t ngrps)
+{
+  struct iobatch *b = &wk->tx;
+  struct io_uring_sqe *sqe;
+  uint32_t g;
+
+  for (g = first; g < first + ngrps; g++) {
+    /* after the messages waiting for the socket */
+    if (src->nout > 0) {
+      queue_msg(wk, src, &b->gmsgs[g].msg_hdr, b->gsegs[g]);
+      continue;
+    }
+    if (! (sqe = get_sqe(wk))) {
+      /* the session resends it later */
+      pmsg(EV_FAIL_URING, "sendmsg", strerror(EBUSY));
+      break;
+    }
+    ur_prep_sendmsg(sqe, src->fd, &b->gmsgs[g].msg_hdr, MSG_DONTWAIT);
+    sqe->user_data = URSEND_DATA(wk->urtxseq, g, b->gsegs[g]);
+    sqe->flags |= IOSQE_CQE_SKIP_SUCCESS;
+    /* in order within the session */
+    if (g + 1 < first + ngrps) {
+      sqe->flags |= IOSQE_IO_LINK;
+    }
+    STAT_ADD(wk->stats.txpkts, b->gsegs[g]);
+  }
+}
+
+
+/* submit the sends of the flush, and queue the groups the full socket buffer
+ * refused, with the rest of their linked window, until the socket is writable
+ */
+static void
+submit_uring(struct worker *wk)
+{
+  struct iobatch *b = &wk->tx;
+  struct io_uring_cqe *cqe;
+  struct evsrc *src;
+  uint32_t n;
+  uint32_t g;
+
+  if (ur_submit(&wk->ring, 0) == IW_ERR) {
+    pmsg(EV_FAIL_URING, "enter", strerror(errno));
+  }
+  STAT_ADD(wk->stats.txcalls, 1);
+
+  /* the completions stay for wait_uring(), which ignores these */
+  for (n = 0; (cqe = ur_peek_cqe_at(&wk->ring, n)); n++) {
+    if ((cqe->user_data & URTAG_MASK) != URTAG_SEND || URSEND_SEQ(cqe->user_data) != wk->urtxseq
+	|| (cqe->res != -EAGAIN && cqe->res != -ECANCELED)) {
+      continue;
+    }
+    g = URSEND_GROUP(cqe->user_data);
+    src = b->srcs[b->gfirst[g]];
+    if (cqe->res == -EAGAIN) {
+      STAT_ADD(wk->stats.txeagain, 1);
+    }
+    STAT_ADD(wk->stats.txpkts, -(int64_t)b->gsegs[g]);
+    queue_msg(wk, src, &b->gmsgs[g].msg_hdr, b->gsegs[g]);
+  }
+  wk->urtxseq++;
+}
+
+
+/* poll the socket once for writing, then the waiting messages are drained */
+static void
+watch_uring(struct worker *wk, struct evsrc *src, int32_t fout)
+{
+  struct io_uring_sqe *sqe;
+
+  if (fout == IW_FALSE || src->outarmed == IW_TRUE) {
+    return;
+  }
+  if (! (sqe = get_sqe(wk))) {
+    pmsg(EV_FAIL_URING, "poll", strerror(EBUSY));
+    return;
+  }
+  ur_prep_poll(sqe, src->fd, POLLOUT);
+  sqe->user_data = (uint64_t)(uintptr_t)src | URTAG_WRITABLE;
+  src->outarmed = IW_TRUE;
+}
+
+
+/* an empty entry of the submission queue, submitting the queue if full */
+static struct io_uring_sqe *
+get_sqe(struct worker *wk)
+{
+  struct io_uring_sqe *sqe;
+
+  if (! (sqe = ur_get_sqe(&wk->ring))) {
+    if (ur_submit(&wk->ring, 0) == IW_ERR) {
+      return NULL;
+    }
+    STAT_ADD(wk->stats.txcalls, 1);
+    sqe = ur_get_sqe(&wk->ring);
+  }
+  return sqe;
+}
+
+
+/* receive datagrams of the socket continuously, into the provided buffers */
+static int32_t
+arm_recv(struct worker *wk, struct evsrc *src)
+{
+  struct io_uring_sqe *sqe;
+
+  if (! (sqe = get_sqe(wk))) {
+    return IW_ERR;
+  }
+  ur_prep_recvmsg_multishot(sqe, src->fd, &wk->urmsg, src->bgid);
+  sqe->user_data = (uint64_t)(uintptr_t)src | URTAG_RECV;
+  src->armed = IW_TRUE;
+
+  return IW_OK;
+}
+
+
+/* process a datagram received by multishot recvmsg */
+static void
+recv_uring(struct worker *wk, struct evsrc *src, int32_t res, uint32_t flags)
+{
+  struct urbufs *ub = &wk->urbufs[src->bgid];
+  struct io_uring_recvmsg_out *out;
+  struct msghdr mh;
+  struct peer pr;
+  uint8_t *buf;
+  uint16_t bid = 0;
+
+  if (flags & IORING_CQE_F_BUFFER) {
+    bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    buf = ur_get_buf(ub, bid);
+    out = (struct io_uring_recvmsg_out *)buf;
+
+    /* nothing for the deleted session, and truncated datagrams are not TFTP */
+    if (res >= 0 && src->type != EVSRC_CLOSED && ! (out->flags & MSG_TRUNC)) {
+      memset(&mh, 0, sizeof mh);
+      mh.msg_control = buf + sizeof(struct io_uring_recvmsg_out) + wk->urmsg.msg_namelen;
+      mh.msg_controllen = out->controllen;
+
+      pr.addr = (struct sockaddr *)(buf + sizeof(struct io_uring_recvmsg_out));
+      pr.addrlen = out->namelen < wk->urmsg.msg_namelen ? out->namelen : wk->urmsg.msg_namelen;
+      pr.ip[0] = '\0';
+      pr.route = NULL;
+
+      handle_segments(wk, src, &pr, (uint8_t *)mh.msg_control + wk->urmsg.msg_controllen, out->payloadlen,
+		      get_gro_size(&mh));
+    }
+    ur_put_buf(ub, bid);
+  }
+
+  /* the request has ended */
+  if (! (flags & IORING_CQE_F_MORE)) {
+    src->armed = IW_FALSE;
+    if (src->type == EVSRC_CLOSED) {
+      if (src->ses && src->outarmed == IW_FALSE) {
+	free_zombie(wk, src->ses);
+      }
+      return;
+    }
+    /* rearmed when buffers ran out, they are given back by processing */
+    if (res >= 0 || res == -ENOBUFS || res == -ECONNREFUSED) {
+      if (arm_recv(wk, src) == IW_ERR) {
+	pmsg(EV_FAIL_URING, "recvmsg", strerror(EBUSY));
+      }
+    }
+    else {
+      pmsg(EV_FAIL_URING, "recvmsg", strerror(-res));
+    }
+  }
+}
+
+
+/* arm or advance the timeout request to wake up by the nearest timer */
+static void
+set_uring_timeout(struct worker *wk, int32_t timeout)
+{
+  struct io_uring_sqe *sqe;
+  int64_t deadline;
+
+  if (timeout < 0) {
+    return;
+  }
+
+  /* a later timeout only wakes up early, then it is set again */
+  deadline = get_monotonic_msec() + timeout;
+  if (wk->urdeadline >= 0 && wk->urdeadline <= deadline) {
+    return;
+  }
+  if (! (sqe = get_sqe(wk))) {
+    return;
+  }
+
+  wk->urts.tv_sec = timeout / 1000;
+  wk->urts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+  if (wk->urdeadline < 0) {
+    ur_prep_timeout(sqe, &wk->urts);
+    sqe->user_data = URTAG_TIMEOUT;
+  }
+  else {
+    ur_prep_timeout_update(sqe, URTAG_TIMEOUT, &wk->urts);
+    sqe->user_data = URTAG_IGNORE;
+  }
+  wk->urdeadline = deadline;
+}
+
+
+/* release the deleted session, after the last completion of receiving */
+static void
+free_zombie(struct worker *wk, struct session *ses)
+{
+  if (ses->prev) {
+    ses->prev->next = ses->next;
+  }
+  else {
+    wk->zombies = ses->next;
+  }
+  if (ses->next) {
+    ses->next->prev = ses->prev;
+  }
+  free(ses);
+}
+#endif	/* HAVE_IO_URING */
+
 
-	ipv6len = strlen(iaddr->ipv6addr);
-	iaddr->ipv6addr[ipv6len++] = '%';
-	strncpy(iaddr->ipv6addr + ipv6len, ifname, sizeof iaddr->ipv6addr - ipv6len - 1);
-      }
+#ifdef HAVE_AF_XDP
+/* AF_XDP path */
+/* ------------ */
+static void
+exit_xdp(IWTFTP *ins)
+{
+  struct xdppath *xp = ins->xdp;
+  int32_t i;
+
+  if (! xp) {
+    return;
+  }
+
+  /* the device gets the packets again */
+  xdp_exit(&xp->prog);
+  for (i = 0; i < xp->nxsks; i++) {
+    xsk_exit(&xp->xsks[i]);
+  }
+  free(xp);
+  ins->xdp = NULL;
+}
+
+
+/* process the packets steered to the socket, as if received by a kernel socket.
+ * The program passed only IPv4 UDP without options and fragments.
+ */
+static void
+recv_xdp(struct worker *wk, struct evsrc *src)
+{
+  struct xdppath *xp = wk->ins->xdp;
+  struct xsk *xs = &xp->xsks[src - xp->srcs];
+  struct ether_header *eh;
+  struct iphdr *ih;
+  struct udphdr *uh;
+  struct sockaddr_in sin;
+  struct xskroute rt;
+  struct peer pr;
+  uint8_t *pkt;
+  uint64_t addr;
+  uint32_t len;
+  int32_t n;
+
+  for (n = 0; n < XDP_RX_BATCH && (pkt = xsk_recv(xs, &addr, &len)); n++) {
+    eh = (struct ether_header *)pkt;
+    ih = (struct iphdr *)(eh + 1);
+    uh = (struct udphdr *)(ih + 1);
+
+    if (len >= XDP_HDR_SIZE + TFTP_OPCODE_SIZE &&
+	ntohs(ih->tot_len) <= len - sizeof(struct ether_header) &&
+	ntohs(uh->len) >= sizeof(struct udphdr) + TFTP_OPCODE_SIZE &&
+	ntohs(uh->len) <= ntohs(ih->tot_len) - sizeof(struct iphdr)) {
+      memset(&sin, 0, sizeof sin);
+      sin.sin_family = AF_INET;
+      sin.sin_port = uh->source;
+      sin.sin_addr.s_addr = ih->saddr;
+
+      /* the reply goes back the way the packet came */
+      rt.xsk = xs;
+      memcpy(rt.lmac, eh->ether_dhost, ETH_ALEN);
+      memcpy(rt.rmac, eh->ether_shost, ETH_ALEN);
+      rt.laddr = ih->daddr;
+      rt.lport = uh->dest;
+
+      pr.addr = (struct sockaddr *)&sin;
+      pr.addrlen = sizeof sin;
+      pr.ip[0] = '\0';
+      pr.route = &rt;
+
+      handle_segments(wk, src, &pr, (uint8_t *)(uh + 1), ntohs(uh->len) - sizeof(struct udphdr), 0);
     }
+    xsk_recv_done(xs, addr);
   }
+  xsk_release(xs);
+}
 
-  freeifaddrs(ifa);
-  return IW_OK;
 
- err:
-  if (ifa) freeifaddrs(ifa);
-  return IW_ERR;
+/* send the messages of a run by the AF_XDP socket, writing the headers in front of each */
+static void
+send_xdp(struct worker *wk, uint32_t first, uint32_t end)
+{
+  struct iobatch *b = &wk->tx;
+  struct xsk *xs = b->routes[first].xsk;
+  struct xskroute *rt;
+  struct sockaddr_in *sin;
+  struct ether_header *eh;
+  struct iphdr *ih;
+  struct udphdr *uh;
+  uint32_t sum;
+  uint32_t ncalls;
+  uint32_t i;
+  size_t len;
+
+  for (i = first; i < end; i++) {
+    rt = &b->routes[i];
+    sin = (struct sockaddr_in *)&b->addrs[i];
+    len = b->iovs[i].iov_len;
+    eh = (struct ether_header *)(xs->umem + b->frames[i]);
+    ih = (struct iphdr *)(eh + 1);
+    uh = (struct udphdr *)(ih + 1);
+
+    memcpy(eh->ether_dhost, rt->rmac, ETH_ALEN);
+    memcpy(eh->ether_shost, rt->lmac, ETH_ALEN);
+    eh->ether_type = htons(ETHERTYPE_IP);
+
+    ih->version = IPVERSION;
+    ih->ihl = sizeof(struct iphdr) / 4;
+    ih->tos = 0;
+    ih->tot_len = htons(sizeof(struct iphdr) + sizeof(struct udphdr) + len);
+    ih->id = 0;
+    ih->frag_off = htons(IP_DF);
+    ih->ttl = IPDEFTTL;
+    ih->protocol = IPPROTO_UDP;
+    ih->saddr = rt->laddr;
+    ih->daddr = sin->sin_addr.s_addr;
+    ih->check = 0;
+    ih->check = csum_fold(csum_add(0, ih, sizeof(struct iphdr)));
+
+    uh->source = rt->lport;
+    uh->dest = sin->sin_port;
+    uh->len = htons(sizeof(struct udphdr) + len);
+    uh->check = 0;
+
+    /* with the pseudo header, 0 means no checksum */
+    sum = csum_add(0, &ih->saddr, sizeof ih->saddr + sizeof ih->daddr);
+    sum += IPPROTO_UDP + sizeof(struct udphdr) + len;
+    uh->check = csum_fold(csum_add(sum, uh, sizeof(struct udphdr) + len));
+    if (uh->check == 0) {
+      uh->check = 0xffff;
+    }
+
+    /* the frame is back by the completion */
+    xsk_send(xs, b->frames[i], XDP_HDR_SIZE + len);
+    b->xsks[i] = NULL;
+  }
+  STAT_ADD(wk->stats.txpkts, end - first);
+
+  if (xsk_kick(xs, &ncalls) == IW_ERR) {
+    pmsg(EV_FAIL_XSK_SEND, xs->queue, strerror(errno));
+  }
+  STAT_ADD(wk->stats.txcalls, ncalls);
 }
 
 
-static int
-create_socket(int family, const char *ip, const char *service)
+/* sum of the 16-bit words in network order, for the Internet checksum */
+static uint32_t
+csum_add(uint32_t sum, const void *data, size_t len)
 {
-  DBG_PRINT(DBG_CREATE_SOCKET);
-  struct addrinfo hints;
-  struct addrinfo *res = NULL;
-  int sock;
-  int opt;
-  int ecode;
-  
-  memset(&hints, 0, sizeof(struct addrinfo));
-  hints.ai_flags = AI_PASSIVE;
-  hints.ai_family = family;
-  hints.ai_socktype = SOCK_DGRAM;
+  const uint8_t *p = data;
+  size_t i;
 
-  if (strcmp(ip, "ANY") == 0) {
-    ip = NULL;
+  for (i = 0; i + 1 < len; i += 2) {
+    sum += (uint32_t)p[i] << 8 | p[i + 1];
   }
-  if ((ecode = getaddrinfo(ip, service, &hints, &res)) != 0) {
-    pmsg(EV_FAIL_GETADDRINFO, gai_strerror(ecode));
-    goto err;
+  if (len & 1) {
+    sum += (uint32_t)p[len - 1] << 8;
   }
+  return sum;
+}
 
-  if ((sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) == -1) {
-    pmsg(EV_FAIL_SOCKET, strerror(errno));
-    goto err;
+
+static uint16_t
+csum_fold(uint32_t sum)
+{
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
   }
+  return htons(~sum & 0xffff);
+}
 
-  opt = 1;
-  if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof opt) == -1) {
-    pmsg(EV_FAIL_SETSOCKOPT, strerror(errno));
-    goto err;
+
+/* a free port for a session, in turn from the range so that a port is not reused soon.
+ * return: the port, or 0 if all are in use
+ */
+static uint16_t
+alloc_sesport(struct xdppath *xp)
+{
+  uint32_t i;
+  uint16_t port;
+
+  for (i = 0; i <= (uint32_t)(xp->maxport - xp->minport); i++) {
+    port = xp->nextport;
+    xp->nextport = port == xp->maxport ? xp->minport : port + 1;
+
+    if (! (xp->ports[port / 8] & (1 << (port % 8))) && port != atoi(TFTP_PORT)) {
+      xp->ports[port / 8] |= 1 << (port % 8);
+      return port;
+    }
   }
+  return 0;
+}
 
-  if (bind(sock, res->ai_addr, res->ai_addrlen) == -1) {
-    pmsg(EV_FAIL_BIND, strerror(errno));
-    goto err;
+
+static void
+free_sesport(struct xdppath *xp, uint16_t port)
+{
+  xp->ports[port / 8] &= ~(1 << (port % 8));
+}
+#endif	/* HAVE_AF_XDP */
+
+
+/* IP address of the packet, formatted at the first use */
+static const char *
+peer_ip(struct peer *pr)
+{
+  if (pr->ip[0] == '\0') {
+    if (format_sockaddr(pr->addr, pr->ip, sizeof pr->ip) == IW_ERR) {
+      pmsg(E_FAIL_ADDRCONVERT);
+      strncpy(pr->ip, "?", sizeof pr->ip);
+    }
   }
-  
-  freeaddrinfo(res);
+  return pr->ip;
+}
 
-  DBG_SH_SOCKET(sock, ip, service);
-  return sock;
 
- err:
-  if (sock != -1) close(sock);
-  if (res) freeaddrinfo(res);
-  return IW_ERR;
+static uint16_t
+peer_port(const struct peer *pr)
+{
+  return sockaddr_port(pr->addr);
+}
+
+
+static uint16_t
+sockaddr_port(const struct sockaddr *sa)
+{
+  if (sa->sa_family == AF_INET6) {
+    return ntohs(((struct sockaddr_in6 *)sa)->sin6_port);
+  }
+  return ntohs(((struct sockaddr_in *)sa)->sin_port);
 }
 
 
+/* numeric text of the IP address, with the zone of IPv6 link-local address */
 static int32_t
-update_event(int epollfd, struct session *head)
+format_sockaddr(const struct sockaddr *sa, char *buf, size_t bufsize)
 {
-  DBG_PRINT(DBG_UPDATE_EVENT);
-  struct epoll_event setev;
-  struct session *pm;
-  int32_t nregev;
-  int32_t err = IW_FALSE;
-
-  for (pm = head; pm; pm = pm->next) {
-    if (pm->disabled == IW_FALSE) {
-      if (pm->regevent == IW_FALSE) {
-	setev.data.fd = pm->clsock;
-	setev.events = EPOLLIN;
-
-	if (epoll_ctl(epollfd, EPOLL_CTL_ADD, pm->clsock, &setev) == -1) {
-	  pmsg(EV_FAIL_EPOLL_CTL, "add", pm->clip, pm->clport, strerror(errno));
-	  err = IW_TRUE;
-	}
-	pm->regevent = IW_TRUE;
+  const struct sockaddr_in6 *sin6;
+  size_t len;
 
-	DBG_SH_ADDEVENT(pm->clip, pm->clport);
-      }
+  if (sa->sa_family == AF_INET) {
+    if (! inet_ntop(AF_INET, &((struct sockaddr_in *)sa)->sin_addr, buf, bufsize)) {
+      pmsg(EV_FAIL_INET_NTOP, 4, "client", strerror(errno));
+      return IW_ERR;
     }
-    else {
-      if (pm->regevent == IW_TRUE) {
-	if (epoll_ctl(epollfd, EPOLL_CTL_DEL, pm->clsock, NULL) == -1) {
-	  pmsg(EV_FAIL_EPOLL_CTL, "del", pm->clip, pm->clport, strerror(errno));
-	  err = IW_TRUE;
-	}
-	pm->regevent = IW_FALSE;
+    return IW_OK;
+  }
 
-	DBG_SH_DELEVENT(pm->clip, pm->clport);
-      }
+  sin6 = (struct sockaddr_in6 *)sa;
+  if (! inet_ntop(AF_INET6, &sin6->sin6_addr, buf, bufsize)) {
+    pmsg(EV_FAIL_INET_NTOP, 6, "client", strerror(errno));
+    return IW_ERR;
+  }
+
+  len = strlen(buf);
+  if (sin6->sin6_scope_id && bufsize - len > IF_NAMESIZE + 1) {
+    buf[len++] = '%';
+    if (! if_indextoname(sin6->sin6_scope_id, buf + len)) {
+      snprintf(buf + len, bufsize - len, "%u", sin6->sin6_scope_id);
+    }
+  }
+  return IW_OK;
+}
+
+
+/* FNV-1a hash of the port and the address */
+static uint32_t
+hash_sockaddr(const struct sockaddr *sa)
+{
+  const uint8_t *p[2];
+  size_t len[2];
+  uint32_t h = 2166136261U;
+  size_t i, j;
+
+  if (sa->sa_family == AF_INET6) {
+    p[0] = (const uint8_t *)&((struct sockaddr_in6 *)sa)->sin6_port;
+    len[0] = sizeof(in_port_t);
+    p[1] = (const uint8_t *)&((struct sockaddr_in6 *)sa)->sin6_addr;
+    len[1] = sizeof(struct in6_addr);
+  }
+  else {
+    p[0] = (const uint8_t *)&((struct sockaddr_in *)sa)->sin_port;
+    len[0] = sizeof(in_port_t);
+    p[1] = (const uint8_t *)&((struct sockaddr_in *)sa)->sin_addr;
+    len[1] = sizeof(struct in_addr);
+  }
+
+  for (i = 0; i < 2; i++) {
+    for (j = 0; j < len[i]; j++) {
+      h = (h ^ p[i][j]) * 16777619U;
     }
   }
+  return h;
+}
+
+
+static int32_t
+is_same_sockaddr(const struct sockaddr *a, const struct sockaddr *b)
+{
+  const struct sockaddr_in6 *a6, *b6;
+
+  if (a->sa_family != b->sa_family) {
+    return IW_FALSE;
+  }
 
-  for (nregev = 0, pm = head; pm; pm = pm->next) {
-    if (pm->regevent == IW_TRUE)
-      nregev++;
+  if (a->sa_family == AF_INET6) {
+    a6 = (struct sockaddr_in6 *)a;
+    b6 = (struct sockaddr_in6 *)b;
+    return (a6->sin6_port == b6->sin6_port && a6->sin6_scope_id == b6->sin6_scope_id &&
+	    memcmp(&a6->sin6_addr, &b6->sin6_addr, sizeof(struct in6_addr)) == 0) ? IW_TRUE : IW_FALSE;
   }
 
-  return err == IW_TRUE ? IW_ERR : nregev;
+  return (((struct sockaddr_in *)a)->sin_port == ((struct sockaddr_in *)b)->sin_port &&
+	  ((struct sockaddr_in *)a)->sin_addr.s_addr == ((struct sockaddr_in *)b)->sin_addr.s_addr) ?
+    IW_TRUE : IW_FALSE;
 }
 
 
 /* TFTP proccess */
 /* ------------- */
 static int32_t
-tftp_proc(IWTFTP *ins, int sock, const char *clip, uint16_t clport,
+tftp_proc(struct worker *wk, struct evsrc *src, struct peer *pr,
 	  void *dbuf, size_t dlen, struct sendinfo *sinfo)
 {
   DBG_PRINT(DBG_TFTP_PROC);
+  struct session *sockses = src->ses;
   struct session *clses = NULL;
   uint16_t opcode;
   uint16_t optmp;
+  uint16_t nacked;
+  uint16_t ninflight;
   struct tftpreq reqmsg;
   struct tftpdata datmsg;
   struct tftpack ackmsg;
   struct tftperror errmsg;
   uint16_t tftperrcode;
+  int32_t dserr;
+  int64_t reqstamp;
   char emsgbuf[TFTP_EMSGLEN_MAX];
   
   memset(emsgbuf, 0, sizeof emsgbuf);
+  sinfo->msglen = 0;
 
   /* get opcode */
   memcpy(&optmp, dbuf, sizeof(uint16_t));
@@ -697,9 +2946,14 @@ tftp_proc(IWTFTP *ins, int sock, const char *clip, uint16_t clport,
 
   DBG_SH_OPCODE(opcode);
   
-  /* retrieve session */
-  DBG_SH_QUERY(clip, clport);
-  clses = get_session(ins->seshead, clip, clport);
+  /* retrieve session, directly from its socket connected to the client */
+  DBG_SH_QUERY(peer_ip(pr), peer_port(pr));
+  if (sockses) {
+    clses = sockses;
+  }
+  else {
+    clses = get_session(wk, pr->addr);
+  }
 
   DBG_SH_SESSION(clses);
 
@@ -709,18 +2963,24 @@ tftp_proc(IWTFTP *ins, int sock, const char *clip, uint16_t clport,
     if (clses) {
       goto resend;
     }
+    /* the shared socket is a TID of the sessions, not the service */
+    if (src->type == EVSRC_SHARED) {
+      tftperrcode = TFTP_ERR_UNKNOWNID;
+      goto errsend;
+    }
 
     /* new request */
+    reqstamp = get_monotonic_usec();
     if (parse_tftpreq(&reqmsg, dbuf, dlen) == IW_ERR) {
-      pmsg(I_TFTPREQ_INCORRECT, clip, clport);
+      pmsg(I_TFTPREQ_INCORRECT, peer_ip(pr), peer_port(pr));
       tftperrcode = TFTP_ERR_ILLEGALOPE;
       goto errsend;
     }
 
-    pmsg(opcode == OP_RRQ ? I_TFTPREQ_GET : I_TFTPREQ_PUT, reqmsg.filename, clip, clport);
+    pmsg(opcode == OP_RRQ ? I_TFTPREQ_GET : I_TFTPREQ_PUT, reqmsg.filename, peer_ip(pr), peer_port(pr));
 
     DBG_PRINT(DBG_CHECK_FILE);
-    switch(iwds_isfile(ins->ads, reqmsg.filename)) {
+    switch(iwds_isfile(wk->ads, reqmsg.filename)) {
     case IW_TRUE:
       if (opcode == OP_WRQ) {
 	pmsg(I_FILE_EXIST, reqmsg.filename);
@@ -739,17 +2999,80 @@ tftp_proc(IWTFTP *ins, int sock, const char *clip, uint16_t clport,
       break;
     }
     
-    if (! (clses = add_newsession(&ins->seshead, sock, clip, clport, reqmsg.filename, reqmsg.mode))) {
-      pmsg(EV_FAIL_ADD_NEWSESSION, clip, clport);
+    if (! (clses = add_newsession(wk, src->fd, pr, reqmsg.filename, reqmsg.mode))) {
+      pmsg(EV_FAIL_ADD_NEWSESSION, peer_ip(pr), peer_port(pr));
+      pmsg(E_SERVER_ERR);
+      tftperrcode = TFTP_ERR_SEEMSG;
+      snprintf(emsgbuf, sizeof emsgbuf, "server error");
+      goto errsend;
+    }
+
+    clses->reqop = opcode;
+    clses->reqstamp = reqstamp;
+
+    /* the socket stays registered until the session is deleted, none on the AF_XDP path */
+    if (clses->clsock >= 0 && clses->fshared == IW_FALSE) {
+      if (add_event(wk, &clses->evsrc, clses->clip, clses->clport) == IW_ERR) {
+	pmsg(E_SERVER_ERR);
+	tftperrcode = TFTP_ERR_SEEMSG;
+	snprintf(emsgbuf, sizeof emsgbuf, "server error");
+	goto errsend;
+      }
+      clses->regevent = IW_TRUE;
+    }
+
+    /* negotiate options */
+    switch (set_session_option(clses, wk->ads, &reqmsg)) {
+    case IW_OK:
+      break;
+    case TFTP_ERR_BADOPT:
+      tftperrcode = TFTP_ERR_BADOPT;
+      goto errsend;
+    default:
       pmsg(E_SERVER_ERR);
       tftperrcode = TFTP_ERR_SEEMSG;
       snprintf(emsgbuf, sizeof emsgbuf, "server error");
       goto errsend;
     }
 
+    /* DATA may arrive coalesced, it is split in the event loop */
+    if (opcode == OP_WRQ && wk->fgro == IW_TRUE && clses->clsock >= 0 && clses->fshared == IW_FALSE) {
+      if (setsockopt(clses->clsock, SOL_UDP, UDP_GRO, &(int){ 1 }, sizeof(int)) == -1) {
+	pmsg(EV_FAIL_SETSOCKOPT, strerror(errno));
+      }
+    }
+
+    /* the space is reserved for tsize before any DATA, so it is limited */
+    if (opcode == OP_WRQ && wk->ins->maxupload > 0 && clses->tsize > wk->ins->maxupload) {
+      pmsg(I_UPLOAD_TOOLARGE, clses->filename, (long long)wk->ins->maxupload, peer_ip(pr), peer_port(pr));
+      tftperrcode = TFTP_ERR_DISKFULL;
+      goto errsend;
+    }
+
+    /* the size of upload is known, so reserve the space before accepting */
+    if (opcode == OP_WRQ && clses->tsize > 0) {
+      if ((dserr = create_data(clses, wk->ads)) != IW_OK) {
+	tftperrcode = dserr == DSERR_NOSPACE ? TFTP_ERR_DISKFULL : TFTP_ERR_ACCESSDENY;
+	goto errsend;
+      }
+    }
+
+    if (clses->optflags) {
+      /* make TFTP OACK, and wait for ACK of block 0 (RRQ) or DATA of block 1 (WRQ) */
+      if ((sinfo->msglen = make_tftpoack_msg(clses, sinfo->msgbuf, sinfo->bufsize)) == IW_ERR) {
+	pmsg(EV_FAIL_MAKEOACK, peer_ip(pr), peer_port(pr));
+	tftperrcode = TFTP_ERR_SEEMSG;
+	snprintf(emsgbuf, sizeof emsgbuf, "server error");
+	goto errsend;
+      }
+      clses->foack = IW_TRUE;
+      goto done;
+    }
+
     if (opcode == OP_RRQ) {
       /* make TFTP DATA */
-      if ((sinfo->msglen = make_tftpdata_msg(clses, ins->ads, sinfo->msgbuf, sizeof sinfo->msgbuf)) < 0) {
+      clses->retrycount = 0;
+      if ((sinfo->msglen = make_tftpdata_msg(clses, wk->ads, sinfo->msgbuf, sinfo->bufsize)) < 0) {
 	tftperrcode = TFTP_ERR_SEEMSG;
 	snprintf(emsgbuf, sizeof emsgbuf, "server error");
 	goto errsend;
@@ -758,8 +3081,8 @@ tftp_proc(IWTFTP *ins, int sock, const char *clip, uint16_t clport,
     }
     if (opcode == OP_WRQ) {
       /* make TFTP ACK */
-      if ((sinfo->msglen = make_tftpack_msg(clses, 0, sinfo->msgbuf, sizeof sinfo->msgbuf)) == IW_ERR) {
-	pmsg(E_FAIL_MAKEACK, clip, clport);
+      if ((sinfo->msglen = make_tftpack_msg(clses, 0, sinfo->msgbuf, sinfo->bufsize)) == IW_ERR) {
+	pmsg(E_FAIL_MAKEACK, peer_ip(pr), peer_port(pr));
 	tftperrcode = TFTP_ERR_SEEMSG;
 	snprintf(emsgbuf, sizeof emsgbuf, "server error");
 	goto errsend;
@@ -774,8 +3097,14 @@ tftp_proc(IWTFTP *ins, int sock, const char *clip, uint16_t clport,
       goto errsend;
     }
 
-    if (parse_tftpdata(&datmsg, dbuf, dlen) == IW_ERR) {
-      pmsg(I_TFTPDATA_INCORRECT, clip, clport);
+    if (clses->reqop != OP_WRQ) {
+      pmsg(I_INVALID_TFTPMSG, "DATA", peer_ip(pr), peer_port(pr));
+      tftperrcode = TFTP_ERR_ILLEGALOPE;
+      goto errsend;
+    }
+
+    if (parse_tftpdata(&datmsg, dbuf, dlen, clses->blksize) == IW_ERR) {
+      pmsg(I_TFTPDATA_INCORRECT, peer_ip(pr), peer_port(pr));
       tftperrcode = TFTP_ERR_ILLEGALOPE;
       goto errsend;
     }
@@ -784,35 +3113,49 @@ tftp_proc(IWTFTP *ins, int sock, const char *clip, uint16_t clport,
       goto resend;
     }
     else if (ntohs(*datmsg.blknum) == (clses->blknum < TFTP_BLKNUM_MAX ? clses->blknum + 1 : 0)) {
+      /* the ACK was not resent (Karn's rule) */
+      if (clses->retrycount == 0) {
+	update_rtt(clses, get_monotonic_usec() - clses->rttstamp);
+      }
+
       /* check fin */
-      if (dlen - sizeof(uint16_t) * 2 < TFTP_DATALEN_MAX) {
+      if (dlen - sizeof(uint16_t) * 2 < clses->blksize) {
 	DBG_PRINT(DBG_SET_FIN);
 	clses->fin = IW_TRUE;
+	pmsg(I_TFTPTRANS_FIN, clses->filename, clses->clip, clses->clport);
+      }
+
+      /* also without tsize */
+      if (wk->ins->maxupload > 0 && clses->sesbuf->fileoff + (off_t)clses->sesbuf->datalen +
+	  (off_t)(dlen - sizeof(uint16_t) * 2) > wk->ins->maxupload) {
+	pmsg(I_UPLOAD_TOOLARGE, clses->filename, (long long)wk->ins->maxupload, peer_ip(pr), peer_port(pr));
+	tftperrcode = TFTP_ERR_DISKFULL;
+	goto errsend;
       }
 
       /* store TFTP data in session buffer */
       DBG_PRINT(DBG_PUT_SESBUF_DATA);
-      if (put_session_data(clses, ins->ads, datmsg.data, dlen - sizeof(uint16_t) * 2) == IW_ERR) {
+      if (put_session_data(clses, wk->ads, datmsg.data, dlen - sizeof(uint16_t) * 2) == IW_ERR) {
 	pmsg(EV_FAIL_PUT_SESBUF, clses->clip, clses->clport);
 	tftperrcode = TFTP_ERR_ACCESSDENY;
 	goto errsend;
       }
       
       if (clses->fin == IW_TRUE) {
-	close_data(clses, ins->ads);
+	close_data(clses, wk->ads);
       }
 	
       /* make TFTP ACK */
       if ((sinfo->msglen = make_tftpack_msg(clses, ntohs(*datmsg.blknum),
-					    sinfo->msgbuf, sizeof sinfo->msgbuf)) == IW_ERR) {
-	pmsg(E_FAIL_MAKEACK, clip, clport);
+					    sinfo->msgbuf, sinfo->bufsize)) == IW_ERR) {
+	pmsg(E_FAIL_MAKEACK, peer_ip(pr), peer_port(pr));
 	tftperrcode = TFTP_ERR_SEEMSG;
 	snprintf(emsgbuf, sizeof emsgbuf, "server error");
 	goto errsend;
       }
     }
     else {
-      pmsg(I_INVALID_BLKNUM, "DATA", clip, clport);
+      pmsg(I_INVALID_BLKNUM, "DATA", peer_ip(pr), peer_port(pr));
       tftperrcode = TFTP_ERR_ILLEGALOPE;
       goto errsend;
     }
@@ -826,55 +3169,100 @@ tftp_proc(IWTFTP *ins, int sock, const char *clip, uint16_t clport,
     }
 
     if (parse_tftpack(&ackmsg, dbuf, dlen) == IW_ERR) {
-      pmsg(I_TFTPACK_INCORRECT, clip, clport);
+      pmsg(I_TFTPACK_INCORRECT, peer_ip(pr), peer_port(pr));
       tftperrcode = TFTP_ERR_ILLEGALOPE;
       goto errsend;
     }
 
-    if (ntohs(*ackmsg.blknum) == clses->blknum -1) {
-      goto resend;
+    if (clses->reqop != OP_RRQ || clses->fin == IW_TRUE) {
+      pmsg(I_INVALID_TFTPMSG, "ACK", peer_ip(pr), peer_port(pr));
+      goto done;
     }
-    else if (ntohs(*ackmsg.blknum) == clses->blknum) {
-      /* check fin */
-      if (clses->fin == IW_TRUE) {
-	DBG_PRINT(DBG_SET_DISABLE);
-	clses->disabled = IW_TRUE;
+
+    /* ACK of OACK */
+    if (clses->foack == IW_TRUE) {
+      if (ntohs(*ackmsg.blknum) != 0) {
+	pmsg(I_INVALID_BLKNUM, "ACK", peer_ip(pr), peer_port(pr));
 	goto done;
       }
+      clses->foack = IW_FALSE;
 
-      /* make TFTP DATA */
-      if ((sinfo->msglen = make_tftpdata_msg(clses, ins->ads, sinfo->msgbuf, sizeof sinfo->msgbuf)) < 0) {
-	tftperrcode = TFTP_ERR_SEEMSG;
-	snprintf(emsgbuf, sizeof emsgbuf, "server error");
-	goto errsend;
+      /* OACK was not resent (Karn's rule) */
+      if (clses->retrycount == 0) {
+	update_rtt(clses, get_monotonic_usec() - clses->rttstamp);
       }
+      goto senddata;
+    }
+
+    /* blocks acknowledged in the window (RFC7440) */
+    nacked = ntohs(*ackmsg.blknum) - clses->ackblk;
+    ninflight = clses->blknum - clses->ackblk;
+
+    /* duplicate, the window is sent again by the timer, not per ACK (Sorcerer's Apprentice) */
+    if (nacked == 0) {
+      goto done;
+    }
+    else if (nacked > ninflight) {
+      pmsg(I_INVALID_BLKNUM, "ACK", peer_ip(pr), peer_port(pr));
+      goto done;
+    }
+
+    clses->retrycount = 0;
+
+    /* the acknowledged block was sent only once (Karn's rule) */
+    if (clses->winpos[nacked - 1].fresent == IW_FALSE) {
+      update_rtt(clses, get_monotonic_usec() - clses->winpos[nacked - 1].sent);
+    }
+
+    /* check fin */
+    if (clses->feot == IW_TRUE && nacked == ninflight) {
+      DBG_PRINT(DBG_SET_DISABLE);
+      pmsg(I_TFTPTRANS_FIN, clses->filename, clses->clip, clses->clport);
+      clses->fin = IW_TRUE;
+      clses->disabled = IW_TRUE;
+      close_data(clses, wk->ads);
+      goto done;
+    }
+
+    if (nacked < ninflight) {
+      /* a part of the window was lost, send again from the next of acknowledged block */
+      rewind_data(clses, nacked);
     }
     else {
-      pmsg(I_INVALID_BLKNUM, "ACK", clip, clport);
+      clses->ackblk = clses->blknum;
+      clses->nresent = clses->nresent > nacked ? clses->nresent - nacked : 0;
+    }
+
+  senddata:
+    /* make TFTP DATA, the rest of the window is sent by send_window() */
+    if ((sinfo->msglen = make_tftpdata_msg(clses, wk->ads, sinfo->msgbuf, sinfo->bufsize)) < 0) {
+      tftperrcode = TFTP_ERR_SEEMSG;
+      snprintf(emsgbuf, sizeof emsgbuf, "server error");
+      goto errsend;
     }
 
     goto done;
 
   case OP_ERROR:
     if (! clses) {
-      pmsg(I_INVALID_TFTPMSG, "ERROR", clip, clport);
+      pmsg(I_INVALID_TFTPMSG, "ERROR", peer_ip(pr), peer_port(pr));
       goto err;
     }
     
     if (parse_tftperror(&errmsg, dbuf, dlen) == IW_ERR) {
-      pmsg(I_TFTPERROR_INCORRECT, clip, clport);
+      pmsg(I_TFTPERROR_INCORRECT, peer_ip(pr), peer_port(pr));
     }
     else {
-      pmsg(I_TFTPERROR_RECV, ntohs(*errmsg.errcode), errmsg.errmsg, clip, clport);
+      pmsg(I_TFTPERROR_RECV, ntohs(*errmsg.errcode), errmsg.errmsg, peer_ip(pr), peer_port(pr));
     }
 
     DBG_PRINT(DBG_SET_DISABLE);
     clses->disabled = IW_TRUE;
-    close_data(clses, ins->ads);
+    discard_data(clses, wk->ads);
     goto done;
     
   default:
-    pmsg(IV_UNKNOWN_MSG, clip, clport);
+    pmsg(IV_UNKNOWN_MSG, peer_ip(pr), peer_port(pr));
     goto done;
   }
 
@@ -886,116 +3274,239 @@ tftp_proc(IWTFTP *ins, int sock, const char *clip, uint16_t clport,
   /* check resend count */
   if (clses->retrycount < RESEND_COUNTMAX) {
     DBG_PRINT(DBG_PREPARE_RESEND);
-    memcpy(sinfo->msgbuf, clses->lastmsg, clses->lastmsglen);
-    sinfo->msglen = clses->lastmsglen;
-    clses->lastsending = time(NULL);
+    if (clses->reqop == OP_RRQ && clses->foack == IW_FALSE) {
+      /* DATA is made again from the datastore */
+      rewind_data(clses, 0);
+      if ((sinfo->msglen = make_tftpdata_msg(clses, wk->ads, sinfo->msgbuf, sinfo->bufsize)) < 0) {
+	tftperrcode = TFTP_ERR_SEEMSG;
+	snprintf(emsgbuf, sizeof emsgbuf, "server error");
+	goto errsend;
+      }
+    }
+    else {
+      memcpy(sinfo->msgbuf, clses->lastmsg, clses->lastmsglen);
+      sinfo->msglen = clses->lastmsglen;
+    }
+    clses->lastsending = get_monotonic_msec();
     clses->retrycount += 1;
     DBG_SH_SESSION(clses);
   }
   else {
     DBG_PRINT(DBG_SET_DISABLE);
     clses->disabled = IW_TRUE;
-    close_data(clses, ins->ads);
+    discard_data(clses, wk->ads);
   }
   sinfo->ses = clses;
   return IW_OK;
 
  errsend:
-  /* make TFTP ERROR */
+  /* make TFTP ERROR, and remove the file of the upload at once */
   if (clses) {
     clses->fin = IW_TRUE;
+    discard_data(clses, wk->ads);
   }
   
-  if ((sinfo->msglen = make_tftperr_msg(tftperrcode, sinfo->msgbuf, sizeof sinfo->msgbuf,
+  if ((sinfo->msglen = make_tftperr_msg(tftperrcode, sinfo->msgbuf, sinfo->bufsize,
 					emsgbuf, strlen(emsgbuf))) == IW_ERR) {
-    pmsg(E_FAIL_MAKEERROR, clip, clport);
+    pmsg(E_FAIL_MAKEERROR, peer_ip(pr), peer_port(pr));
     goto err;
   }
   sinfo->ses = clses;
   return IW_OK;
-  
- err:
-  /* could not send TFTP ERROR */
-  return IW_ERR;
+  
+ err:
+  /* could not send TFTP ERROR */
+  return IW_ERR;
+}
+
+
+/* resend or close the sessions whose timer has expired */
+static void
+expire_session(struct worker *wk)
+{
+  DBG_PRINT(DBG_EXPIRE_SESSION);
+  struct twtimer *tm;
+  struct twtimer *next;
+  struct session *pm;
+
+  for (tm = tw_expire(&wk->timers, get_monotonic_msec()); tm; tm = next) {
+    next = tm->next;
+    pm = tm->data;
+
+    /* discarded, or finished and waited for closing */
+    if (pm->disabled == IW_TRUE || pm->fin == IW_TRUE) {
+      del_session(wk, pm);
+      continue;
+    }
+
+    resend_session(wk, pm);
+    set_session_timer(&wk->timers, pm);
+  }
+
+  DBG_PRINT(DBG_REMAIN_SESSION);
+  DBG_SH_ALLSESSION(wk->seshead);
+}
+
+
+/* arm the timer of the session for the next resending or closing */
+static void
+set_session_timer(struct timerwheel *tw, struct session *clses)
+{
+  int64_t expire;
+
+  if (clses->disabled == IW_TRUE) {
+    expire = get_monotonic_msec();
+  }
+  else if (clses->fin == IW_TRUE) {
+    expire = clses->lastsending + SESSION_CLOSEWAIT;
+  }
+  else {
+    expire = clses->lastsending + clses->timeout;
+  }
+
+  tw_add(tw, &clses->timer, expire);
+}
+
+
+static int32_t
+resend_session(struct worker *wk, struct session *clses)
+{
+  DBG_PRINT(DBG_RESEND_SESSION);
+  uint8_t *buf;
+  size_t bufsize;
+
+  if (clses->optflags & (TFTP_OPT_TIMEOUT | TFTP_OPT_UTIMEOUT)) {
+    /* fixed timeout requested by the client */
+    if (clses->retrycount >= RESEND_COUNTMAX) {
+      goto giveup;
+    }
+  }
+  else {
+    /* exponential backoff */
+    if (clses->timeout >= RTO_MAX) {
+      goto giveup;
+    }
+    clses->timeout = clses->timeout * 2 < RTO_MAX ? clses->timeout * 2 : RTO_MAX;
+  }
+
+  DBG_PRINT(DBG_UPDATE_RETRY);
+
+  clses->retrycount += 1;
+  clses->lastsending = get_monotonic_msec();
+
+  DBG_SH_SESSION(clses);
+  DBG_PRINT(DBG_SEND_SESSION);
+
+  if (clses->reqop == OP_RRQ && clses->foack == IW_FALSE) {
+    /* send the window again from the last acknowledged block */
+    rewind_data(clses, 0);
+    send_window(wk, clses);
+    return IW_OK;
+  }
+
+  if (! (buf = get_txbuf(wk, clses->route.xsk, &bufsize))) {
+    /* by the next timer */
+    return IW_OK;
+  }
+  memcpy(buf, clses->lastmsg, clses->lastmsglen);
+  put_txbuf(wk, clses->sendsrc, clses->lastmsglen,
+	    is_connected(clses) == IW_TRUE ? NULL : (struct sockaddr *)&clses->claddr, clses->claddrlen,
+	    clses->route.xsk ? &clses->route : NULL);
+
+  DBG_SH_SEND(clses->lastmsglen, clses->clsock, clses->clip, clses->clport);
+  return IW_OK;
+
+ giveup:
+  clses->disabled = IW_TRUE;
+  discard_data(clses, wk->ads);
+  return IW_OK;
 }
 
 
-static int32_t
-resend_allsession(struct session *head, IWDS *ads)
+/* RTO from a sample of round-trip time, by Jacobson/Karels (RFC6298) */
+static void
+update_rtt(struct session *clses, int64_t rtt)
 {
-  DBG_PRINT(DBG_RESEND_SESSION);
-  struct session *pm;
-  int32_t diff;
-  struct sockaddr_storage addr;
-  socklen_t addrlen;
-  ssize_t slen;
+  int64_t rto;
 
-  addrlen = sizeof addr;
-  
-  for (pm = head; pm; pm = pm->next) {
-    diff = (int32_t)difftime(time(NULL), pm->lastsending);
+  /* fixed timeout requested by the client */
+  if (clses->optflags & (TFTP_OPT_TIMEOUT | TFTP_OPT_UTIMEOUT)) {
+    return;
+  }
 
-    if (diff <=  RESEND_INTERVAL)
-      continue;
-    
-    if (pm->fin == IW_TRUE || pm->disabled == IW_TRUE)
-      continue;
+  if (rtt < 0) {
+    rtt = 0;
+  }
 
-    if (pm->retrycount >= RESEND_COUNTMAX) {
-      pm->disabled = IW_TRUE;
-      close_data(pm, ads);
-      continue;
-    }
+  if (clses->srtt == 0 && clses->rttvar == 0) {
+    /* first measurement */
+    clses->srtt = rtt;
+    clses->rttvar = rtt / 2;
+  }
+  else {
+    clses->rttvar = (3 * clses->rttvar + (clses->srtt > rtt ? clses->srtt - rtt : rtt - clses->srtt)) / 4;
+    clses->srtt = (7 * clses->srtt + rtt) / 8;
+  }
 
-    if (getsockname(pm->clsock, (struct sockaddr *)&addr, &addrlen) == -1) {
-      pmsg(EV_FAIL_GETSOCKNAME, strerror(errno));
-      pmsg(E_FAIL_RESEND, pm->clip, pm->clport);
-      continue;
-    }
+  rto = clses->srtt + (4 * clses->rttvar > RTT_GRANULARITY ? 4 * clses->rttvar : RTT_GRANULARITY);
+  rto = (rto + 999) / 1000;
+  clses->timeout = rto < RTO_MIN ? RTO_MIN : (rto > RTO_MAX ? RTO_MAX : rto);
 
-    DBG_PRINT(DBG_UPDATE_RETRY);
+  DBG_SH_RTT(rtt, clses);
+}
 
-    pm->retrycount += 1;
-    pm->lastsending = time(NULL);
 
-    DBG_SH_SESSION(pm);
-    DBG_PRINT(DBG_SEND_SESSION);
+static void
+send_window(struct worker *wk, struct session *clses)
+{
+  DBG_PRINT(DBG_SEND_WINDOW);
+  ssize_t msglen;
+  uint8_t *buf;
+  size_t bufsize;
 
-    if ((slen = sendto(pm->clsock, pm->lastmsg, pm->lastmsglen, 0,
-		       (struct sockaddr *)&addr, addrlen)) == -1) {
-      pmsg(EV_FAIL_SENDTO, pm->clip, pm->clport, strerror(errno));
-      pmsg(E_FAIL_RESEND, pm->clip, pm->clport);
-      continue;
+  while ((uint16_t)(clses->blknum - clses->ackblk) < clses->windowsize && clses->feot == IW_FALSE) {
+    /* the rest is sent after the next ACK, or by the timer */
+    if (! (buf = get_txbuf(wk, clses->route.xsk, &bufsize))) {
+      break;
+    }
+    if ((msglen = make_tftpdata_msg(clses, wk->ads, buf, bufsize)) < 0) {
+      pmsg(E_FAIL_RESEND, clses->clip, clses->clport);
+      break;
     }
 
-    DBG_SH_SEND(slen, pm->clsock, pm->clip, pm->clport);
-  }
+    put_txbuf(wk, clses->sendsrc, msglen,
+	      is_connected(clses) == IW_TRUE ? NULL : (struct sockaddr *)&clses->claddr, clses->claddrlen,
+	      clses->route.xsk ? &clses->route : NULL);
 
-  return IW_OK;
+    DBG_SH_SEND(msglen, clses->clsock, clses->clip, clses->clport);
+  }
 }
 
 
 /* for sessions */
 /* ------------ */
-struct session *
-add_newsession(struct session **phead, int32_t svsock, const char *clip, uint16_t clport,
-	       const char *file, const char *mode)
+static struct session *
+add_newsession(struct worker *wk, int svsock, struct peer *pr, const char *file, const char *mode)
 {
   DBG_PRINT(DBG_ADD_SESSION);
   struct session *clses = NULL;
-  struct sockaddr_storage svaddr;
-  socklen_t svaddrlen;
-  char svip[NI_MAXHOST];
-  int ecode;
+#ifdef HAVE_AF_XDP
+  uint16_t port;
+#endif
 
-  if (! (clses = create_session(phead))) {
+  if (! (clses = create_session(&wk->seshead))) {
     pmsg(EV_FAIL_CREATE_SESSION);
     goto err;
   }
 
-  strncpy(clses->clip, clip, sizeof clses->clip - 1);
+  /* the session keeps the text for its own log lines */
+  strncpy(clses->clip, peer_ip(pr), sizeof clses->clip - 1);
 
-  clses->clport = clport;
+  clses->clport = peer_port(pr);
+
+  memcpy(&clses->claddr, pr->addr, pr->addrlen);
+  clses->claddrlen = pr->addrlen;
+  index_session(wk, clses);
 
   strncpy(clses->filename, file, sizeof clses->filename - 1);
 
@@ -1005,28 +3516,49 @@ add_newsession(struct session **phead, int32_t svsock, const char *clip, uint16_
   else if (IS_OCTET(mode)) {
     clses->tftpmode = TFTP_MODE_OCTET;
   }
+
+#ifdef HAVE_AF_XDP
+  /* the AF_XDP path has no socket, replies from a port of the range steered by the program */
+  if (pr->route) {
+    if (! (port = alloc_sesport(wk->ins->xdp))) {
+      pmsg(EV_XDP_NOPORT);
+      goto err;
+    }
+    clses->route = *pr->route;
+    clses->route.lport = htons(port);
+    clses->maxblksize = wk->ins->xdp->maxblksize;
+
+    DBG_SH_SESSION(clses);
+    return clses;
+  }
+#endif
       
-  svaddrlen = sizeof svaddr;
-  if (getsockname(svsock, (struct sockaddr *)&svaddr, &svaddrlen) == -1) {
-    pmsg(EV_FAIL_GETSOCKNAME, strerror(errno));
+  /* client socket, bound on the address of the server socket */
+  if ((clses->clsock = get_sessock(wk, svsock, clses)) == IW_ERR) {
     goto err;
   }
-  if ((ecode = getnameinfo((struct sockaddr *)&svaddr, svaddrlen,
-			   svip, sizeof svip, NULL, 0, NI_NUMERICHOST)) != 0) {
-    pmsg(EV_FAIL_GETNAMEINFO, gai_strerror(ecode));
-    goto err;
+  if (clses->fshared == IW_TRUE) {
+    DBG_SH_SESSION(clses);
+    return clses;
   }
-
-  /* client socket */
-  if ((clses->clsock = create_socket(svaddr.ss_family, svip, NULL)) == IW_ERR) {
-    pmsg(E_FAIL_CREATE_SOCKET, svaddr.ss_family == AF_INET ? 4 : 6, svip, "ANY");
+  /* the kernel drops the datagrams of other transfer IDs, and routes the replies once */
+  if (connect(clses->clsock, pr->addr, pr->addrlen) == -1) {
+    pmsg(EV_FAIL_CONNECT, clses->clip, clses->clport, strerror(errno));
     goto err;
   }
+  /* datagrams of anyone while the socket was not connected */
+  while (recv(clses->clsock, NULL, 0, MSG_DONTWAIT | MSG_TRUNC) >= 0)
+    ;
+  clses->evsrc.type = EVSRC_SESSION;
+  clses->evsrc.fd = clses->clsock;
+  clses->evsrc.ses = clses;
+  clses->sendsrc = &clses->evsrc;
 
   DBG_SH_SESSION(clses);
   return clses;
 
  err:
+  if (clses) del_session(wk, clses);
   return NULL;
 }
 
@@ -1043,6 +3575,16 @@ create_session(struct session **phead)
   memset(node, 0, sizeof(struct session));
   node->clsock = -1;
   node->tftpmode = TFTP_MODE_OCTET;
+  node->blksize = TFTP_DATALEN_MAX;
+  node->maxblksize = TFTP_BLKSIZE_MAX;
+  node->windowsize = TFTP_WINDOWSIZE_MIN;
+  node->timeout = RTO_INIT;
+  tw_init_timer(&node->timer, node);
+
+  if (! (node->winpos = malloc(sizeof(struct blkpos) * TFTP_WINDOWSIZE_MIN))) {
+    pmsg(E_FAIL_MALLOC, __FUNCTION__);
+    goto err;
+  }
 
   if (! (node->sesbuf = malloc(sizeof(struct datastorage)))) {
     pmsg(E_FAIL_MALLOC, __FUNCTION__);
@@ -1061,20 +3603,22 @@ create_session(struct session **phead)
   return node;
 
  err:
+  if (node) {
+    free(node->winpos);
+    free(node->sesbuf);
+  }
+  free(node);
   return NULL;
 }
 
 
 static struct session *
-get_session(struct session *head, const char *clip, uint16_t clport)
+get_session(struct worker *wk, const struct sockaddr *addr)
 {
-  struct session *pm = NULL;
-
-  if (! head)
-    return NULL;
+  struct session *pm;
 
-  for (pm = head; pm; pm = pm->next) {
-    if (strcmp(pm->clip, clip) == 0 && pm->clport == clport) {
+  for (pm = wk->sestable[hash_sockaddr(addr) & (wk->sestablesize - 1)]; pm; pm = pm->hnext) {
+    if (is_same_sockaddr((struct sockaddr *)&pm->claddr, addr) == IW_TRUE) {
       break;
     }
   }
@@ -1083,25 +3627,69 @@ get_session(struct session *head, const char *clip, uint16_t clport)
 }
 
 
+/* add the session to the hash index, doubling the buckets as sessions increase */
 static void
-del_session(struct session **phead, const char *clip, uint16_t clport)
+index_session(struct worker *wk, struct session *ses)
 {
-  DBG_PRINT(DBG_DEL_SESSION);
-  struct session *tmp;
-  
-  if (! (tmp = get_session(*phead, clip, clport))) {
-    pmsg(EV_SESSION_NOTFOUND, clip, clport);
-    return;
+  struct session **table;
+  struct session *pm;
+  struct session *next;
+  uint32_t size;
+  uint32_t i;
+
+  if (wk->nsessions >= wk->sestablesize) {
+    size = wk->sestablesize * 2;
+    /* keep the current buckets if no memory, only the chains get longer */
+    if ((table = calloc(size, sizeof(struct session *)))) {
+      for (i = 0; i < wk->sestablesize; i++) {
+	for (pm = wk->sestable[i]; pm; pm = next) {
+	  next = pm->hnext;
+	  pm->hnext = table[pm->hkey & (size - 1)];
+	  table[pm->hkey & (size - 1)] = pm;
+	}
+      }
+      free(wk->sestable);
+      wk->sestable = table;
+      wk->sestablesize = size;
+    }
+  }
+
+  ses->hkey = hash_sockaddr((struct sockaddr *)&ses->claddr);
+  ses->hnext = wk->sestable[ses->hkey & (wk->sestablesize - 1)];
+  wk->sestable[ses->hkey & (wk->sestablesize - 1)] = ses;
+  wk->nsessions++;
+}
+
+
+static void
+unindex_session(struct worker *wk, struct session *ses)
+{
+  struct session **pp;
+
+  for (pp = &wk->sestable[ses->hkey & (wk->sestablesize - 1)]; *pp; pp = &(*pp)->hnext) {
+    if (*pp == ses) {
+      *pp = ses->hnext;
+      wk->nsessions--;
+      return;
+    }
   }
+}
+
+
+static void
+del_session(struct worker *wk, struct session *ses)
+{
+  DBG_PRINT(DBG_DEL_SESSION);
+  struct session *tmp = ses;
 
   DBG_SH_SESSION(tmp);
   
   if (! tmp->prev && ! tmp->next) {
-    *phead = NULL;
+    wk->seshead = NULL;
   }
   else if (! tmp->prev && tmp->next) {
     tmp->next->prev = NULL;
-    *phead = tmp->next;
+    wk->seshead = tmp->next;
   }
   else if (tmp->prev && ! tmp->next) {
     tmp->prev->next = NULL;
@@ -1111,8 +3699,36 @@ del_session(struct session **phead, const char *clip, uint16_t clport)
     tmp->next->prev = tmp->prev;
   }
 
-  close(tmp->clsock);
+  /* disarmed already if expired */
+  tw_del(&wk->timers, &tmp->timer);
+
+  if (tmp->regevent == IW_TRUE) {
+    del_event(wk, &tmp->evsrc, tmp->clip, tmp->clport);
+  }
+  unindex_session(wk, tmp);
+  discard_data(tmp, wk->ads);
+  if (tmp->clsock >= 0 && tmp->fshared == IW_FALSE) {
+    free_outq(wk, &tmp->evsrc);
+    put_sessock(wk, tmp);
+  }
+#ifdef HAVE_AF_XDP
+  if (tmp->route.xsk && tmp->route.lport) {
+    free_sesport(wk->ins->xdp, ntohs(tmp->route.lport));
+  }
+#endif
+  free(tmp->winpos);
   free(tmp->sesbuf);
+
+  /* the requests of io_uring refer to the session until they are canceled */
+  if (tmp->evsrc.armed == IW_TRUE || tmp->evsrc.outarmed == IW_TRUE) {
+    tmp->prev = NULL;
+    tmp->next = wk->zombies;
+    if (wk->zombies) {
+      wk->zombies->prev = tmp;
+    }
+    wk->zombies = tmp;
+    return;
+  }
   free(tmp);
 }
 
@@ -1129,7 +3745,10 @@ del_allsession(struct session **phead)
     
   while (pm) {
     tmp = pm->next;
-    close(pm->clsock);
+    if (pm->clsock >= 0 && pm->fshared == IW_FALSE) {
+      close(pm->clsock);
+    }
+    free(pm->winpos);
     free(pm->sesbuf);
     free(pm);
     pm = tmp;
@@ -1140,30 +3759,122 @@ del_allsession(struct session **phead)
 }
 
 
-static void
-cleanup_session(struct session **phead)
+/* TFTP options of the session (RFC2347), unknown ones are ignored
+ * return: IW_OK, TFTP_ERR_BADOPT if the value of a known option is unacceptable, or IW_ERR
+ */
+static int32_t
+set_session_option(struct session *clses, IWDS *ads, struct tftpreq *req)
 {
-  DBG_PRINT(DBG_CLEANUP_SESSION);
-  struct session *pm;
-  int32_t diff;
+  DBG_PRINT(DBG_SET_OPTION);
+  unsigned long val;
+  off_t fsize;
+  char *endp;
+  struct blkpos *bp;
+  int32_t i;
+
+  for (i = 0; i < req->nopts; i++) {
+    DBG_SH_TFTPOPT(req->opts[i].name, req->opts[i].value);
+
+    /* blksize (RFC2348) */
+    if (IS_OPTNAME(req->opts[i].name, "blksize")) {
+      errno = 0;
+      val = strtoul(req->opts[i].value, &endp, 10);
+      if (errno || *endp != '\0' || endp == req->opts[i].value || val < TFTP_BLKSIZE_MIN) {
+	goto badopt;
+      }
+      clses->blksize = val < clses->maxblksize ? val : clses->maxblksize;
+      clses->optflags |= TFTP_OPT_BLKSIZE;
+      continue;
+    }
 
-  for (pm = *phead; pm; pm = pm->next) {
-    if (pm->disabled == IW_TRUE) {
-      del_session(phead, pm->clip, pm->clport);
+    /* windowsize (RFC7440), only for reading */
+    if (IS_OPTNAME(req->opts[i].name, "windowsize") && ntohs(*req->opcode) == OP_RRQ) {
+      errno = 0;
+      val = strtoul(req->opts[i].value, &endp, 10);
+      if (errno || *endp != '\0' || endp == req->opts[i].value || val < TFTP_WINDOWSIZE_MIN) {
+	goto badopt;
+      }
+      clses->windowsize = val < TFTP_WINDOWSIZE_MAX ? val : TFTP_WINDOWSIZE_MAX;
+      clses->optflags |= TFTP_OPT_WINDOWSIZE;
+      continue;
     }
-    else {
-      if (pm->fin == IW_TRUE) {
-	diff = (int32_t)difftime(time(NULL), pm->lastsending);
 
-	if (diff > SESSION_CLOSEWAIT) {
-	  del_session(phead, pm->clip, pm->clport);
+    /* tsize (RFC2349) */
+    if (IS_OPTNAME(req->opts[i].name, "tsize")) {
+      errno = 0;
+      val = strtoul(req->opts[i].value, &endp, 10);
+      if (errno || *endp != '\0' || endp == req->opts[i].value || (off_t)val < 0) {
+	goto badopt;
+      }
+
+      if (ntohs(*req->opcode) == OP_WRQ) {
+	/* size of the upload, for preallocation */
+	clses->tsize = val;
+      }
+      else {
+	/* the size on the disk differs from the transfer size in netascii */
+	if (clses->tftpmode != TFTP_MODE_OCTET ||
+	    (fsize = iwds_getsize(ads, clses->filename)) == IW_ERR) {
+	  pmsg(IV_OPTION_IGNORED, req->opts[i].name, req->opts[i].value);
+	  continue;
 	}
+	clses->tsize = fsize;
+      }
+      clses->optflags |= TFTP_OPT_TSIZE;
+      continue;
+    }
+
+    /* timeout (RFC2349), in seconds */
+    if (IS_OPTNAME(req->opts[i].name, "timeout")) {
+      errno = 0;
+      val = strtoul(req->opts[i].value, &endp, 10);
+      if (errno || *endp != '\0' || endp == req->opts[i].value ||
+	  val < TFTP_TIMEOUT_MIN || val > TFTP_TIMEOUT_MAX) {
+	goto badopt;
+      }
+      clses->timeout = val * 1000;
+      clses->reqtimeout = val;
+      clses->optflags &= ~TFTP_OPT_UTIMEOUT;
+      clses->optflags |= TFTP_OPT_TIMEOUT;
+      continue;
+    }
+
+    /* utimeout (extension of tftp-hpa), in microseconds */
+    if (IS_OPTNAME(req->opts[i].name, "utimeout")) {
+      errno = 0;
+      val = strtoul(req->opts[i].value, &endp, 10);
+      if (errno || *endp != '\0' || endp == req->opts[i].value ||
+	  val < TFTP_UTIMEOUT_MIN || val > TFTP_UTIMEOUT_MAX) {
+	goto badopt;
       }
+      /* timers are in msec, the value is acknowledged as requested */
+      clses->timeout = val / 1000;
+      clses->reqtimeout = val;
+      clses->optflags &= ~TFTP_OPT_TIMEOUT;
+      clses->optflags |= TFTP_OPT_UTIMEOUT;
+      continue;
     }
+
+    pmsg(IV_OPTION_IGNORED, req->opts[i].name, req->opts[i].value);
   }
 
-  DBG_PRINT(DBG_REMAIN_SESSION);
-  DBG_SH_ALLSESSION(*phead);
+  /* positions of the blocks in the window */
+  if (clses->windowsize > TFTP_WINDOWSIZE_MIN) {
+    if (! (bp = realloc(clses->winpos, sizeof(struct blkpos) * clses->windowsize))) {
+      pmsg(E_FAIL_MALLOC, __FUNCTION__);
+      goto err;
+    }
+    clses->winpos = bp;
+  }
+
+  return IW_OK;
+
+ badopt:
+  pmsg(IV_OPTION_REJECTED, req->opts[i].name, req->opts[i].value);
+  return TFTP_ERR_BADOPT;
+
+ err:
+  return IW_ERR;
 }
 
 
@@ -1176,6 +3887,10 @@ parse_tftpreq(struct tftpreq *req, void *msg, size_t msglen)
 
   int32_t passed;
   int32_t i;
+  uint8_t *pm;
+  uint8_t *pend;
+  char *name;
+  char *value;
   
   if (msglen < sizeof(uint16_t) + 2 + strlen("octet") + 1) {
     pmsg(IV_REQLEN_TOOSHORT);
@@ -1221,6 +3936,43 @@ parse_tftpreq(struct tftpreq *req, void *msg, size_t msglen)
     goto err;
   }
 
+  /* options (RFC2347), pairs of "name\0value\0" */
+  req->nopts = 0;
+  pm = (uint8_t *)req->mode + strlen(req->mode) + 1;
+  pend = (uint8_t *)msg + msglen;
+
+  while (pm < pend) {
+    name = (char *)pm;
+    while (pm < pend && *pm != '\0') {
+      pm++;
+    }
+    if (pm++ == pend) {
+      pmsg(IV_OPTION_INCORRECT);
+      goto err;
+    }
+
+    value = (char *)pm;
+    while (pm < pend && *pm != '\0') {
+      pm++;
+    }
+    if (pm++ == pend) {
+      pmsg(IV_OPTION_INCORRECT);
+      goto err;
+    }
+
+    /* no known option takes such a long value */
+    if (pm - (uint8_t *)value > TFTP_OPTVAL_MAX) {
+      pmsg(IV_OPTION_IGNORED, name, "(too long)");
+      continue;
+    }
+
+    if (req->nopts < TFTP_OPTS_MAX) {
+      req->opts[req->nopts].name = name;
+      req->opts[req->nopts].value = value;
+      req->nopts++;
+    }
+  }
+
   DBG_SH_TFTPMSG(0, req, msglen);
   return IW_OK;
 
@@ -1230,11 +3982,11 @@ parse_tftpreq(struct tftpreq *req, void *msg, size_t msglen)
 
 
 static int32_t
-parse_tftpdata(struct tftpdata *dat, void *msg, size_t msglen)
+parse_tftpdata(struct tftpdata *dat, void *msg, size_t msglen, size_t blksize)
 {
   DBG_PRINT(DBG_PARSE_TFTPDATA);
  
-  if (msglen < sizeof(uint16_t) * 2 || msglen - sizeof(uint16_t) * 2 > TFTP_DATALEN_MAX) {
+  if (msglen < sizeof(uint16_t) * 2 || msglen - sizeof(uint16_t) * 2 > blksize) {
     pmsg(IV_DATA_INCORRECT);
     goto err;
   }
@@ -1339,12 +4091,23 @@ make_tftpdata_msg(struct session *clses, IWDS *ads, void *emptybuf, size_t bufsi
   struct tftpdata datmsg;
   ssize_t datalen;
   ssize_t msglen;
+  uint16_t widx;
 
-  if (bufsize < TFTP_MSGLEN_MAX) {
+  if (bufsize < TFTP_OPCODE_SIZE + TFTP_BLKNUM_SIZE + clses->blksize) {
     pmsg(EV_BUF_TOOSHORT, "data");
     goto err;
   }
 
+  /* position of this block, for resending the window */
+  if ((widx = clses->blknum - clses->ackblk) >= clses->windowsize) {
+    pmsg(EV_BUF_TOOSHORT, "window");
+    goto err;
+  }
+  clses->winpos[widx].offset = clses->sesbuf->fileoff - clses->sesbuf->datalen;
+  clses->winpos[widx].fopt = clses->sesbuf->fopt;
+  clses->winpos[widx].sent = get_monotonic_usec();
+  clses->winpos[widx].fresent = widx < clses->nresent ? IW_TRUE : IW_FALSE;
+
   datmsg.opcode = emptybuf;
   datmsg.blknum = emptybuf + sizeof(uint16_t);
   datmsg.data = emptybuf + sizeof(uint16_t) + sizeof(uint16_t);
@@ -1355,25 +4118,22 @@ make_tftpdata_msg(struct session *clses, IWDS *ads, void *emptybuf, size_t bufsi
   *datmsg.blknum = htons(clses->blknum);
 
   DBG_PRINT(DBG_GET_SESBUF_DATA);
-  if ((datalen = get_session_data(clses, ads, datmsg.data, TFTP_DATALEN_MAX)) == IW_ERR) {
+  if ((datalen = get_session_data(clses, ads, datmsg.data, clses->blksize)) == IW_ERR) {
     pmsg(EV_FAIL_GET_SESBUF, clses->clip, clses->clport);
     goto err;
   }
 
-  /* check fin */
-  if (datalen < TFTP_DATALEN_MAX) {
+  /* check the last block */
+  if ((size_t)datalen < clses->blksize) {
     DBG_PRINT(DBG_SET_FIN);
-    clses->fin = IW_TRUE;
+    clses->feot = IW_TRUE;
     close_data(clses, ads);
   }
 
   msglen = sizeof(uint16_t) * 2 + datalen;
 
-  /* for resending */
-  memcpy(clses->lastmsg, emptybuf, msglen);
-  clses->lastmsglen = msglen;
-  clses->lastsending = time(NULL);
-  clses->retrycount = 0;
+  /* DATA is resent by making again from the datastore */
+  clses->lastsending = get_monotonic_msec();
 
   DBG_SH_TFTPMSG(OP_DATA, &datmsg, msglen);
   return msglen;
@@ -1408,7 +4168,8 @@ make_tftpack_msg(struct session *clses, uint16_t blk, void *emptybuf, size_t buf
   /* for resending */
   memcpy(clses->lastmsg, emptybuf, msglen);
   clses->lastmsglen = msglen;
-  clses->lastsending = time(NULL);
+  clses->lastsending = get_monotonic_msec();
+  clses->rttstamp = get_monotonic_usec();
   clses->retrycount = 0;
 
   DBG_SH_TFTPMSG(OP_ACK, &ackmsg, msglen);
@@ -1419,6 +4180,89 @@ make_tftpack_msg(struct session *clses, uint16_t blk, void *emptybuf, size_t buf
 }
 
 
+static ssize_t
+make_tftpoack_msg(struct session *clses, void *emptybuf, size_t bufsize)
+{
+  DBG_PRINT(DBG_MAKE_TFTPOACK);
+  uint8_t *pm;
+  ssize_t msglen;
+  int len;
+
+  /* OACK is kept for resending too */
+  if (bufsize > sizeof clses->lastmsg) {
+    bufsize = sizeof clses->lastmsg;
+  }
+  if (bufsize < TFTP_OPCODE_SIZE) {
+    pmsg(EV_BUF_TOOSHORT, "oack");
+    goto err;
+  }
+
+  pm = emptybuf;
+  *(uint16_t *)pm = htons(OP_OACK);
+  pm += sizeof(uint16_t);
+
+  if (clses->optflags & TFTP_OPT_BLKSIZE) {
+    len = snprintf((char *)pm, bufsize - (pm - (uint8_t *)emptybuf), "blksize%c%zu", '\0', clses->blksize);
+    if (len < 0 || (size_t)len + 1 > bufsize - (pm - (uint8_t *)emptybuf)) {
+      pmsg(EV_BUF_TOOSHORT, "oack");
+      goto err;
+    }
+    pm += len + 1;
+  }
+
+  if (clses->optflags & TFTP_OPT_WINDOWSIZE) {
+    len = snprintf((char *)pm, bufsize - (pm - (uint8_t *)emptybuf), "windowsize%c%u", '\0', clses->windowsize);
+    if (len < 0 || (size_t)len + 1 > bufsize - (pm - (uint8_t *)emptybuf)) {
+      pmsg(EV_BUF_TOOSHORT, "oack");
+      goto err;
+    }
+    pm += len + 1;
+  }
+
+  if (clses->optflags & TFTP_OPT_TSIZE) {
+    len = snprintf((char *)pm, bufsize - (pm - (uint8_t *)emptybuf), "tsize%c%lld", '\0',
+		   (long long)clses->tsize);
+    if (len < 0 || (size_t)len + 1 > bufsize - (pm - (uint8_t *)emptybuf)) {
+      pmsg(EV_BUF_TOOSHORT, "oack");
+      goto err;
+    }
+    pm += len + 1;
+  }
+
+  if (clses->optflags & (TFTP_OPT_TIMEOUT | TFTP_OPT_UTIMEOUT)) {
+    if (clses->optflags & TFTP_OPT_TIMEOUT) {
+      len = snprintf((char *)pm, bufsize - (pm - (uint8_t *)emptybuf), "timeout%c%u", '\0',
+		     clses->reqtimeout);
+    }
+    else {
+      len = snprintf((char *)pm, bufsize - (pm - (uint8_t *)emptybuf), "utimeout%c%u", '\0',
+		     clses->reqtimeout);
+    }
+    if (len < 0 || (size_t)len + 1 > bufsize - (pm - (uint8_t *)emptybuf)) {
+      pmsg(EV_BUF_TOOSHORT, "oack");
+      goto err;
+    }
+    pm += len + 1;
+  }
+
+  msglen = pm - (uint8_t *)emptybuf;
+
+  /* for resending, the OACK takes place of block 0 */
+  clses->blknum = 0;
+  memcpy(clses->lastmsg, emptybuf, msglen);
+  clses->lastmsglen = msglen;
+  clses->lastsending = get_monotonic_msec();
+  clses->rttstamp = get_monotonic_usec();
+  clses->retrycount = 0;
+
+  DBG_SH_TFTPMSG(OP_OACK, clses, msglen);
+  return msglen;
+
+ err:
+  return IW_ERR;
+}
+
+
 static ssize_t
 make_tftperr_msg(uint16_t ecode, void *emptybuf, size_t bufsize, const char *emsg, size_t emsglen)
 {
@@ -1665,15 +4509,22 @@ load_data(struct session *clses, IWDS *ads)
 
   DBG_PRINT(DBG_DS_SETREQ);
   
-  dticket.dsid = clses->clsock;
   dticket.dfile = clses->filename;
   dticket.dbuf = clses->sesbuf->storage;
   dticket.dlen = SESSION_BUFSIZE;
+  dticket.doff = clses->sesbuf->fileoff;
+  dticket.dsize = 0;
   dticket.derr = 0;
 
   DBG_SH_DSREQ(dticket);
 
-  clses->sesbuf->datalen = iwds_read(ads, &dticket);
+  /* opened at the first block, and again after the last block when it is resent */
+  if (! clses->dsfile && ! (clses->dsfile = iwds_open(ads, &dticket))) {
+    pmsg(E_DS_FAIL_OPEN, iwds_strerr(dticket.derr));
+    goto err;
+  }
+
+  clses->sesbuf->datalen = iwds_read_at(ads, clses->dsfile, &dticket);
   if (dticket.derr) {
     pmsg(E_DS_FAIL_READ, iwds_strerr(dticket.derr));
     goto err;
@@ -1683,6 +4534,7 @@ load_data(struct session *clses, IWDS *ads)
   DBG_SH_DSREQ(dticket);
   
   clses->sesbuf->pos = clses->sesbuf->storage;
+  clses->sesbuf->fileoff += clses->sesbuf->datalen;
   
   return IW_OK;
 
@@ -1692,6 +4544,61 @@ load_data(struct session *clses, IWDS *ads)
 }
 
 
+/* reposition the session to the next of nacked blocks from the last acknowledged block */
+static void
+rewind_data(struct session *clses, uint16_t nacked)
+{
+  DBG_PRINT(DBG_DS_REWIND);
+  struct blkpos *bp;
+
+  bp = &clses->winpos[nacked];
+
+  /* the buffer is loaded again from the offset */
+  clses->sesbuf->datalen = 0;
+  clses->sesbuf->pos = clses->sesbuf->storage;
+  clses->sesbuf->fileoff = bp->offset;
+  clses->sesbuf->fopt = bp->fopt;
+
+  /* blocks to be made again are resent ones */
+  if ((uint16_t)(clses->blknum - clses->ackblk) > clses->nresent) {
+    clses->nresent = clses->blknum - clses->ackblk;
+  }
+  clses->nresent -= nacked;
+
+  clses->ackblk += nacked;
+  clses->blknum = clses->ackblk;
+  clses->feot = IW_FALSE;
+}
+
+
+/* create the file for writing with the space of tsize, returns the error code of datastore */
+static int32_t
+create_data(struct session *clses, IWDS *ads)
+{
+  DBG_PRINT(DBG_DS_CREATE);
+  struct dsreq dticket;
+
+  DBG_PRINT(DBG_DS_SETREQ);
+
+  dticket.dfile = clses->filename;
+  dticket.dbuf = NULL;
+  dticket.dlen = 0;
+  dticket.doff = 0;
+  dticket.dsize = clses->tsize;
+  dticket.derr = 0;
+
+  DBG_SH_DSREQ(dticket);
+
+  if (! (clses->dsfile = iwds_create(ads, &dticket))) {
+    pmsg(E_DS_FAIL_CREATE, iwds_strerr(dticket.derr));
+    return dticket.derr;
+  }
+
+  DBG_SH_DSREQ(dticket);
+  return IW_OK;
+}
+
+
 static int32_t
 save_data(struct session *clses, IWDS *ads)
 {
@@ -1699,17 +4606,27 @@ save_data(struct session *clses, IWDS *ads)
   struct dsreq dticket;
   size_t wlen;
 
+  /* without tsize, the file is created at the first data, even if empty */
+  if (! clses->dsfile && create_data(clses, ads) != IW_OK) {
+    goto err;
+  }
+
+  if (clses->sesbuf->datalen == 0) {
+    return IW_OK;
+  }
+
   DBG_PRINT(DBG_DS_SETREQ);
   /* save data to datastore */
-  dticket.dsid = clses->clsock;
   dticket.dfile = clses->filename;
   dticket.dbuf = clses->sesbuf->storage;
   dticket.dlen = clses->sesbuf->datalen;
+  dticket.doff = clses->sesbuf->fileoff;
+  dticket.dsize = 0;
   dticket.derr = 0;
   
   DBG_SH_DSREQ(dticket);
   
-  wlen = iwds_write(ads, &dticket);
+  wlen = iwds_write_at(ads, clses->dsfile, &dticket);
   if (dticket.derr || wlen != clses->sesbuf->datalen) {
     pmsg(E_DS_FAIL_WRITE, iwds_strerr(dticket.derr));
     goto err;
@@ -1718,33 +4635,49 @@ save_data(struct session *clses, IWDS *ads)
   DBG_SH_DSIOLEN(wlen);
   DBG_SH_DSREQ(dticket);
 
+  clses->sesbuf->fileoff += wlen;
   clses->sesbuf->datalen = 0;
   clses->sesbuf->pos = clses->sesbuf->storage;
 
   return IW_OK;
 
  err:
-  close_data(clses, ads);
+  discard_data(clses, ads);
   return IW_ERR;
 }
 
 
+/* close the file reading or writing, if opened */
 static void
 close_data(struct session *clses, IWDS *ads)
 {
   DBG_PRINT(DBG_CLOSE_DATA);
-  struct dsreq dticket;
 
-  /* close the file reading or writing */
-  dticket.dsid = clses->clsock;
-  dticket.dfile = clses->filename;
-  dticket.dbuf = NULL;
-  dticket.dlen = 0;
-  dticket.derr = 0;
+  if (! clses->dsfile) {
+    return;
+  }
+
+  if (iwds_close(ads, clses->dsfile) == IW_ERR) {
+    pmsg(E_DS_FAIL_CLOSE, "invalid handle");
+  }
+  clses->dsfile = NULL;
+}
+
+
+/* close the file, and remove it if it was being uploaded */
+static void
+discard_data(struct session *clses, IWDS *ads)
+{
+  DBG_PRINT(DBG_CLOSE_DATA);
+
+  if (! clses->dsfile) {
+    return;
+  }
 
-  if (iwds_close(ads, &dticket) == IW_ERR) {
-    pmsg(E_DS_FAIL_CLOSE, iwds_strerr(dticket.derr));
+  if (iwds_discard(ads, clses->dsfile) == IW_ERR) {
+    pmsg(E_DS_FAIL_CLOSE, "invalid handle");
   }
+  clses->dsfile = NULL;
 }
 
 
@@ -1760,7 +4693,7 @@ dbg_show_session(struct session *ses)
     return;
   }
 
-  diff = ses->lastsending > 0 ? difftime(time(NULL), ses->lastsending) : 0;
+  diff = ses->lastsending > 0 ? get_monotonic_msec() - ses->lastsending : 0;
   pmsg(DBG_SESSION_ONE, ses->clip, ses->clport, ses->clsock, ses->regevent, ses->filename, ses->blknum,
        ses->fin, ses->lastmsglen, diff, ses->retrycount, ses->disabled);
 
@@ -1779,7 +4712,7 @@ dbg_show_allsession(struct session *head)
   }
 
   for (i = 1, pm = head; pm; pm = pm->next, i++) {
-    diff = pm->lastsending > 0 ? difftime(time(NULL), pm->lastsending) : 0;
+    diff = pm->lastsending > 0 ? get_monotonic_msec() - pm->lastsending : 0;
     pmsg(DBG_SESSION_ALL, i, pm->clip, pm->clport, pm->clsock, pm->regevent, pm->filename, pm->blknum,
 	 pm->fin, pm->lastmsglen, diff, pm->retrycount, pm->disabled);
   }
@@ -1788,7 +4721,12 @@ dbg_show_allsession(struct session *head)
 static void
 dbg_show_opcode(int32_t code)
 {
-  char *s_opcode[] = { "RRQ", "WRQ", "DATA", "ACK", "ERROR" };
+  char *s_opcode[] = { "RRQ", "WRQ", "DATA", "ACK", "ERROR", "OACK" };
+
+  if (code < OP_RRQ || code > OP_OACK) {
+    pmsg(DBG_OPCODE, "UNKNOWN");
+    return;
+  }
 
   pmsg(DBG_OPCODE, s_opcode[code - 1]);
 }
@@ -1800,6 +4738,7 @@ dbg_show_tftpmsg(int32_t sw, void *ptr, size_t msglen)
   struct tftpdata *d;
   struct tftpack *a;
   struct tftperror *e;
+  struct session *o;
   
   switch (sw) {
   case 0:
@@ -1818,6 +4757,11 @@ dbg_show_tftpmsg(int32_t sw, void *ptr, size_t msglen)
     e = ptr;
     pmsg(DBG_TFTPERROR, msglen, ntohs(*e->opcode), ntohs(*e->errcode), e->errmsg, strlen(e->errmsg));
     break;
+  case OP_OACK:
+    o = ptr;
+    pmsg(DBG_TFTPOACK, msglen, OP_OACK, o->optflags, o->blksize, o->windowsize, (long long)o->tsize,
+	 o->timeout);
+    break;
   }
 }
 #endif	/* DEBUG */
@@ -28,16 +28,29 @@
 #define _TFTP_H_
 
 #include <signal.h>
+#include <strings.h>
+#include <pthread.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/ioctl.h>
 #include <sys/param.h>
 #include <ifaddrs.h>
 #include <net/if.h>
 #include <netdb.h>
 #include <arpa/inet.h>
+#include <netinet/udp.h>
+#include <netinet/ip.h>
+#include <linux/filter.h>
+#include <net/ethernet.h>
 
 #include "iw_common.h"
 #include "iw_log.h"
+#include "util.h"
+#include "timerwheel.h"
+#include "uring.h"
+#include "xdp.h"
 #include "iw_ds.h"
 #include "iw_tftp.h"
 
@@ -45,17 +58,81 @@
 /* constants */
 #define TFTP_PORT "69"		                        /* port number */
 #define SVSOCKS_MAX 2					/* maximum number of server sockets */
-#define CLSOCKS_MAX 32					/* maximum number of client sockets */
+#define WORKERS_MAX 256					/* maximum number of worker threads */
 #define IPV4_ADDR_SIZE INET_ADDRSTRLEN			/* length of IPv4 address string (=16) */
 #define IPV6_ADDR_SIZE (INET6_ADDRSTRLEN + IF_NAMESIZE) /* length of IPv6 address string (=46 + 16) */
 #define IPADDRLEN_MAX IPV6_ADDR_SIZE			/* maximum length of IP address string */
-#define EVENTS_MAX (SVSOCKS_MAX + CLSOCKS_MAX)		/* maximum number of epoll events */
-#define BLOCKING_TIMEOUT 1000				/* epoll_wait timeout (msec) */
-#define RESEND_INTERVAL 10				/* interval of resending (sec) */
-#define RESEND_COUNTMAX 3				/* maximum number of resending counts */
-#define SESSION_CLOSEWAIT 15				/* time of waiting for closing the finished session */
-#define NWBUF_SIZE 1024					/* size of buffer for send/recv */
+#define EVENTS_INIT 64					/* initial size of the epoll event array */
+#define SESTABLE_INIT 256				/* initial number of buckets of the session index */
+#define SOCKPOOL_MIN 16					/* pre-bound session sockets kept for a server socket */
+#define SOCKPOOL_MAX 256				/* session sockets given back at most, the rest are closed */
+#define SOCKPOOL_RETRY 1000				/* wait to bind again after a failure (msec) */
+#define SHSOCKS_MAX 64					/* maximum number of shared sockets for a server socket */
+#define OUTQ_MAX 1024					/* messages waiting for a socket at most, the rest are dropped */
+#define BUSYPOLL_USEC 50				/* busy polling of the device queue by a socket (usec) */
+#define IOBATCH_MAX 16					/* maximum number of messages by recvmmsg/sendmmsg */
+#define RXBUF_SIZE 65536				/* receiving buffer, for datagrams coalesced by GRO */
+#define GSO_SEGS_MAX 64					/* maximum number of segments by UDP_SEGMENT */
+#define GSO_BYTES_MAX 65507				/* maximum length of a message by UDP_SEGMENT */
+#define URING_SQ_ENTRIES 256				/* submission queue of io_uring */
+#define URING_CQ_ENTRIES 4096				/* completion queue of io_uring */
+#define RTO_INIT 1000					/* initial retransmission timeout (msec, RFC6298) */
+#define RTO_MIN 50					/* minimum retransmission timeout (msec) */
+#define RTO_MAX 16000					/* maximum retransmission timeout, give up beyond it (msec) */
+#define RTT_GRANULARITY 1000				/* clock granularity for RTO (usec) */
+#define RESEND_COUNTMAX 3				/* maximum number of resending counts (fixed timeout) */
+#define SESSION_CLOSEWAIT 15000				/* time of waiting for closing the finished session (msec) */
 #define SESSION_BUFSIZE 8192	                        /* size of the session buffer */
+#define MAXUPLOAD_DEFAULT (1024LL * 1024 * 1024)		/* largest size of uploads (bytes) */
+
+/* UDP segmentation offload (Linux 4.18, 5.0) */
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+/* io_uring */
+#ifdef HAVE_IO_URING
+/* received message in a provided buffer: header, address, UDP_GRO, payload */
+#define URBUF_HDR_SIZE (sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_storage) + \
+			CMSG_SPACE(sizeof(int)))
+#define URBUF_SMALL 0			       /* group of small buffers */
+#define URBUF_LARGE 1			       /* group of large buffers */
+#define URBUF_GROUPS 2
+#define URBUF_SMALL_NBUFS 1024		       /* buffers for requests and ACK */
+#define URBUF_SMALL_SIZE 2048
+#define URBUF_LARGE_NBUFS 32		       /* buffers for DATA of uploads, coalesced by GRO */
+#define URBUF_LARGE_SIZE (URBUF_HDR_SIZE + RXBUF_SIZE)
+
+/* kinds of requests in user_data, with a pointer in the upper bits */
+#define URTAG_RECV 0			       /* multishot recvmsg, of struct evsrc */
+#define URTAG_SEND 1			       /* sendmsg, flush, group and segments in the upper bits */
+#define URTAG_TIMEOUT 2			       /* timeout until the nearest timer */
+#define URTAG_WAKEUP 3			       /* poll of the eventfd */
+#define URTAG_IGNORE 4			       /* cancellation and updating timeout */
+#define URTAG_POLL 5			       /* poll of an AF_XDP socket, of struct evsrc */
+#define URTAG_WRITABLE 6		       /* poll of a socket with waiting messages, of struct evsrc */
+#define URTAG_MASK 7
+#define URTAG_SHIFT 3
+
+/* upper bits of URTAG_SEND, to requeue the groups the socket refused */
+#define URSEND_DATA(seq, g, nsegs) \
+  ((((uint64_t)(seq) << 32) | ((uint64_t)(g) << 16) | (uint64_t)(nsegs)) << URTAG_SHIFT | URTAG_SEND)
+#define URSEND_SEQ(data) ((uint32_t)((data) >> (URTAG_SHIFT + 32)) & 0xffff)
+#define URSEND_GROUP(data) ((uint32_t)((data) >> (URTAG_SHIFT + 16)) & 0xffff)
+#define URSEND_SEGS(data) ((uint32_t)((data) >> URTAG_SHIFT) & 0xffff)
+#endif	/* HAVE_IO_URING */
+
+/* AF_XDP path */
+#define SESPORT_MIN 61000		       /* default ports of sessions, above the ephemeral ports of Linux */
+#define SESPORT_MAX 65535
+#define XDP_HDR_SIZE (sizeof(struct ether_header) + sizeof(struct iphdr) + sizeof(struct udphdr))
+#define XDP_RX_BATCH 64			       /* packets processed at a wakeup */
 
 /* for TFTP protocol */
 #define TFTP_OPCODE_SIZE 2	               /* size of Opcode field (bytes) */
@@ -63,22 +140,222 @@
 #define TFTP_BLKNUM_MAX USHRT_MAX	       /* maximum block number */
 #define TFTP_FILENAME_MAX 256		       /* maximum size of Filename field (bytes) */
 #define TFTP_MODENAME_MAX 9		       /* maximum size of Mode filed (bytes) */
-#define TFTP_DATALEN_MAX 512		       /* maximum size of Data filed (bytes) */
+#define TFTP_DATALEN_MAX 512		       /* size of Data filed without blksize option (bytes) */
 #define TFTP_ECODE_SIZE 2		       /* size of ErrorCode field (bytes) */
 #define TFTP_EMSGLEN_MAX 256		       /* maximum size of ErrMsg filed (bytes) */
-/* maximum length of the TFTP message (bytes) */
+/* maximum length of the TFTP message without options (bytes) */
 #define TFTP_MSGLEN_MAX (TFTP_OPCODE_SIZE + TFTP_BLKNUM_SIZE + TFTP_DATALEN_MAX)
 
+/* for TFTP options (RFC2347, RFC2348) */
+#define TFTP_OPTS_MAX 8			       /* maximum number of options in a request */
+#define TFTP_OPTVAL_MAX 32		       /* maximum size of option value (bytes) */
+#define TFTP_BLKSIZE_MIN 8		       /* minimum value of blksize option */
+#define TFTP_BLKSIZE_MAX 65464		       /* maximum value of blksize option */
+#define TFTP_WINDOWSIZE_MIN 1		       /* minimum value of windowsize option (RFC7440) */
+#define TFTP_WINDOWSIZE_MAX 64		       /* maximum value of windowsize option */
+#define TFTP_OPT_BLKSIZE 0x00000001	       /* blksize option is acknowledged */
+#define TFTP_OPT_WINDOWSIZE 0x00000002	       /* windowsize option is acknowledged */
+#define TFTP_OPT_TSIZE 0x00000004	       /* tsize option is acknowledged (RFC2349) */
+#define TFTP_OPT_TIMEOUT 0x00000008	       /* timeout option is acknowledged (RFC2349) */
+#define TFTP_OPT_UTIMEOUT 0x00000010	       /* utimeout option is acknowledged */
+#define TFTP_TIMEOUT_MIN 1		       /* minimum value of timeout option (sec) */
+#define TFTP_TIMEOUT_MAX 255		       /* maximum value of timeout option (sec) */
+#define TFTP_UTIMEOUT_MIN 10000		       /* minimum value of utimeout option (usec) */
+#define TFTP_UTIMEOUT_MAX 255000000	       /* maximum value of utimeout option (usec) */
+
+/* size of buffer for send/recv (the largest DATA message) */
+#define NWBUF_SIZE (TFTP_OPCODE_SIZE + TFTP_BLKNUM_SIZE + TFTP_BLKSIZE_MAX)
+
 /* check bool of TFTP mode */
 #define IS_NETASCII(m) (strcmp((m), "netascii") == 0 ? IW_TRUE : IW_FALSE)
 #define IS_OCTET(m) (strcmp((m), "octet") == 0 ? IW_TRUE : IW_FALSE)
+#define IS_OPTNAME(o, n) (strcasecmp((o), (n)) == 0 ? IW_TRUE : IW_FALSE)
 
 
 /* iwtftp object */
 struct _iwtftp {
-  int svsocks[SVSOCKS_MAX];	       /* sever sockets (IPv4/IPv6) */
+  IWDS *ads;			       /* pointer to iwds module */
+  struct worker *workers;	       /* workers */
+  int32_t nworkers;		       /* number of workers */
+  int32_t fgso;			       /* flag of whether UDP_SEGMENT is supported */
+  int32_t fgro;			       /* flag of whether UDP_GRO is supported */
+  struct xdppath *xdp;		       /* AF_XDP path, served by the first worker, or NULL */
+  uint16_t minport;		       /* ports of session sockets, or 0 for ephemeral ports */
+  uint16_t maxport;
+  int32_t nshared;		       /* sockets shared by the sessions of a worker, or 0 */
+  int32_t busyidle;		       /* idle time to stop busy polling (msec), or 0 for no polling */
+  int32_t faffinity;		       /* flag of whether workers are pinned on CPUs */
+  off_t maxupload;		       /* largest size of uploads and their tsize, or 0 for no limit */
+};
+
+/* kinds of fds registered to epoll */
+enum EVSRC_TYPE {
+  EVSRC_SERVER,			       /* server socket */
+  EVSRC_SESSION,		       /* client socket of a session */
+  EVSRC_WAKEUP,			       /* eventfd for exiting */
+  EVSRC_CLOSED,			       /* socket of a deleted session, until receiving is canceled */
+  EVSRC_XSK,			       /* AF_XDP socket of a receive queue */
+  EVSRC_SHARED,			       /* socket shared by sessions, told apart by client address */
+};
+
+/* message waiting for the socket to be writable, a group of UDP_SEGMENT in a buffer */
+struct outmsg {
+  struct outmsg *next;
+  struct sockaddr_storage addr;	       /* destination */
+  socklen_t addrlen;		       /* length of the destination, or 0 for the connected socket */
+  uint16_t segsize;		       /* size of the segments, or 0 for a datagram */
+  uint32_t nsegs;		       /* number of datagrams */
+  size_t len;			       /* length of the data */
+  uint8_t data[];
+};
+
+/* source of epoll events, pointed by epoll_event.data.ptr */
+struct evsrc {
+  enum EVSRC_TYPE type;		       /* kind of the fd */
+  int fd;			       /* registered fd */
+  struct session *ses;		       /* session of the socket (EVSRC_SESSION) */
+  int32_t armed;		       /* flag of whether receiving is armed (io_uring) */
+  int32_t outarmed;		       /* flag of whether polling for writing is armed (io_uring) */
+  uint16_t bgid;		       /* group of the buffers for receiving (io_uring) */
+  struct outmsg *outhead;	       /* messages waiting for the socket, in order */
+  struct outmsg *outtail;
+  uint32_t nout;		       /* number of the waiting messages */
+};
+
+/* how to reach the client on the XDP device, learned from its packet */
+struct xskroute {
+  struct xsk *xsk;		       /* socket to send from, or NULL for the kernel sockets */
+  uint8_t lmac[ETH_ALEN];	       /* MAC address of the device */
+  uint8_t rmac[ETH_ALEN];	       /* MAC address of the client, or the router */
+  uint32_t laddr;		       /* IPv4 address of the server (network order) */
+  uint16_t lport;		       /* port of the server (network order) */
+};
+
+#ifdef HAVE_AF_XDP
+/* AF_XDP sockets of all receive queues of the device, with the XDP program */
+struct xdppath {
+  struct xdpprog prog;		       /* XDP program steering the packets to the sockets */
+  int ifindex;			       /* device */
+  size_t maxblksize;		       /* largest blksize in a frame and the MTU */
+  struct xsk xsks[XSK_QUEUES_MAX];     /* sockets by receive queue */
+  struct evsrc srcs[XSK_QUEUES_MAX];   /* event sources of the sockets */
+  int32_t nxsks;		       /* number of sockets */
+  uint16_t minport;		       /* ports of sessions */
+  uint16_t maxport;
+  uint16_t nextport;		       /* next port to be tried */
+  uint8_t ports[(USHRT_MAX + 1) / 8];  /* bitmap of the ports in use */
+};
+#endif
+
+/* pre-bound sockets of sessions, for a server socket.
+ * In the shared mode, the sessions use the shared sockets instead. The server TID (port)
+ * is the same for the clients on a socket, and a transfer is identified by the client TID
+ * (address and port) alone, so a client has one transfer at a time on the worker. Packets
+ * of an unknown client TID, including requests, are answered by "unknown transfer id".
+ */
+struct sockpool {
+  struct sockaddr_storage addr;	       /* address of the server socket, with port 0 */
+  socklen_t addrlen;		       /* length of the address, or 0 for no server socket */
+  int socks[SOCKPOOL_MAX];	       /* bound and not connected */
+  int32_t n;			       /* number of sockets */
+  int64_t retry;		       /* time to bind again after a failure (msec) */
+  int shared[SHSOCKS_MAX];	       /* sockets shared by sessions */
+  struct evsrc shsrcs[SHSOCKS_MAX];    /* event sources of the shared sockets */
+  int32_t nshared;		       /* number of shared sockets */
+};
+
+/* event backend of the worker */
+struct worker;
+struct evbackend {
+  const char *name;
+  int32_t (*init)(struct worker *wk);
+  void (*exit)(struct worker *wk);
+  int32_t (*add)(struct worker *wk, struct evsrc *src, const char *ip, uint16_t port);
+  void (*del)(struct worker *wk, struct evsrc *src, const char *ip, uint16_t port);
+  void (*wait)(struct worker *wk, int32_t timeout);	/* to handle the ready sources */
+  void (*send)(struct worker *wk, struct evsrc *src, uint32_t first, uint32_t ngrps); /* of grouped messages */
+  void (*submit)(struct worker *wk);			/* at the end of flushing, or NULL */
+  void (*watch)(struct worker *wk, struct evsrc *src, int32_t fout); /* writability while messages wait */
+};
+
+/* messages for recvmmsg() or sendmmsg() */
+struct iobatch {
+  struct mmsghdr msgs[IOBATCH_MAX];    /* message headers */
+  struct iovec iovs[IOBATCH_MAX];      /* a buffer for each message */
+  struct sockaddr_storage addrs[IOBATCH_MAX]; /* source or destination addresses */
+  int socks[IOBATCH_MAX];	       /* sockets to send from (send queue) */
+  struct evsrc *srcs[IOBATCH_MAX];     /* event sources of the sockets (send queue) */
+  uint8_t ctrls[IOBATCH_MAX][CMSG_SPACE(sizeof(int))]; /* UDP_GRO or UDP_SEGMENT */
+  struct mmsghdr gmsgs[IOBATCH_MAX];   /* messages grouped for UDP_SEGMENT (send queue) */
+  uint32_t gfirst[IOBATCH_MAX];	       /* first queued message of the group */
+  uint32_t gsegs[IOBATCH_MAX];	       /* number of queued messages of the group */
+  uint8_t *bufs;		       /* buffers */
+  uint32_t n;			       /* number of queued messages (send queue) */
+#ifdef HAVE_AF_XDP
+  struct xsk *xsks[IOBATCH_MAX];       /* owner of the frame as the buffer, or NULL (send queue) */
+  uint64_t frames[IOBATCH_MAX];	       /* frames of UMEM */
+  struct xskroute routes[IOBATCH_MAX]; /* to send by AF_XDP, or xsk is NULL */
+#endif
+};
+
+/* counters of the worker, written only by the worker */
+struct iostats {
+  uint64_t rxpkts;		       /* received packets */
+  uint64_t rxcalls;		       /* calls of recvmmsg() */
+  uint64_t txpkts;		       /* sent packets */
+  uint64_t txcalls;		       /* calls of sendmmsg() */
+  uint64_t waitcalls;		       /* calls of epoll_wait() or waiting io_uring_enter() */
+  uint64_t sessions;		       /* sessions replied */
+  uint64_t ttfbsum;		       /* time from the request to the first reply (usec) */
+  uint64_t ttfbmax;
+  uint64_t poolhits;		       /* sessions with a socket of the pool */
+  uint64_t txeagain;		       /* sending failed by the full socket buffer */
+  uint64_t txqueued;		       /* messages waiting for sockets to be writable */
+  uint64_t txqmax;		       /* most waiting messages */
+  uint64_t txqdrops;		       /* messages dropped by the full queue */
+};
+
+/* worker, each has own server sockets, epoll and sessions */
+struct worker {
+  IWTFTP *ins;			       /* iwtftp object */
+  int32_t id;			       /* worker number */
+  pthread_t thread;		       /* thread of the worker */
+  int32_t fthread;		       /* flag of whether the thread is running */
+  int32_t status;		       /* result of the event loop */
+  int svsocks[SVSOCKS_MAX];	       /* sever sockets (IPv4/IPv6), with SO_REUSEPORT */
+  struct evsrc svsrcs[SVSOCKS_MAX];    /* event sources of the server sockets */
+  struct sockpool pools[SVSOCKS_MAX];  /* session sockets for each server socket */
+  uint16_t nextport;		       /* next port of session sockets to be tried */
+  int64_t lastrx;		       /* time of the last received packet, for busy polling (msec) */
+  int32_t cpu;			       /* CPU of the pinned worker, or -1 */
+  int32_t node;			       /* NUMA node of the CPU, or -1 */
+  const struct evbackend *evb;	       /* event backend */
+  int epollfd;			       /* epoll instance */
+  int evfd;			       /* eventfd to wake up at exiting */
+  struct evsrc wakesrc;		       /* event source of the eventfd */
+  struct epoll_event *events;	       /* array of the ready events */
+  int32_t maxevents;		       /* size of the event array */
+  int32_t nregevents;		       /* number of registered fds */
+#ifdef HAVE_IO_URING
+  struct uring ring;		       /* io_uring instance */
+  struct urbufs urbufs[URBUF_GROUPS];  /* buffers for receiving, by size */
+  struct msghdr urmsg;		       /* sizes of address and control for receiving */
+  struct __kernel_timespec urts;       /* time of the timeout request */
+  int64_t urdeadline;		       /* expiration of the timeout request (msec), or -1 */
+  uint16_t urtxseq;		       /* number of the flush, in the sendmsg requests */
+#endif
   IWDS *ads;			       /* pointer to iwds module */
   struct session *seshead;	       /* head of the session list */
+  struct session *zombies;	       /* deleted sessions, until the requests are canceled (io_uring) */
+  struct session **sestable;	       /* hash index of the sessions by client address */
+  uint32_t sestablesize;	       /* number of buckets, power of 2 */
+  uint32_t nsessions;		       /* number of sessions */
+  struct timerwheel timers;	       /* timers of the sessions */
+  struct iobatch rx;		       /* receiving batch */
+  struct iobatch tx;		       /* send queue */
+  int32_t fgso;			       /* flag of sending windows by UDP_SEGMENT */
+  int32_t fgro;			       /* flag of receiving DATA by UDP_GRO */
+  struct iostats stats;		       /* statistics */
 };
 
 /* TFTP modes */
@@ -91,27 +368,64 @@ enum TFTP_MODE {
 struct session {
   struct session *next;
   struct session *prev;
+  struct session *hnext;	       /* next in the bucket of the session index */
+  uint32_t hkey;		       /* hash of the client address */
+  struct evsrc evsrc;		       /* event source of the client socket */
   char clip[IPADDRLEN_MAX];	       /* client IP address  */
   uint16_t clport;		       /* client port number */
-  int clsock;			       /* client socket */
+  int clsock;			       /* client socket, or -1 on the AF_XDP path */
+  struct sockpool *pool;	       /* pool to give back the socket, or NULL */
+  int32_t fshared;		       /* flag of whether the socket is shared with other sessions */
+  struct evsrc *sendsrc;	       /* event source of the socket to send from, or NULL */
+  int64_t reqstamp;		       /* time of the request until the first reply (usec), or 0 */
+  IWDSFILE *dsfile;		       /* file on the datastore, or NULL */
+  struct xskroute route;	       /* route of the AF_XDP path, or xsk is NULL */
   int32_t regevent;	               /* flag of whether epoll event is registered */
+  struct sockaddr_storage claddr;      /* client address */
+  socklen_t claddrlen;		       /* length of client address */
+  uint16_t reqop;		       /* opcode of the request (RRQ or WRQ) */
   enum TFTP_MODE tftpmode;	       /* TFTP transfer mode */
   struct datastorage *sesbuf;	       /* data buffer of this session */
   char filename[TFTP_FILENAME_MAX];    /* requested file */
   uint16_t blknum;		       /* last block number */
+  uint16_t ackblk;		       /* last acknowledged block number (RRQ) */
+  size_t blksize;		       /* negotiated block size */
+  size_t maxblksize;		       /* largest block size of the path */
+  uint16_t windowsize;		       /* negotiated window size (RRQ) */
+  struct blkpos *winpos;	       /* positions of blocks in the window (RRQ) */
+  off_t tsize;			       /* transfer size, of the file (RRQ) or told by the client (WRQ) */
+  uint32_t optflags;		       /* options to be acknowledged by OACK */
+  int32_t foack;		       /* flag of waiting for the reply to OACK */
+  int32_t feot;			       /* flag of whether the last DATA is made (RRQ) */
   int32_t fin;		               /* flag of whether transfer is finished */
-  uint8_t lastmsg[TFTP_MSGLEN_MAX];    /* last message */
+  uint8_t lastmsg[TFTP_MSGLEN_MAX];    /* last ACK or OACK message */
   size_t lastmsglen;		       /* length of last message */
-  time_t lastsending;		       /* time of last sending */
+  int64_t lastsending;		       /* time of last sending (msec, monotonic) */
+  int32_t timeout;		       /* retransmission timeout, with backoff (msec) */
+  uint32_t reqtimeout;		       /* timeout (sec) or utimeout (usec) requested, echoed by OACK */
+  int64_t srtt;			       /* smoothed round-trip time (usec) */
+  int64_t rttvar;		       /* round-trip time variation (usec) */
+  int64_t rttstamp;		       /* time of sending the ACK or OACK being timed (usec) */
+  uint16_t nresent;		       /* blocks sent before beyond the acknowledged block (RRQ) */
+  struct twtimer timer;		       /* timer of resending or closing */
   int32_t retrycount;		       /* count of resending */
   int32_t disabled;		       /* flag of session discard */
 };
 
+/* position of a block in the file (RRQ) */
+struct blkpos {
+  off_t offset;			       /* offset of the file */
+  int32_t fopt;			       /* flag of option of the session buffer */
+  int64_t sent;			       /* time of making the block (usec) */
+  int32_t fresent;		       /* flag of whether the block is sent again */
+};
+
 /* data storage for the session */
 struct datastorage {
   uint8_t *pos;			       /* position indicator of the data buffer */
   int32_t fopt;			       /* flag of option */
   size_t datalen;		       /* length of data */
+  off_t fileoff;		       /* offset of the file at the end of the data */
   uint8_t storage[SESSION_BUFSIZE];    /* storage area of data */
 };
 
@@ -121,13 +435,28 @@ struct ifinet {
   char ipv6addr[IPV6_ADDR_SIZE];       /* xxxx:xxxx:xxxx:xxxx:xxxx:xxxx:xxxx:xxxx%eth0 */
 };
 
+/* address of a received packet, formatted into text only for logging */
+struct peer {
+  const struct sockaddr *addr;	       /* address of the sender */
+  socklen_t addrlen;		       /* length of the address */
+  char ip[IPADDRLEN_MAX];	       /* IP address text, empty until used */
+  const struct xskroute *route;	       /* route of the packet of the XDP device, or NULL */
+};
+
 /* information for sending */
 struct sendinfo {
   struct session *ses;		       /* pointer to the session */
-  uint8_t msgbuf[TFTP_MSGLEN_MAX];     /* message buffer */
+  uint8_t *msgbuf;		       /* message buffer, a slot of the send queue */
+  size_t bufsize;		       /* size of message buffer */
   ssize_t msglen;		       /* length of message */
 };
 
+
+/* counters read by other threads for logging */
+#define STAT_ADD(c, v) __atomic_store_n(&(c), (c) + (v), __ATOMIC_RELAXED)
+#define STAT_SET(c, v) __atomic_store_n(&(c), (v), __ATOMIC_RELAXED)
+#define STAT_GET(c) __atomic_load_n(&(c), __ATOMIC_RELAXED)
+
 /* flag for logging */
 extern int32_t g_iw_logready;
 
@@ -138,7 +467,8 @@ enum TFTP_OPCODE {
   OP_WRQ = 2,
   OP_DATA = 3,
   OP_ACK = 4,
-  OP_ERROR = 5
+  OP_ERROR = 5,
+  OP_OACK = 6
 };
 
 /* TFTP error codes */
@@ -150,7 +480,14 @@ enum TFTP_ERRORCODE {
   TFTP_ERR_ILLEGALOPE,
   TFTP_ERR_UNKNOWNID,
   TFTP_ERR_FILEEXIST,
-  TFTP_ERR_NOUSER
+  TFTP_ERR_NOUSER,
+  TFTP_ERR_BADOPT
+};
+
+/* TFTP option */
+struct tftpopt {
+  char *name;
+  char *value;
 };
 
 /* TFTP request format */
@@ -158,6 +495,8 @@ struct tftpreq {
   uint16_t *opcode;
   char *filename;
   char *mode;
+  struct tftpopt opts[TFTP_OPTS_MAX];
+  int32_t nopts;
 };
 
 /* TFTP DATA format */
@@ -187,6 +526,8 @@ enum T_STATCODE {
   E_DS_FAIL_READ = 1,
   E_DS_FAIL_WRITE,
   E_DS_FAIL_CLOSE,
+  E_DS_FAIL_OPEN,
+  E_DS_FAIL_CREATE,
   E_EVENT_NOTEXIST,
   E_FAIL_ADDRCONVERT,
   E_FAIL_CREATE_SOCKET,
@@ -199,10 +540,12 @@ enum T_STATCODE {
   E_FAIL_RESEND,
   E_FAIL_SAVEFILE,
   E_FAIL_TFTP_PROC,
-  E_FAIL_UPDATE_EVENT,
   E_IF_NOADDR,
   E_IF_NOTFOUND,
   E_SERVER_ERR,       
+  E_WORKER_STOPPED,
+  E_FAIL_XDP,
+  E_XDP_UNSUPPORTED,
   /* info */
   I_FILE_EXIST,
   I_FILE_NOTFOUND,
@@ -216,6 +559,19 @@ enum T_STATCODE {
   I_TFTPREQ_INCORRECT,
   I_TFTPREQ_PUT,
   I_TFTPTRANS_FIN,      
+  I_START_WORKERS,
+  I_STATS_WORKER,
+  I_STATS_TOTAL,
+  I_STATS_SESSIONS,
+  I_STATS_TXQUEUE,
+  I_STATS_DATASTORE,
+  I_UDP_OFFLOAD,
+  I_EVENT_BACKEND,
+  I_XDP_PATH,
+  I_BUSY_POLL,
+  I_AFFINITY,
+  I_STEERING,
+  I_UPLOAD_TOOLARGE,
 };
 
 enum T_STATCODE_VERBOSE {
@@ -224,23 +580,32 @@ enum T_STATCODE_VERBOSE {
   EV_ERRMSG_TOOLONG,
   EV_FAIL_ADD_NEWSESSION,
   EV_FAIL_BIND,
+  EV_FAIL_CONNECT,
   EV_FAIL_CREATE_SESSION,
   EV_FAIL_EPOLL_CREATE,
   EV_FAIL_EPOLL_CTL,
   EV_FAIL_EPOLL_WAIT,
+  EV_FAIL_EVENTFD,
   EV_FAIL_GETADDRINFO,
   EV_FAIL_GETIFADDRS,
   EV_FAIL_GETNAMEINFO,
   EV_FAIL_GETSOCKNAME,
   EV_FAIL_INET_NTOP,
-  EV_FAIL_RECVFROM,
-  EV_FAIL_SENDTO,
+  EV_FAIL_PTHREAD_CREATE,
+  EV_FAIL_RECVMMSG,
+  EV_FAIL_SCHED_SETAFFINITY,
+  EV_FAIL_SENDMMSG,
   EV_FAIL_SETSOCKOPT,
   EV_FAIL_SOCKET,
+  EV_FAIL_URING,
+  EV_FAIL_WRITE_EVENTFD,
+  EV_FAIL_XSK_SEND,
+  EV_XDP_NOPORT,
+  EV_GSO_DISABLED,
   EV_NULL_OBJ,
-  EV_SESSION_NOTFOUND,  
   EV_FAIL_GET_SESBUF,
   EV_FAIL_PUT_SESBUF,
+  EV_FAIL_MAKEOACK,
   /* info verbose */
   IV_ACK_INCORRECT,
   IV_DATA_INCORRECT,
@@ -249,6 +614,9 @@ enum T_STATCODE_VERBOSE {
   IV_FILENAME_INCORRECT,
   IV_MODE_INCORRECT,
   IV_OPCODE_INCORRECT,
+  IV_OPTION_INCORRECT,
+  IV_OPTION_IGNORED,
+  IV_OPTION_REJECTED,
   IV_REQLEN_TOOSHORT,
   IV_UNKNOWN_MSG,        
 #ifdef DEBUG
@@ -256,7 +624,7 @@ enum T_STATCODE_VERBOSE {
   DBG_ADD_INITEVENT,
   DBG_ADD_SESSION,
   DBG_CHECK_FILE,
-  DBG_CLEANUP_SESSION,
+  DBG_EXPIRE_SESSION,
   DBG_CLOSE_DATA,
   DBG_CREATE_SOCKET,
   DBG_DEL_ALLSESSION,
@@ -266,15 +634,19 @@ enum T_STATCODE_VERBOSE {
   DBG_DS_LOAD,
   DBG_DS_REQ,
   DBG_DS_SAVE,
+  DBG_DS_REWIND,
+  DBG_DS_CREATE,
   DBG_DS_SETREQ,
   DBG_MAKE_TFTPACK,
   DBG_MAKE_TFTPDATA,
   DBG_MAKE_TFTPERROR,
+  DBG_MAKE_TFTPOACK,
   DBG_OPCODE,
   DBG_PARSE_TFTPACK,
   DBG_PARSE_TFTPDATA,
   DBG_PARSE_TFTPERROR,
   DBG_PARSE_TFTPREQ,
+  DBG_SET_OPTION,
   DBG_PREPARE_RESEND,
   DBG_RECV,
   DBG_REMAIN_SESSION,
@@ -282,6 +654,7 @@ enum T_STATCODE_VERBOSE {
   DBG_RETRIEVE_SESSION,
   DBG_SEND,
   DBG_SENDINFO,
+  DBG_SEND_WINDOW,
   DBG_SEND_SESSION,
   DBG_SESSION_ALL,
   DBG_SESSION_EMPTY,
@@ -294,10 +667,12 @@ enum T_STATCODE_VERBOSE {
   DBG_TFTPACK,
   DBG_TFTPDATA,
   DBG_TFTPERROR,
+  DBG_TFTPOACK,
+  DBG_TFTPOPT,
   DBG_TFTPREQ,
   DBG_TFTP_PROC,
-  DBG_UPDATE_EVENT,
   DBG_UPDATE_RETRY,
+  DBG_UPDATE_RTT,
   DBG_GET_SESBUF_DATA,
   DBG_PUT_SESBUF_DATA,
   DBG_SESBUF_IOLEN,
@@ -311,24 +686,99 @@ enum T_STATCODE_VERBOSE {
 /* function prototypes */
 static void pmsg(int32_t statcode, ...);
 static int32_t get_ifaddress(const char *ifname, struct ifinet *iaddr);
-static int create_socket(int family, const char *ip, const char *service);
-static int32_t update_event(int epollfd, struct session *head);
-static int32_t tftp_proc(IWTFTP *ins, int sock, const char *clip, uint16_t clport,
+static void *worker_thread(void *arg);
+static int32_t service_worker(struct worker *wk);
+static void handle_packet(struct worker *wk, struct evsrc *src, struct peer *pr, void *rbuf, size_t rlen);
+static int32_t init_iobatch(struct iobatch *b, size_t bufsize, int32_t fctrl);
+static uint8_t *get_txbuf(struct worker *wk, struct xsk *xs, size_t *bufsize);
+static void put_txbuf(struct worker *wk, struct evsrc *src, size_t len, const struct sockaddr *to, socklen_t tolen,
+		      const struct xskroute *rt);
+static void flush_tx(struct worker *wk);
+static void send_plain(struct worker *wk, struct evsrc *src, uint32_t first, uint32_t n);
+static void queue_msg(struct worker *wk, struct evsrc *src, struct msghdr *mh, uint32_t nsegs);
+static void drain_outq(struct worker *wk, struct evsrc *src);
+static void free_outq(struct worker *wk, struct evsrc *src);
+static void send_failed(int sock, struct mmsghdr *msg);
+static int get_gro_size(struct msghdr *mh);
+static void probe_udp_offload(int32_t *fgso, int32_t *fgro);
+static void show_stats(IWTFTP *ins);
+static void handle_segments(struct worker *wk, struct evsrc *src, struct peer *pr,
+			    uint8_t *rbuf, size_t rlen, int seglen);
+static int32_t init_epoll(struct worker *wk);
+static void exit_epoll(struct worker *wk);
+static int32_t add_epoll(struct worker *wk, struct evsrc *src, const char *ip, uint16_t port);
+static void del_epoll(struct worker *wk, struct evsrc *src, const char *ip, uint16_t port);
+static void wait_epoll(struct worker *wk, int32_t timeout);
+static void send_epoll(struct worker *wk, struct evsrc *src, uint32_t first, uint32_t ngrps);
+static void watch_epoll(struct worker *wk, struct evsrc *src, int32_t fout);
+#ifdef HAVE_IO_URING
+static int32_t probe_uring(void);
+static int32_t init_uring(struct worker *wk);
+static void exit_uring(struct worker *wk);
+static int32_t add_uring(struct worker *wk, struct evsrc *src, const char *ip, uint16_t port);
+static void del_uring(struct worker *wk, struct evsrc *src, const char *ip, uint16_t port);
+static void wait_uring(struct worker *wk, int32_t timeout);
+static void send_uring(struct worker *wk, struct evsrc *src, uint32_t first, uint32_t ngrps);
+static void submit_uring(struct worker *wk);
+static void watch_uring(struct worker *wk, struct evsrc *src, int32_t fout);
+static struct io_uring_sqe *get_sqe(struct worker *wk);
+static int32_t arm_recv(struct worker *wk, struct evsrc *src);
+static void recv_uring(struct worker *wk, struct evsrc *src, int32_t res, uint32_t flags);
+static void set_uring_timeout(struct worker *wk, int32_t timeout);
+static void free_zombie(struct worker *wk, struct session *ses);
+#endif
+#ifdef HAVE_AF_XDP
+static void exit_xdp(IWTFTP *ins);
+static void recv_xdp(struct worker *wk, struct evsrc *src);
+static void send_xdp(struct worker *wk, uint32_t first, uint32_t end);
+static uint32_t csum_add(uint32_t sum, const void *data, size_t len);
+static uint16_t csum_fold(uint32_t sum);
+static uint16_t alloc_sesport(struct xdppath *xp);
+static void free_sesport(struct xdppath *xp, uint16_t port);
+#endif
+static int create_socket(int family, const char *ip, const char *service, int32_t freuseport);
+static int32_t attach_steering(int sock, int32_t nsocks);
+static void init_sockpool(struct worker *wk);
+static void fill_sockpool(struct worker *wk, struct sockpool *sp);
+static void init_shared(struct worker *wk, struct sockpool *sp);
+static void set_busypoll(int sock);
+static void set_affinity(struct worker *wk);
+static void exit_sockpool(struct worker *wk);
+static int bind_sessock(struct worker *wk, struct sockpool *sp);
+static int get_sessock(struct worker *wk, int svsock, struct session *ses);
+static int32_t is_connected(const struct session *ses);
+static void put_sessock(struct worker *wk, struct session *ses);
+static int32_t add_event(struct worker *wk, struct evsrc *src, const char *ip, uint16_t port);
+static void del_event(struct worker *wk, struct evsrc *src, const char *ip, uint16_t port);
+static const char *peer_ip(struct peer *pr);
+static uint16_t peer_port(const struct peer *pr);
+static uint16_t sockaddr_port(const struct sockaddr *sa);
+static int32_t format_sockaddr(const struct sockaddr *sa, char *buf, size_t bufsize);
+static uint32_t hash_sockaddr(const struct sockaddr *sa);
+static int32_t is_same_sockaddr(const struct sockaddr *a, const struct sockaddr *b);
+static int32_t tftp_proc(struct worker *wk, struct evsrc *src, struct peer *pr,
 			 void *dbuf, size_t dlen, struct sendinfo *sinfo);
-static int32_t resend_allsession(struct session *head, IWDS *ads);
-static struct session *add_newsession(struct session **phead, int svsock, const char *clip, uint16_t clport,
+static void expire_session(struct worker *wk);
+static void set_session_timer(struct timerwheel *tw, struct session *clses);
+static int32_t resend_session(struct worker *wk, struct session *clses);
+static void update_rtt(struct session *clses, int64_t rtt);
+static void send_window(struct worker *wk, struct session *clses);
+static struct session *add_newsession(struct worker *wk, int svsock, struct peer *pr,
 				      const char *file, const char *mode);
 static struct session *create_session(struct session **phead);
-static struct session *get_session(struct session *head, const char *clip, uint16_t clport);
-static void del_session(struct session **phead, const char *clip, uint16_t clport);
+static struct session *get_session(struct worker *wk, const struct sockaddr *addr);
+static void index_session(struct worker *wk, struct session *ses);
+static void unindex_session(struct worker *wk, struct session *ses);
+static void del_session(struct worker *wk, struct session *ses);
 static void del_allsession(struct session **phead);
-static void cleanup_session(struct session **phead);
+static int32_t set_session_option(struct session *clses, IWDS *ads, struct tftpreq *req);
 static int32_t parse_tftpreq(struct tftpreq *req, void *msg, size_t msglen);
-static int32_t parse_tftpdata(struct tftpdata *dat, void *msg, size_t msglen);
+static int32_t parse_tftpdata(struct tftpdata *dat, void *msg, size_t msglen, size_t blksize);
 static int32_t parse_tftpack(struct tftpack *ack, void *msg, size_t msglen);
 static int32_t parse_tftperror(struct tftperror *terr, void *msg, size_t msglen);
 static ssize_t make_tftpdata_msg(struct session *clses, IWDS *ads, void *emptybuf, size_t bufsize);
 static ssize_t make_tftpack_msg(struct session *clses, uint16_t blk, void *emptybuf, size_t bufsize);
+static ssize_t make_tftpoack_msg(struct session *clses, void *emptybuf, size_t bufsize);
 static ssize_t make_tftperr_msg(uint16_t ecode, void *emptybuf, size_t bufsize,
 				const char *emsg, size_t emsglen);
 static ssize_t get_session_data(struct session *clses, IWDS *ads, void *dstbuf, size_t dstbufsize);
@@ -336,8 +786,11 @@ static ssize_t put_session_data(struct session *clses, IWDS *ads, void *data, si
 static size_t netascii_to_local(struct datastorage *sb, void *srcdata, size_t srclen);
 static size_t local_to_netascii(void *dstbuf, size_t bufsize, struct datastorage *sb);
 static int32_t load_data(struct session *clses, IWDS *ads);
+static int32_t create_data(struct session *clses, IWDS *ads);
+static void rewind_data(struct session *clses, uint16_t nacked);
 static int32_t save_data(struct session *clses, IWDS *ads);
 static void close_data(struct session *clses, IWDS *ads);
+static void discard_data(struct session *clses, IWDS *ads);
 
 
 /* for debugging */
@@ -348,15 +801,17 @@ static void close_data(struct session *clses, IWDS *ads);
 #define DBG_SH_DELEVENT(ip, port) pmsg(DBG_DEL_EVENT, ip, port)
 #define DBG_SH_DSALLDSESSION(ds) dbg_ds_show_alldsession(ds)
 #define DBG_SH_DSIOLEN(len) pmsg(DBG_DS_IOLEN, len)
-#define DBG_SH_DSREQ(req) pmsg(DBG_DS_REQ, req.dsid, req.dfile, req.dbuf ? "***" : "null", req.dlen, req.derr)
+#define DBG_SH_DSREQ(req) pmsg(DBG_DS_REQ, req.dfile, req.dbuf ? "***" : "null", req.dlen, (long)req.doff, req.derr)
 #define DBG_SH_OPCODE(c) dbg_show_opcode(c)
 #define DBG_SH_QUERY(ip, port) pmsg(DBG_RETRIEVE_SESSION, ip, port)
 #define DBG_SH_RECV(len, so, ip, po) pmsg(DBG_RECV, len, so, ip, po)
+#define DBG_SH_RTT(r, s) pmsg(DBG_UPDATE_RTT, (long)r, (long)s->srtt, (long)s->rttvar, s->timeout)
 #define DBG_SH_SEND(len, so, ip, po) pmsg(DBG_SEND, len, so, ip, po)
 #define DBG_SH_SENDINFO(ss, len) pmsg(DBG_SENDINFO, ss, len)
 #define DBG_SH_SESSION(ses) dbg_show_session(ses)
 #define DBG_SH_SOCKET(so, ip, sv) pmsg(DBG_SOCKET, so, ip, sv)
 #define DBG_SH_TFTPMSG(sw, m, len) dbg_show_tftpmsg(sw, m, len)
+#define DBG_SH_TFTPOPT(n, v) pmsg(DBG_TFTPOPT, n, v)
 #define DBG_SH_SESBUF_IOLEN(len) pmsg(DBG_SESBUF_IOLEN, len)
 #define DBG_SH_SESBUF(mode, len) pmsg(DBG_SESBUF, mode, len)
 
@@ -376,11 +831,13 @@ static void dbg_show_tftpmsg(int32_t sw, void *ptr, size_t msglen);
 #define DBG_SH_OPCODE(c)
 #define DBG_SH_QUERY(ip, port)
 #define DBG_SH_RECV(so, ip, po, len)
+#define DBG_SH_RTT(r, s)
 #define DBG_SH_SEND(so, ip, po, len)
 #define DBG_SH_SENDINFO(ss, len)
 #define DBG_SH_SESSION(ses)
 #define DBG_SH_SOCKET(so, ip, sv)
 #define DBG_SH_TFTPMSG(sw, m, len)
+#define DBG_SH_TFTPOPT(n, v)
 #define DBG_SH_SESBUF_IOLEN(len)
 #define DBG_SH_SESBUF(mode, len)
 
@@ -0,0 +1,258 @@
+/*
+ * timerwheel.c
+ *
+ * Copyright (c) 2012, Daisuke Sato <bigsplint@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timerwheel.h"
+
+/* function prototypes */
+static void place_timer(struct timerwheel *tw, struct twtimer *tm);
+static void unlink_timer(struct timerwheel *tw, struct twtimer *tm);
+static int64_t next_event(struct timerwheel *tw);
+static struct twtimer *run_tick(struct timerwheel *tw, struct twtimer *expired);
+
+
+/* To initialize the wheel, starting from now (msec). */
+extern void
+tw_init(struct timerwheel *tw, int64_t now)
+{
+  memset(tw, 0, sizeof(struct timerwheel));
+  tw->curtick = now;
+}
+
+
+/* To initialize the timer, not armed. */
+extern void
+tw_init_timer(struct twtimer *tm, void *data)
+{
+  memset(tm, 0, sizeof(struct twtimer));
+  tm->level = -1;
+  tm->data = data;
+}
+
+
+/* To arm the timer at expire (msec), rearming if already armed. */
+extern void
+tw_add(struct timerwheel *tw, struct twtimer *tm, int64_t expire)
+{
+  if (tm->level >= 0) {
+    unlink_timer(tw, tm);
+  }
+  tm->expire = expire;
+  place_timer(tw, tm);
+}
+
+
+/* To disarm the timer. */
+extern void
+tw_del(struct timerwheel *tw, struct twtimer *tm)
+{
+  if (tm->level >= 0) {
+    unlink_timer(tw, tm);
+  }
+}
+
+
+/* To advance the wheel until now.
+ * return: list of expired timers linked by next, they are disarmed
+ */
+extern struct twtimer *
+tw_expire(struct timerwheel *tw, int64_t now)
+{
+  struct twtimer *expired = NULL;
+  int64_t t;
+
+  while (tw->curtick <= now) {
+    /* skip the ticks having nothing to do */
+    if ((t = next_event(tw)) == -1 || t > now) {
+      tw->curtick = now + 1;
+      break;
+    }
+    tw->curtick = t;
+    expired = run_tick(tw, expired);
+    tw->curtick = t + 1;
+  }
+
+  return expired;
+}
+
+
+/* To get the time until the next timer.
+ * return: milliseconds, or -1 if no timer is armed
+ */
+extern int32_t
+tw_next_timeout(struct timerwheel *tw, int64_t now)
+{
+  int64_t t;
+
+  if ((t = next_event(tw)) == -1) {
+    return -1;
+  }
+  if (t <= now) {
+    return 0;
+  }
+  return t - now < INT32_MAX ? (int32_t)(t - now) : INT32_MAX;
+}
+
+
+/* The timer goes to the lowest level covering the distance. On the
+ * higher levels, the slot is cascaded down when the lower bits of the
+ * current tick become zero at the index of the slot.
+ */
+static void
+place_timer(struct timerwheel *tw, struct twtimer *tm)
+{
+  int64_t expire;
+  int64_t delta;
+  int32_t lv;
+
+  expire = tm->expire;
+  delta = expire - tw->curtick;
+  if (delta < 0) {
+    expire = tw->curtick;
+    delta = 0;
+  }
+  else if (delta >= TW_RANGE_MAX) {
+    expire = tw->curtick + TW_RANGE_MAX - 1;
+    delta = TW_RANGE_MAX - 1;
+  }
+
+  for (lv = 0; lv < TW_LEVELS - 1; lv++) {
+    if (delta < (int64_t)1 << (TW_SLOT_BITS * (lv + 1))) {
+      break;
+    }
+  }
+
+  tm->level = lv;
+  tm->slot = (expire >> (TW_SLOT_BITS * lv)) & TW_SLOT_MASK;
+  tm->prev = NULL;
+  tm->next = tw->slots[lv][tm->slot];
+  if (tm->next) {
+    tm->next->prev = tm;
+  }
+  tw->slots[lv][tm->slot] = tm;
+  tw->bitmap[lv] |= (uint64_t)1 << tm->slot;
+}
+
+
+static void
+unlink_timer(struct timerwheel *tw, struct twtimer *tm)
+{
+  if (tm->prev) {
+    tm->prev->next = tm->next;
+  }
+  else {
+    tw->slots[tm->level][tm->slot] = tm->next;
+  }
+  if (tm->next) {
+    tm->next->prev = tm->prev;
+  }
+
+  if (! tw->slots[tm->level][tm->slot]) {
+    tw->bitmap[tm->level] &= ~((uint64_t)1 << tm->slot);
+  }
+
+  tm->next = tm->prev = NULL;
+  tm->level = -1;
+}
+
+
+/* the earliest tick having timers to be expired or cascaded, or -1 if empty */
+static int64_t
+next_event(struct timerwheel *tw)
+{
+  uint64_t rot;
+  int64_t unit;
+  int64_t base;
+  int64_t t;
+  int64_t next = -1;
+  int32_t pos;
+  int32_t lv;
+
+  for (lv = 0; lv < TW_LEVELS; lv++) {
+    if (! tw->bitmap[lv]) {
+      continue;
+    }
+
+    /* the first tick of the slot at or after the current tick */
+    unit = (int64_t)1 << (TW_SLOT_BITS * lv);
+    base = (tw->curtick + unit - 1) & ~(unit - 1);
+    pos = (base >> (TW_SLOT_BITS * lv)) & TW_SLOT_MASK;
+
+    rot = pos ? (tw->bitmap[lv] >> pos) | (tw->bitmap[lv] << (TW_SLOTS - pos)) : tw->bitmap[lv];
+    t = base + (int64_t)__builtin_ctzll(rot) * unit;
+
+    if (next == -1 || t < next) {
+      next = t;
+    }
+  }
+
+  return next;
+}
+
+
+/* cascade the higher levels and expire the timers of the current tick */
+static struct twtimer *
+run_tick(struct timerwheel *tw, struct twtimer *expired)
+{
+  struct twtimer *tm;
+  struct twtimer *next;
+  int32_t slot;
+  int32_t lv;
+
+  for (lv = 1; lv < TW_LEVELS; lv++) {
+    if (tw->curtick & (((int64_t)1 << (TW_SLOT_BITS * lv)) - 1)) {
+      break;
+    }
+    slot = (tw->curtick >> (TW_SLOT_BITS * lv)) & TW_SLOT_MASK;
+
+    tm = tw->slots[lv][slot];
+    tw->slots[lv][slot] = NULL;
+    tw->bitmap[lv] &= ~((uint64_t)1 << slot);
+
+    for (; tm; tm = next) {
+      next = tm->next;
+      place_timer(tw, tm);
+    }
+  }
+
+  slot = tw->curtick & TW_SLOT_MASK;
+  tm = tw->slots[0][slot];
+  tw->slots[0][slot] = NULL;
+  tw->bitmap[0] &= ~((uint64_t)1 << slot);
+
+  for (; tm; tm = next) {
+    next = tm->next;
+    tm->level = -1;
+    tm->prev = NULL;
+    tm->next = expired;
+    expired = tm;
+  }
+
+  return expired;
+}
@@ -0,0 +1,67 @@
+/*
+ * timerwheel.h
+ *
+ * Copyright (c) 2012, Daisuke Sato <bigsplint@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TIMERWHEEL_H_
+#define _TIMERWHEEL_H_
+
+#include <stdint.h>
+
+
+/* constants */
+#define TW_SLOT_BITS 6				/* bits of the slot index */
+#define TW_SLOTS (1 << TW_SLOT_BITS)		/* number of slots per level */
+#define TW_SLOT_MASK (TW_SLOTS - 1)
+#define TW_LEVELS 4				/* number of levels (1 tick = 1 msec, up to 4.6 hours) */
+#define TW_RANGE_MAX ((int64_t)1 << (TW_SLOT_BITS * TW_LEVELS))
+
+
+/* timer */
+struct twtimer {
+  struct twtimer *next;
+  struct twtimer *prev;
+  int64_t expire;		/* expiration time (msec) */
+  int32_t level;		/* level of the wheel, or -1 if not armed */
+  int32_t slot;			/* slot in the level */
+  void *data;			/* owner of the timer */
+};
+
+/* hierarchical timer wheel */
+struct timerwheel {
+  int64_t curtick;			       /* next tick to be processed (msec) */
+  uint64_t bitmap[TW_LEVELS];		       /* slots having timers */
+  struct twtimer *slots[TW_LEVELS][TW_SLOTS];  /* lists of timers */
+};
+
+
+extern void tw_init(struct timerwheel *tw, int64_t now);
+extern void tw_init_timer(struct twtimer *tm, void *data);
+extern void tw_add(struct timerwheel *tw, struct twtimer *tm, int64_t expire);
+extern void tw_del(struct timerwheel *tw, struct twtimer *tm);
+extern struct twtimer *tw_expire(struct timerwheel *tw, int64_t now);
+extern int32_t tw_next_timeout(struct timerwheel *tw, int64_t now);
+
+
+#endif	/* _TIMERWHEEL_H_ */
@@ -0,0 +1,387 @@
+/*
+ * uring.c
+ *
+ * Copyright (c) 2012, Daisuke Sato <bigsplint@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_IO_URING
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "iw_common.h"
+#include "uring.h"
+
+/* the ring is shared with the kernel */
+#define LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+
+/* To set up the rings, with cqentries of completion queue.
+ * return: IW_OK, or IW_ERR with errno
+ */
+extern int32_t
+ur_init(struct uring *ur, uint32_t sqentries, uint32_t cqentries)
+{
+  struct io_uring_params p;
+  uint32_t *sqarray;
+  uint32_t i;
+  int err;
+
+  memset(ur, 0, sizeof(struct uring));
+  ur->sqmap = ur->cqmap = MAP_FAILED;
+  ur->sqes = MAP_FAILED;
+
+  memset(&p, 0, sizeof p);
+  p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL;
+  p.cq_entries = cqentries;
+  if ((ur->fd = syscall(__NR_io_uring_setup, sqentries, &p)) == -1) {
+    return IW_ERR;
+  }
+
+  /* completions are not dropped on overflow of the queue (Linux 5.5) */
+  if (! (p.features & IORING_FEAT_NODROP)) {
+    errno = EOPNOTSUPP;
+    goto err;
+  }
+
+  ur->sqmapsize = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+  ur->cqmapsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ur->cqmapsize > ur->sqmapsize) {
+      ur->sqmapsize = ur->cqmapsize;
+    }
+    ur->cqmapsize = ur->sqmapsize;
+  }
+
+  if ((ur->sqmap = mmap(NULL, ur->sqmapsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ur->fd, IORING_OFF_SQ_RING)) == MAP_FAILED) {
+    goto err;
+  }
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    ur->cqmap = ur->sqmap;
+  }
+  else if ((ur->cqmap = mmap(NULL, ur->cqmapsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			     ur->fd, IORING_OFF_CQ_RING)) == MAP_FAILED) {
+    goto err;
+  }
+  ur->sqesmapsize = p.sq_entries * sizeof(struct io_uring_sqe);
+  if ((ur->sqes = mmap(NULL, ur->sqesmapsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       ur->fd, IORING_OFF_SQES)) == MAP_FAILED) {
+    goto err;
+  }
+
+  ur->sqhead = (uint32_t *)((uint8_t *)ur->sqmap + p.sq_off.head);
+  ur->sqtail = (uint32_t *)((uint8_t *)ur->sqmap + p.sq_off.tail);
+  ur->sqmask = *(uint32_t *)((uint8_t *)ur->sqmap + p.sq_off.ring_mask);
+  ur->sqentries = p.sq_entries;
+  ur->sqlocal = *ur->sqtail;
+  ur->cqhead = (uint32_t *)((uint8_t *)ur->cqmap + p.cq_off.head);
+  ur->cqtail = (uint32_t *)((uint8_t *)ur->cqmap + p.cq_off.tail);
+  ur->cqmask = *(uint32_t *)((uint8_t *)ur->cqmap + p.cq_off.ring_mask);
+  ur->cqes = (struct io_uring_cqe *)((uint8_t *)ur->cqmap + p.cq_off.cqes);
+
+  /* the entries are used in order, so the index array is fixed */
+  sqarray = (uint32_t *)((uint8_t *)ur->sqmap + p.sq_off.array);
+  for (i = 0; i < p.sq_entries; i++) {
+    sqarray[i] = i;
+  }
+
+  return IW_OK;
+
+ err:
+  err = errno;
+  ur_exit(ur);
+  errno = err;
+  return IW_ERR;
+}
+
+
+/* To tear down the rings, the kernel cancels all requests. */
+extern void
+ur_exit(struct uring *ur)
+{
+  if (ur->sqes != MAP_FAILED) {
+    munmap(ur->sqes, ur->sqesmapsize);
+  }
+  if (ur->cqmap != MAP_FAILED && ur->cqmap != ur->sqmap) {
+    munmap(ur->cqmap, ur->cqmapsize);
+  }
+  if (ur->sqmap != MAP_FAILED) {
+    munmap(ur->sqmap, ur->sqmapsize);
+  }
+  ur->sqmap = ur->cqmap = MAP_FAILED;
+  ur->sqes = MAP_FAILED;
+
+  if (ur->fd >= 0) {
+    close(ur->fd);
+  }
+  ur->fd = -1;
+}
+
+
+/* To get a cleared entry of the submission queue.
+ * return: the entry, or NULL if the queue is full
+ */
+extern struct io_uring_sqe *
+ur_get_sqe(struct uring *ur)
+{
+  struct io_uring_sqe *sqe;
+
+  if (ur->sqlocal - LOAD_ACQUIRE(ur->sqhead) >= ur->sqentries) {
+    return NULL;
+  }
+  sqe = &ur->sqes[ur->sqlocal & ur->sqmask];
+  ur->sqlocal++;
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+  return sqe;
+}
+
+
+/* To submit the prepared entries, and wait for waitnr completions.
+ * return: number of submitted entries, or IW_ERR with errno
+ */
+extern int32_t
+ur_submit(struct uring *ur, uint32_t waitnr)
+{
+  uint32_t nsubmit;
+  int ret;
+
+  STORE_RELEASE(ur->sqtail, ur->sqlocal);
+  nsubmit = ur->sqlocal - LOAD_ACQUIRE(ur->sqhead);
+
+  do {
+    ret = syscall(__NR_io_uring_enter, ur->fd, nsubmit, waitnr, waitnr > 0 ? IORING_ENTER_GETEVENTS : 0,
+		  NULL, 0);
+  } while (ret == -1 && errno == EINTR && waitnr == 0);
+
+  return ret;
+}
+
+
+/* To get the next completion, it stays in the queue until ur_seen_cqe().
+ * return: the completion, or NULL if nothing
+ */
+extern struct io_uring_cqe *
+ur_peek_cqe(struct uring *ur)
+{
+  uint32_t head = *ur->cqhead;
+
+  if (head == LOAD_ACQUIRE(ur->cqtail)) {
+    return NULL;
+  }
+  return &ur->cqes[head & ur->cqmask];
+}
+
+
+/* To look at the n-th completion not seen yet, without releasing it.
+ * return: the completion, or NULL if fewer have arrived
+ */
+extern struct io_uring_cqe *
+ur_peek_cqe_at(struct uring *ur, uint32_t n)
+{
+  uint32_t head = *ur->cqhead;
+
+  if (LOAD_ACQUIRE(ur->cqtail) - head <= n) {
+    return NULL;
+  }
+  return &ur->cqes[(head + n) & ur->cqmask];
+}
+
+
+/* To release the completion from ur_peek_cqe(). */
+extern void
+ur_seen_cqe(struct uring *ur)
+{
+  STORE_RELEASE(ur->cqhead, *ur->cqhead + 1);
+}
+
+
+/* To register nbufs buffers of bufsize as the group bgid (Linux 5.19).
+ * return: IW_OK, or IW_ERR with errno
+ */
+extern int32_t
+ur_init_bufs(struct uring *ur, struct urbufs *ub, uint16_t bgid, uint32_t nbufs, size_t bufsize)
+{
+  struct io_uring_buf_reg reg;
+  size_t ringsize;
+  uint32_t i;
+  int err;
+
+  memset(ub, 0, sizeof(struct urbufs));
+  ub->bgid = bgid;
+  ub->nbufs = nbufs;
+  ub->bufsize = bufsize;
+
+  /* the ring must be aligned to a page */
+  ringsize = nbufs * sizeof(struct io_uring_buf);
+  if ((ub->ring = mmap(NULL, ringsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+		       -1, 0)) == MAP_FAILED) {
+    ub->ring = NULL;
+    return IW_ERR;
+  }
+  if (! (ub->bufs = malloc(nbufs * bufsize))) {
+    errno = ENOMEM;
+    goto err;
+  }
+
+  memset(&reg, 0, sizeof reg);
+  reg.ring_addr = (uint64_t)(uintptr_t)ub->ring;
+  reg.ring_entries = nbufs;
+  reg.bgid = bgid;
+  if (syscall(__NR_io_uring_register, ur->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+    goto err;
+  }
+
+  for (i = 0; i < nbufs; i++) {
+    ur_put_buf(ub, i);
+  }
+
+  return IW_OK;
+
+ err:
+  err = errno;
+  munmap(ub->ring, ringsize);
+  ub->ring = NULL;
+  free(ub->bufs);
+  ub->bufs = NULL;
+  errno = err;
+  return IW_ERR;
+}
+
+
+/* To release the buffers, after the rings are torn down. */
+extern void
+ur_exit_bufs(struct uring *ur, struct urbufs *ub)
+{
+  (void)ur;
+
+  if (ub->ring) {
+    munmap(ub->ring, ub->nbufs * sizeof(struct io_uring_buf));
+    ub->ring = NULL;
+  }
+  free(ub->bufs);
+  ub->bufs = NULL;
+}
+
+
+/* To get the buffer picked by the kernel. */
+extern uint8_t *
+ur_get_buf(struct urbufs *ub, uint16_t bid)
+{
+  return ub->bufs + (size_t)bid * ub->bufsize;
+}
+
+
+/* To give the buffer back to the kernel. */
+extern void
+ur_put_buf(struct urbufs *ub, uint16_t bid)
+{
+  struct io_uring_buf *buf;
+
+  buf = &ub->ring->bufs[ub->tail & (ub->nbufs - 1)];
+  buf->addr = (uint64_t)(uintptr_t)ur_get_buf(ub, bid);
+  buf->len = ub->bufsize;
+  buf->bid = bid;
+  ub->tail++;
+  STORE_RELEASE(&ub->ring->tail, ub->tail);
+}
+
+
+/* To receive datagrams continuously into the buffers of bgid (Linux 6.0).
+ * Each buffer starts with struct io_uring_recvmsg_out, followed by the
+ * name and the control of the sizes in mh, and the payload.
+ */
+extern void
+ur_prep_recvmsg_multishot(struct io_uring_sqe *sqe, int fd, struct msghdr *mh, uint16_t bgid)
+{
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)mh;
+  sqe->len = 1;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = bgid;
+}
+
+
+extern void
+ur_prep_sendmsg(struct io_uring_sqe *sqe, int fd, const struct msghdr *mh, uint32_t flags)
+{
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)mh;
+  sqe->len = 1;
+  sqe->msg_flags = flags;
+}
+
+
+/* one shot */
+extern void
+ur_prep_poll(struct io_uring_sqe *sqe, int fd, uint32_t events)
+{
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = events;
+}
+
+
+/* completes with -ETIME after ts, the kernel copies ts at the submission */
+extern void
+ur_prep_timeout(struct io_uring_sqe *sqe, struct __kernel_timespec *ts)
+{
+  sqe->opcode = IORING_OP_TIMEOUT;
+  sqe->fd = -1;
+  sqe->addr = (uint64_t)(uintptr_t)ts;
+  sqe->len = 1;
+}
+
+
+/* to change the time of the timeout of user_data target (Linux 5.11) */
+extern void
+ur_prep_timeout_update(struct io_uring_sqe *sqe, uint64_t target, struct __kernel_timespec *ts)
+{
+  sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+  sqe->fd = -1;
+  sqe->addr = target;
+  sqe->addr2 = (uint64_t)(uintptr_t)ts;
+  sqe->timeout_flags = IORING_TIMEOUT_UPDATE;
+}
+
+
+/* to cancel the request of user_data target */
+extern void
+ur_prep_cancel(struct io_uring_sqe *sqe, uint64_t target)
+{
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = target;
+}
+
+#endif	/* HAVE_IO_URING */
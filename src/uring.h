@@ -0,0 +1,94 @@
+/*
+ * uring.h
+ *
+ * Copyright (c) 2012, Daisuke Sato <bigsplint@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _URING_H_
+#define _URING_H_
+
+/* Linux 6.0 for receiving by multishot recvmsg, checked by cmake */
+#ifdef HAVE_IO_URING
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+
+/* submission and completion rings of io_uring, set up by raw system calls */
+struct uring {
+  int fd;			/* io_uring instance */
+  /* submission queue */
+  uint32_t *sqhead;		/* consumed by the kernel */
+  uint32_t *sqtail;		/* published to the kernel */
+  uint32_t sqmask;
+  uint32_t sqentries;
+  uint32_t sqlocal;		/* tail of the prepared entries, not published yet */
+  struct io_uring_sqe *sqes;	/* submission queue entries */
+  /* completion queue */
+  uint32_t *cqhead;		/* consumed by the user */
+  uint32_t *cqtail;		/* produced by the kernel */
+  uint32_t cqmask;
+  struct io_uring_cqe *cqes;	/* completion queue entries */
+  /* mappings */
+  void *sqmap;
+  size_t sqmapsize;
+  void *cqmap;
+  size_t cqmapsize;
+  size_t sqesmapsize;
+};
+
+/* ring of buffers provided to the kernel, picked by receiving */
+struct urbufs {
+  struct io_uring_buf_ring *ring;	/* shared with the kernel */
+  uint16_t bgid;			/* buffer group */
+  uint32_t nbufs;			/* number of buffers, power of 2 */
+  size_t bufsize;			/* size of a buffer */
+  uint8_t *bufs;			/* buffers */
+  uint16_t tail;			/* tail of the ring */
+};
+
+
+extern int32_t ur_init(struct uring *ur, uint32_t sqentries, uint32_t cqentries);
+extern void ur_exit(struct uring *ur);
+extern struct io_uring_sqe *ur_get_sqe(struct uring *ur);
+extern int32_t ur_submit(struct uring *ur, uint32_t waitnr);
+extern struct io_uring_cqe *ur_peek_cqe(struct uring *ur);
+extern struct io_uring_cqe *ur_peek_cqe_at(struct uring *ur, uint32_t n);
+extern void ur_seen_cqe(struct uring *ur);
+extern int32_t ur_init_bufs(struct uring *ur, struct urbufs *ub, uint16_t bgid, uint32_t nbufs, size_t bufsize);
+extern void ur_exit_bufs(struct uring *ur, struct urbufs *ub);
+extern uint8_t *ur_get_buf(struct urbufs *ub, uint16_t bid);
+extern void ur_put_buf(struct urbufs *ub, uint16_t bid);
+
+/* preparing the entries */
+extern void ur_prep_recvmsg_multishot(struct io_uring_sqe *sqe, int fd, struct msghdr *mh, uint16_t bgid);
+extern void ur_prep_sendmsg(struct io_uring_sqe *sqe, int fd, const struct msghdr *mh, uint32_t flags);
+extern void ur_prep_poll(struct io_uring_sqe *sqe, int fd, uint32_t events);
+extern void ur_prep_timeout(struct io_uring_sqe *sqe, struct __kernel_timespec *ts);
+extern void ur_prep_timeout_update(struct io_uring_sqe *sqe, uint64_t target, struct __kernel_timespec *ts);
+extern void ur_prep_cancel(struct io_uring_sqe *sqe, uint64_t target);
+
+#endif	/* HAVE_IO_URING */
+
+#endif	/* _URING_H_ */
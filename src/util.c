@@ -28,10 +28,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sched.h>
 
 #include "util.h"
 
 /* constants */
+#define CGROUP_PROCFILE "/proc/self/cgroup"	/* cgroup of the process */
+#define CGROUP_ROOT "/sys/fs/cgroup"		/* mount point of cgroup */
+#define CGROUP_PATHLEN 512			/* maximum length of cgroup path */
 
 
 /* To join head and tail.
@@ -79,3 +86,152 @@ join_path(const char *head, const char *tail, char *buf, size_t bufsize)
   return -1;
 }
 
+
+/* To get the time of monotonic clock.
+ * return: milliseconds, not related to the wall clock
+ */
+extern int64_t
+get_monotonic_msec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/* To get the time of monotonic clock.
+ * return: microseconds, not related to the wall clock
+ */
+extern int64_t
+get_monotonic_usec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+
+/* To get the CPU quota of cgroup v2 or v1.
+ * return: number of CPUs rounded up, or 0 if no limit
+ */
+static int32_t
+get_cgroup_cpus(void)
+{
+  FILE *fp;
+  char line[CGROUP_PATHLEN];
+  char path[CGROUP_PATHLEN];
+  char quota[32];
+  int64_t nquota = -1, nperiod = 0;
+
+  /* cgroup v2, the entry is "0::/path" */
+  path[0] = '\0';
+  if ((fp = fopen(CGROUP_PROCFILE, "r"))) {
+    while (fgets(line, sizeof line, fp)) {
+      if (strncmp(line, "0::", 3) == 0) {
+	line[strcspn(line, "\n")] = '\0';
+	snprintf(path, sizeof path, "%s%s/cpu.max", CGROUP_ROOT, line + 3);
+	break;
+      }
+    }
+    fclose(fp);
+  }
+
+  if ((path[0] && (fp = fopen(path, "r"))) ||
+      (fp = fopen(CGROUP_ROOT"/cpu.max", "r"))) {
+    if (fscanf(fp, "%31s %"SCNd64, quota, &nperiod) == 2 && strcmp(quota, "max") != 0) {
+      nquota = strtoll(quota, NULL, 10);
+    }
+    fclose(fp);
+  }
+  /* cgroup v1 */
+  else if ((fp = fopen(CGROUP_ROOT"/cpu/cpu.cfs_quota_us", "r"))) {
+    if (fscanf(fp, "%"SCNd64, &nquota) != 1) {
+      nquota = -1;
+    }
+    fclose(fp);
+    if ((fp = fopen(CGROUP_ROOT"/cpu/cpu.cfs_period_us", "r"))) {
+      if (fscanf(fp, "%"SCNd64, &nperiod) != 1) {
+	nperiod = 0;
+      }
+      fclose(fp);
+    }
+  }
+
+  if (nquota <= 0 || nperiod <= 0) {
+    return 0;
+  }
+  return (int32_t)((nquota + nperiod - 1) / nperiod);
+}
+
+
+/* To get the number of CPUs to be usable by the process,
+ * with the affinity mask and the CPU quota of cgroup.
+ * return: number of CPUs, at least 1
+ */
+extern int32_t
+get_usable_cpus(void)
+{
+  cpu_set_t cpus;
+  int32_t ncpus = 1, nquota;
+
+  if (sched_getaffinity(0, sizeof cpus, &cpus) == 0) {
+    ncpus = CPU_COUNT(&cpus);
+  }
+
+  nquota = get_cgroup_cpus();
+  if (nquota > 0 && nquota < ncpus) {
+    ncpus = nquota;
+  }
+
+  return ncpus > 0 ? ncpus : 1;
+}
+
+
+/* To pin the calling thread on the index-th CPU usable by the process, counted cyclically.
+ * return: the CPU number, or -1 on failure
+ */
+extern int32_t
+pin_thread_cpu(int32_t index)
+{
+  cpu_set_t cpus;
+  cpu_set_t one;
+  int32_t ncpus;
+  int32_t cpu;
+
+  if (sched_getaffinity(0, sizeof cpus, &cpus) == -1 || (ncpus = CPU_COUNT(&cpus)) == 0) {
+    return -1;
+  }
+
+  index %= ncpus;
+  for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &cpus) && index-- == 0) {
+      CPU_ZERO(&one);
+      CPU_SET(cpu, &one);
+      /* 0 is the calling thread */
+      if (sched_setaffinity(0, sizeof one, &one) == -1) {
+	return -1;
+      }
+      return cpu;
+    }
+  }
+
+  return -1;
+}
+
+
+/* To hash a string by FNV-1a.
+ * return: the hash value
+ */
+extern uint32_t
+hash_string(const char *str)
+{
+  uint32_t h = 2166136261U;
+
+  for (; *str; str++) {
+    h = (h ^ (uint8_t)*str) * 16777619U;
+  }
+  return h;
+}
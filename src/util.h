@@ -29,6 +29,11 @@
 
 
 extern int32_t join_path(const char *head, const char *tail, char *buf, size_t bufsize);
+extern int64_t get_monotonic_msec(void);
+extern int64_t get_monotonic_usec(void);
+extern int32_t get_usable_cpus(void);
+extern int32_t pin_thread_cpu(int32_t index);
+extern uint32_t hash_string(const char *str);
 
 
 #endif	/* _UTIL_H_ */
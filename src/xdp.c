@@ -0,0 +1,496 @@
+/*
+ * xdp.c
+ *
+ * Copyright (c) 2012, Daisuke Sato <bigsplint@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_AF_XDP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+
+#include "iw_common.h"
+#include "xdp.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+/* the rings are shared with the kernel */
+#define LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/* kicks of sending, while the kernel takes a batch at a time */
+#define XSK_KICK_MAX 64
+
+/* eBPF instructions */
+#define INSN(c, d, s, o, i) ((struct bpf_insn){ .code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i) })
+#define MOV64_REG(d, s) INSN(BPF_ALU64 | BPF_MOV | BPF_X, d, s, 0, 0)
+#define MOV64_IMM(d, i) INSN(BPF_ALU64 | BPF_MOV | BPF_K, d, 0, 0, i)
+#define ADD64_IMM(d, i) INSN(BPF_ALU64 | BPF_ADD | BPF_K, d, 0, 0, i)
+#define AND32_IMM(d, i) INSN(BPF_ALU | BPF_AND | BPF_K, d, 0, 0, i)
+#define TO_HOST16(d) INSN(BPF_ALU | BPF_END | BPF_TO_BE, d, 0, 0, 16)
+#define LDX_MEM(sz, d, s, o) INSN(BPF_LDX | BPF_MEM | (sz), d, s, o, 0)
+#define LD_MAP_FD(d, fd) INSN(BPF_LD | BPF_DW | BPF_IMM, d, BPF_PSEUDO_MAP_FD, 0, fd), INSN(0, 0, 0, 0, 0)
+#define JMP_REG(op, d, s, o) INSN(BPF_JMP | (op) | BPF_X, d, s, o, 0)
+#define JMP_IMM(op, d, i, o) INSN(BPF_JMP | (op) | BPF_K, d, 0, o, i)
+#define CALL(f) INSN(BPF_JMP | BPF_CALL, 0, 0, 0, f)
+#define EXIT() INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+
+/* jump from the instruction at i to the end of the program, which passes the packet */
+#define XDP_PROG_PASS 28
+#define TO_PASS(i) (XDP_PROG_PASS - (i) - 1)
+
+
+static int
+sys_bpf(int cmd, union bpf_attr *attr)
+{
+  return syscall(__NR_bpf, cmd, attr, sizeof(union bpf_attr));
+}
+
+
+/* To create the XSKMAP, and load the program redirecting IPv4 UDP packets to port
+ * or minport-maxport into the socket of the receive queue. Other packets, and packets
+ * of a queue without socket, go to the kernel stack.
+ * return: IW_OK, or IW_ERR with errno
+ */
+extern int32_t
+xdp_load(struct xdpprog *xp, uint16_t port, uint16_t minport, uint16_t maxport)
+{
+  union bpf_attr attr;
+  int err;
+
+  xp->mapfd = xp->progfd = xp->linkfd = -1;
+  xp->fgeneric = IW_FALSE;
+
+  memset(&attr, 0, sizeof attr);
+  attr.map_type = BPF_MAP_TYPE_XSKMAP;
+  attr.key_size = sizeof(uint32_t);
+  attr.value_size = sizeof(uint32_t);
+  attr.max_entries = XSK_QUEUES_MAX;
+  if ((xp->mapfd = sys_bpf(BPF_MAP_CREATE, &attr)) == -1) {
+    return IW_ERR;
+  }
+
+  {
+    /* r2: packet, r3: end of packet, r4: field, r6: context (struct xdp_md) */
+    struct bpf_insn insns[] = {
+      /*  0 */ MOV64_REG(BPF_REG_6, BPF_REG_1),
+      /*  1 */ LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_6, 0),
+      /*  2 */ LDX_MEM(BPF_W, BPF_REG_3, BPF_REG_6, 4),
+      /* Ethernet, IPv4 without options and UDP headers */
+      /*  3 */ MOV64_REG(BPF_REG_4, BPF_REG_2),
+      /*  4 */ ADD64_IMM(BPF_REG_4, 42),
+      /*  5 */ JMP_REG(BPF_JGT, BPF_REG_4, BPF_REG_3, TO_PASS(5)),
+      /*  6 */ LDX_MEM(BPF_H, BPF_REG_4, BPF_REG_2, 12),
+      /*  7 */ TO_HOST16(BPF_REG_4),
+      /*  8 */ JMP_IMM(BPF_JNE, BPF_REG_4, 0x0800, TO_PASS(8)),
+      /*  9 */ LDX_MEM(BPF_B, BPF_REG_4, BPF_REG_2, 14),
+      /* 10 */ JMP_IMM(BPF_JNE, BPF_REG_4, 0x45, TO_PASS(10)),
+      /* 11 */ LDX_MEM(BPF_B, BPF_REG_4, BPF_REG_2, 23),
+      /* 12 */ JMP_IMM(BPF_JNE, BPF_REG_4, 17, TO_PASS(12)),
+      /* fragments are left to the kernel for reassembly */
+      /* 13 */ LDX_MEM(BPF_H, BPF_REG_4, BPF_REG_2, 20),
+      /* 14 */ TO_HOST16(BPF_REG_4),
+      /* 15 */ AND32_IMM(BPF_REG_4, 0x3fff),
+      /* 16 */ JMP_IMM(BPF_JNE, BPF_REG_4, 0, TO_PASS(16)),
+      /* destination port */
+      /* 17 */ LDX_MEM(BPF_H, BPF_REG_4, BPF_REG_2, 36),
+      /* 18 */ TO_HOST16(BPF_REG_4),
+      /* 19 */ JMP_IMM(BPF_JEQ, BPF_REG_4, port, 2),
+      /* 20 */ JMP_IMM(BPF_JLT, BPF_REG_4, minport, TO_PASS(20)),
+      /* 21 */ JMP_IMM(BPF_JGT, BPF_REG_4, maxport, TO_PASS(21)),
+      /* bpf_redirect_map(map, rx_queue_index, XDP_PASS) */
+      /* 22 */ LD_MAP_FD(BPF_REG_1, xp->mapfd),
+      /* 24 */ LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_6, 16),
+      /* 25 */ MOV64_IMM(BPF_REG_3, XDP_PASS),
+      /* 26 */ CALL(BPF_FUNC_redirect_map),
+      /* 27 */ EXIT(),
+      /* 28 */ MOV64_IMM(BPF_REG_0, XDP_PASS),
+      /* 29 */ EXIT(),
+    };
+
+    memset(&attr, 0, sizeof attr);
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.expected_attach_type = BPF_XDP;
+    attr.insns = (uint64_t)(uintptr_t)insns;
+    attr.insn_cnt = sizeof insns / sizeof insns[0];
+    attr.license = (uint64_t)(uintptr_t)"Dual BSD/GPL";
+    strncpy(attr.prog_name, "iwtftpd", sizeof attr.prog_name - 1);
+    if ((xp->progfd = sys_bpf(BPF_PROG_LOAD, &attr)) == -1) {
+      goto err;
+    }
+  }
+
+  return IW_OK;
+
+ err:
+  err = errno;
+  xdp_exit(xp);
+  errno = err;
+  return IW_ERR;
+}
+
+
+/* To attach the program to the device, in driver mode if supported, or generic
+ * (SKB) mode for any device, e.g. veth. It is detached when the process exits.
+ * return: IW_OK, or IW_ERR with errno
+ */
+extern int32_t
+xdp_attach(struct xdpprog *xp, int ifindex)
+{
+  union bpf_attr attr;
+
+  memset(&attr, 0, sizeof attr);
+  attr.link_create.prog_fd = xp->progfd;
+  attr.link_create.target_ifindex = ifindex;
+  attr.link_create.attach_type = BPF_XDP;
+  attr.link_create.flags = XDP_FLAGS_DRV_MODE;
+  if ((xp->linkfd = sys_bpf(BPF_LINK_CREATE, &attr)) >= 0) {
+    xp->fgeneric = IW_FALSE;
+    return IW_OK;
+  }
+
+  attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+  if ((xp->linkfd = sys_bpf(BPF_LINK_CREATE, &attr)) >= 0) {
+    xp->fgeneric = IW_TRUE;
+    return IW_OK;
+  }
+
+  return IW_ERR;
+}
+
+
+/* To detach and unload the program. */
+extern void
+xdp_exit(struct xdpprog *xp)
+{
+  if (xp->linkfd >= 0) {
+    close(xp->linkfd);
+  }
+  if (xp->progfd >= 0) {
+    close(xp->progfd);
+  }
+  if (xp->mapfd >= 0) {
+    close(xp->mapfd);
+  }
+  xp->mapfd = xp->progfd = xp->linkfd = -1;
+}
+
+
+/* To count the receive queues of the device, a socket is bound to each.
+ * return: number of queues, at least 1
+ */
+extern int32_t
+xdp_count_queues(const char *ifname)
+{
+  char path[128];
+  int32_t n;
+
+  for (n = 0; n < XSK_QUEUES_MAX; n++) {
+    snprintf(path, sizeof path, "/sys/class/net/%s/queues/rx-%d", ifname, n);
+    if (access(path, F_OK) == -1) {
+      break;
+    }
+  }
+  return n > 0 ? n : 1;
+}
+
+
+static int32_t
+map_ring(struct xskring *r, int fd, struct xdp_ring_offset *off, size_t descsize, off_t pgoff)
+{
+  r->mapsize = off->desc + XSK_RING_SIZE * descsize;
+  if ((r->map = mmap(NULL, r->mapsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		     fd, pgoff)) == MAP_FAILED) {
+    return IW_ERR;
+  }
+
+  r->producer = (uint32_t *)((uint8_t *)r->map + off->producer);
+  r->consumer = (uint32_t *)((uint8_t *)r->map + off->consumer);
+  r->descs = (uint8_t *)r->map + off->desc;
+  r->size = XSK_RING_SIZE;
+  r->mask = XSK_RING_SIZE - 1;
+  return IW_OK;
+}
+
+
+static void
+unmap_ring(struct xskring *r)
+{
+  if (r->map && r->map != MAP_FAILED) {
+    munmap(r->map, r->mapsize);
+  }
+  r->map = NULL;
+}
+
+
+/* To create the socket bound to the queue of the device, and add it to the XSKMAP.
+ * Zero-copy mode is tried if fzerocopy, falling back to copy mode.
+ * return: IW_OK, or IW_ERR with errno
+ */
+extern int32_t
+xsk_init(struct xsk *xs, int ifindex, uint32_t queue, int mapfd, int32_t fzerocopy)
+{
+  struct xdp_umem_reg mr;
+  struct xdp_mmap_offsets off;
+  struct sockaddr_xdp sxdp;
+  union bpf_attr attr;
+  socklen_t optlen;
+  uint32_t i;
+  int size = XSK_RING_SIZE;
+  int err;
+
+  memset(xs, 0, sizeof(struct xsk));
+  xs->queue = queue;
+  xs->umem = MAP_FAILED;
+
+  if ((xs->fd = socket(AF_XDP, SOCK_RAW, 0)) == -1) {
+    return IW_ERR;
+  }
+
+  /* UMEM, the first half is for receiving */
+  if ((xs->umem = mmap(NULL, (size_t)XSK_NFRAMES * XSK_FRAME_SIZE, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+    goto err;
+  }
+  memset(&mr, 0, sizeof mr);
+  mr.addr = (uint64_t)(uintptr_t)xs->umem;
+  mr.len = (uint64_t)XSK_NFRAMES * XSK_FRAME_SIZE;
+  mr.chunk_size = XSK_FRAME_SIZE;
+  if (setsockopt(xs->fd, SOL_XDP, XDP_UMEM_REG, &mr, sizeof mr) == -1) {
+    goto err;
+  }
+
+  if (setsockopt(xs->fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof size) == -1 ||
+      setsockopt(xs->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof size) == -1 ||
+      setsockopt(xs->fd, SOL_XDP, XDP_RX_RING, &size, sizeof size) == -1 ||
+      setsockopt(xs->fd, SOL_XDP, XDP_TX_RING, &size, sizeof size) == -1) {
+    goto err;
+  }
+
+  optlen = sizeof off;
+  if (getsockopt(xs->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) == -1) {
+    goto err;
+  }
+  if (map_ring(&xs->fill, xs->fd, &off.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) == IW_ERR ||
+      map_ring(&xs->comp, xs->fd, &off.cr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) == IW_ERR ||
+      map_ring(&xs->rx, xs->fd, &off.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) == IW_ERR ||
+      map_ring(&xs->tx, xs->fd, &off.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING) == IW_ERR) {
+    goto err;
+  }
+  xs->fill.local = *xs->fill.producer;
+  xs->comp.local = *xs->comp.consumer;
+  xs->rx.local = *xs->rx.consumer;
+  xs->tx.local = *xs->tx.producer;
+
+  memset(&sxdp, 0, sizeof sxdp);
+  sxdp.sxdp_family = AF_XDP;
+  sxdp.sxdp_ifindex = ifindex;
+  sxdp.sxdp_queue_id = queue;
+  sxdp.sxdp_flags = XDP_ZEROCOPY;
+  if (fzerocopy == IW_TRUE && bind(xs->fd, (struct sockaddr *)&sxdp, sizeof sxdp) == 0) {
+    xs->fzerocopy = IW_TRUE;
+  }
+  else {
+    sxdp.sxdp_flags = XDP_COPY;
+    if (bind(xs->fd, (struct sockaddr *)&sxdp, sizeof sxdp) == -1) {
+      goto err;
+    }
+  }
+
+  /* the rings can hold all frames, so they never overflow */
+  for (i = 0; i < XSK_NFRAMES / 2; i++) {
+    ((uint64_t *)xs->fill.descs)[xs->fill.local++ & xs->fill.mask] = (uint64_t)i * XSK_FRAME_SIZE;
+  }
+  STORE_RELEASE(xs->fill.producer, xs->fill.local);
+
+  if (! (xs->frees = malloc(sizeof(uint64_t) * (XSK_NFRAMES / 2)))) {
+    errno = ENOMEM;
+    goto err;
+  }
+  for (i = XSK_NFRAMES / 2; i < XSK_NFRAMES; i++) {
+    xs->frees[xs->nfrees++] = (uint64_t)i * XSK_FRAME_SIZE;
+  }
+
+  memset(&attr, 0, sizeof attr);
+  attr.map_fd = mapfd;
+  attr.key = (uint64_t)(uintptr_t)&xs->queue;
+  attr.value = (uint64_t)(uintptr_t)&xs->fd;
+  if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) == -1) {
+    goto err;
+  }
+
+  return IW_OK;
+
+ err:
+  err = errno;
+  xsk_exit(xs);
+  errno = err;
+  return IW_ERR;
+}
+
+
+/* To close the socket, it is removed from the XSKMAP by the kernel. */
+extern void
+xsk_exit(struct xsk *xs)
+{
+  unmap_ring(&xs->fill);
+  unmap_ring(&xs->comp);
+  unmap_ring(&xs->rx);
+  unmap_ring(&xs->tx);
+  if (xs->fd >= 0) {
+    close(xs->fd);
+  }
+  xs->fd = -1;
+  if (xs->umem != MAP_FAILED) {
+    munmap(xs->umem, (size_t)XSK_NFRAMES * XSK_FRAME_SIZE);
+  }
+  xs->umem = MAP_FAILED;
+  free(xs->frees);
+  xs->frees = NULL;
+}
+
+
+/* To take the next received packet, the frame is given back by xsk_recv_done().
+ * return: the packet and its frame in addr, or NULL if nothing
+ */
+extern uint8_t *
+xsk_recv(struct xsk *xs, uint64_t *addr, uint32_t *len)
+{
+  struct xdp_desc *desc;
+
+  if (xs->rx.local == LOAD_ACQUIRE(xs->rx.producer)) {
+    return NULL;
+  }
+  desc = &((struct xdp_desc *)xs->rx.descs)[xs->rx.local++ & xs->rx.mask];
+  *addr = desc->addr;
+  *len = desc->len;
+
+  return xs->umem + desc->addr;
+}
+
+
+/* To give the frame of a received packet back for receiving. */
+extern void
+xsk_recv_done(struct xsk *xs, uint64_t addr)
+{
+  ((uint64_t *)xs->fill.descs)[xs->fill.local++ & xs->fill.mask] = addr & ~(uint64_t)(XSK_FRAME_SIZE - 1);
+}
+
+
+/* To publish the taken packets and the given frames to the kernel. */
+extern void
+xsk_release(struct xsk *xs)
+{
+  STORE_RELEASE(xs->rx.consumer, xs->rx.local);
+  STORE_RELEASE(xs->fill.producer, xs->fill.local);
+}
+
+
+/* To get a free frame for sending, collecting the frames sent by the kernel.
+ * return: the frame and its address in addr, or NULL if all are in flight
+ */
+extern uint8_t *
+xsk_get_frame(struct xsk *xs, uint64_t *addr)
+{
+  uint32_t prod;
+
+  if (xs->nfrees == 0) {
+    prod = LOAD_ACQUIRE(xs->comp.producer);
+    while (xs->comp.local != prod) {
+      xs->frees[xs->nfrees++] = ((uint64_t *)xs->comp.descs)[xs->comp.local++ & xs->comp.mask];
+    }
+    STORE_RELEASE(xs->comp.consumer, xs->comp.local);
+    if (xs->nfrees == 0) {
+      return NULL;
+    }
+  }
+  *addr = xs->frees[--xs->nfrees];
+
+  return xs->umem + *addr;
+}
+
+
+/* To give back a frame from xsk_get_frame() which is not sent. */
+extern void
+xsk_put_frame(struct xsk *xs, uint64_t addr)
+{
+  xs->frees[xs->nfrees++] = addr;
+}
+
+
+/* To queue the packet of len on the frame, sent by xsk_kick().
+ * return: IW_OK
+ */
+extern int32_t
+xsk_send(struct xsk *xs, uint64_t addr, uint32_t len)
+{
+  struct xdp_desc *desc;
+
+  /* the frames for sending are fewer than the entries */
+  desc = &((struct xdp_desc *)xs->tx.descs)[xs->tx.local++ & xs->tx.mask];
+  desc->addr = addr;
+  desc->len = len;
+  desc->options = 0;
+
+  return IW_OK;
+}
+
+
+/* To make the kernel send the queued packets, ncalls is the number of system calls.
+ * In copy mode the kernel sends a batch per call, so it is kicked until all are taken,
+ * the driver of zero-copy mode takes them after a kick.
+ * return: IW_OK, or IW_ERR with errno
+ */
+extern int32_t
+xsk_kick(struct xsk *xs, uint32_t *ncalls)
+{
+  STORE_RELEASE(xs->tx.producer, xs->tx.local);
+
+  for (*ncalls = 0; *ncalls < XSK_KICK_MAX && LOAD_ACQUIRE(xs->tx.consumer) != xs->tx.local; ) {
+    if (*ncalls > 0 && xs->fzerocopy == IW_TRUE) {
+      break;
+    }
+    (*ncalls)++;
+    if (sendto(xs->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) == -1 &&
+	errno != EAGAIN && errno != EBUSY && errno != ENOBUFS) {
+      return IW_ERR;
+    }
+  }
+
+  return IW_OK;
+}
+
+#endif	/* HAVE_AF_XDP */
@@ -0,0 +1,100 @@
+/*
+ * xdp.h
+ *
+ * Copyright (c) 2012, Daisuke Sato <bigsplint@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _XDP_H_
+#define _XDP_H_
+
+/* AF_XDP sockets fed by an XDP program (Linux 5.9), checked by cmake */
+#ifdef HAVE_AF_XDP
+
+#include <stdint.h>
+#include <linux/if_xdp.h>
+
+
+/* constants */
+#define XSK_FRAME_SIZE 2048		/* size of a frame of UMEM */
+#define XSK_NFRAMES 4096		/* frames of UMEM, half for receiving and half for sending */
+#define XSK_RING_SIZE 2048		/* entries of each ring, power of 2 */
+#define XSK_RX_HEADROOM 256		/* the kernel puts received packets after this (XDP_PACKET_HEADROOM) */
+#define XSK_QUEUES_MAX 64		/* maximum number of receive queues of the device */
+
+
+/* a ring shared with the kernel */
+struct xskring {
+  uint32_t *producer;
+  uint32_t *consumer;
+  void *descs;			/* struct xdp_desc (RX/TX), or uint64_t (FILL/COMPLETION) */
+  uint32_t mask;
+  uint32_t size;
+  uint32_t local;		/* our index, producer or consumer, not published yet */
+  void *map;
+  size_t mapsize;
+};
+
+/* AF_XDP socket bound to a receive queue, with its own UMEM */
+struct xsk {
+  int fd;			/* AF_XDP socket */
+  uint32_t queue;		/* receive queue of the device */
+  uint8_t *umem;		/* frames */
+  struct xskring fill;		/* frames given to the kernel for receiving */
+  struct xskring comp;		/* frames sent by the kernel */
+  struct xskring rx;		/* received packets */
+  struct xskring tx;		/* packets to be sent */
+  uint64_t *frees;		/* stack of free frames for sending */
+  uint32_t nfrees;		/* number of free frames */
+  int32_t fzerocopy;		/* flag of whether bound in zero-copy mode */
+};
+
+/* XDP program redirecting UDP packets of the ports to the sockets */
+struct xdpprog {
+  int mapfd;			/* XSKMAP, by receive queue */
+  int progfd;			/* program */
+  int linkfd;			/* attachment to the device, detached by closing */
+  int32_t fgeneric;		/* flag of whether attached in generic (SKB) mode */
+};
+
+
+extern int32_t xdp_load(struct xdpprog *xp, uint16_t port, uint16_t minport, uint16_t maxport);
+extern int32_t xdp_attach(struct xdpprog *xp, int ifindex);
+extern void xdp_exit(struct xdpprog *xp);
+extern int32_t xdp_count_queues(const char *ifname);
+extern int32_t xsk_init(struct xsk *xs, int ifindex, uint32_t queue, int mapfd, int32_t fzerocopy);
+extern void xsk_exit(struct xsk *xs);
+
+/* receiving */
+extern uint8_t *xsk_recv(struct xsk *xs, uint64_t *addr, uint32_t *len);
+extern void xsk_recv_done(struct xsk *xs, uint64_t addr);
+extern void xsk_release(struct xsk *xs);
+
+/* sending */
+extern uint8_t *xsk_get_frame(struct xsk *xs, uint64_t *addr);
+extern void xsk_put_frame(struct xsk *xs, uint64_t addr);
+extern int32_t xsk_send(struct xsk *xs, uint64_t addr, uint32_t len);
+extern int32_t xsk_kick(struct xsk *xs, uint32_t *ncalls);
+
+#endif	/* HAVE_AF_XDP */
+
+#endif	/* _XDP_H_ */